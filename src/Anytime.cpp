@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "Anytime.h"
+
+using namespace std;
+
+namespace tricrf {
+
+/** Constructor.
+	@param budget_ms	decoding time per sequence in milliseconds (0 for no budget)
+*/
+DecodeBudget::DecodeBudget(double budget_ms) {
+	m_Budget = (budget_ms > 0.0 ? budget_ms / 1000.0 : 0.0);
+	m_Rate = 0.0;
+	m_Count.assign(N_LEVEL, 0);
+	m_Over = 0;
+	m_Max = 0.0;
+}
+
+void DecodeBudget::start() {
+	m_Timer.restart();
+}
+
+/** Whether the work is predicted to finish within the budget.
+	Before the first measurement the work is assumed to fit (it gives the first estimate).
+	@param cells	work of the step
+*/
+bool DecodeBudget::fits(double cells) const {
+	if (!enabled())
+		return true;
+	return m_Timer.elapsed() + m_Rate * cells <= m_Budget;
+}
+
+/** Update the time per cell with a step just run (moving average).
+	@param cells	work of the step
+	@param seconds	time of the step
+*/
+void DecodeBudget::measure(double cells, double seconds) {
+	if (!enabled() || cells <= 0.0)
+		return;
+	double rate = seconds / cells;
+	m_Rate = (m_Rate > 0.0 ? 0.9 * m_Rate + 0.1 * rate : rate);
+}
+
+/** Drop the least probable topics until the best-path search over the rest fits the budget.
+	@param topics	(probability, topic) of the topics to be searched, the most probable first
+	@param cells	work of the search of each topic
+	@return FULL if no topic is dropped, PRUNED if some are, or GREEDY if even the best topic does not fit
+*/
+DecodeBudget::Level DecodeBudget::trim(vector<pair<long double, size_t> >& topics, const vector<double>& cells) const {
+	double total = 0.0;
+	for (size_t i = 0; i < topics.size(); i++)
+		total += cells[topics[i].second];
+	Level level = FULL;
+	while (topics.size() > 1 && !fits(total)) {
+		total -= cells[topics.back().second];
+		topics.pop_back();
+		level = PRUNED;
+	}
+	if (!fits(total))
+		level = GREEDY;
+	return level;
+}
+
+/** Finish decoding a sequence.
+	While falling back, the time per cell decays, so that an overestimate (e.g. of a cold start)
+	is corrected by trying the full decoding again.
+	@param level	decoder used
+*/
+void DecodeBudget::finish(Level level) {
+	++m_Count[level];
+	if (level != FULL)
+		m_Rate *= 0.95;
+	double elapsed = m_Timer.elapsed();
+	if (enabled() && elapsed > m_Budget)
+		++m_Over;
+	if (elapsed > m_Max)
+		m_Max = elapsed;
+}
+
+/// Add the counts of another budget (e.g. of a thread)
+void DecodeBudget::merge(const DecodeBudget& budget) {
+	for (size_t i = 0; i < m_Count.size(); i++)
+		m_Count[i] += budget.m_Count[i];
+	m_Over += budget.m_Over;
+	if (budget.m_Max > m_Max)
+		m_Max = budget.m_Max;
+}
+
+/// Report the fallbacks used
+void DecodeBudget::report(Logger *logger) const {
+	if (!enabled())
+		return;
+	logger->report("[Anytime decoding]\n");
+	logger->report("  budget = \t\t%.3f ms/seq\n", m_Budget * 1000.0);
+	logger->report("  full = \t\t%d\n", m_Count[FULL]);
+	logger->report("  pruned topics = \t%d\n", m_Count[PRUNED]);
+	logger->report("  topic first = \t%d\n", m_Count[TOPIC]);
+	logger->report("  greedy = \t\t%d\n", m_Count[GREEDY]);
+	logger->report("  over budget = \t%d\n", m_Over);
+	logger->report("  max time = \t\t%.3f ms\n\n", m_Max * 1000.0);
+}
+
+} // namespace tricrf
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __ANYTIME_H__
+#define __ANYTIME_H__
+
+/// max headers
+#include "Utility.h"
+/// standard headers
+#include <vector>
+#include <utility>
+
+namespace tricrf {
+
+/** Time budget of decoding a sequence (anytime decoding).
+	The work of each decoding step is counted in cells (positions x states x states of a chain),
+	and the time per cell is estimated from the steps already run. A step is taken only if it is
+	predicted to finish within the budget; otherwise the decoder falls back to a cheaper one:
+	fewer topics (PRUNED), the topic chosen by its own features without the forward pass (TOPIC),
+	or the greedy left-to-right labeling (GREEDY).
+	Without a budget, every sequence is decoded in full.
+	@class DecodeBudget
+*/
+class DecodeBudget {
+public:
+	enum Level { FULL = 0, PRUNED, TOPIC, GREEDY, N_LEVEL };
+
+private:
+	double m_Budget;		///< seconds per sequence (0 for no budget)
+	double m_Rate;			///< estimated seconds per cell (0 before the first step)
+	wall_timer m_Timer;		///< the current sequence
+	std::vector<size_t> m_Count;	///< sequences decoded at each level
+	size_t m_Over;			///< sequences over the budget anyway
+	double m_Max;			///< longest decoding time
+
+public:
+	DecodeBudget(double budget_ms = 0.0);
+	bool enabled() const { return m_Budget > 0.0; };
+	void start();		///< Start decoding a sequence
+	bool fits(double cells) const;	///< Whether the work is predicted to finish within the budget
+	void measure(double cells, double seconds);	///< Update the time per cell
+	Level trim(std::vector<std::pair<long double, size_t> >& topics, const std::vector<double>& cells) const;
+	void finish(Level level);	///< Finish decoding a sequence at the given level
+	void merge(const DecodeBudget& budget);
+	void report(Logger *logger) const;
+};
+
+} // namespace tricrf
+
+#endif
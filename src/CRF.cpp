@@ -7,11 +7,14 @@
 
 /// max headers
 #include "CRF.h"
+#include "Parallel.h"
 #include "Evaluator.h"
 #include "Utility.h"
 #include "LBFGS.h"
+#include "Chain.h"
 /// standard headers
 #include <cassert>
+#include <cstdlib>
 #include <cfloat>
 #include <cmath>
 #include <limits>
@@ -19,6 +22,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #define MAT3(I, X, Y)	((m_state_size * m_state_size * (I)) + (m_state_size * (X)) + Y)
 #define MAT2(I, X)		((m_state_size * (I)) + X)
@@ -31,6 +35,13 @@ namespace tricrf {
 */
 CRF::CRF() {
 	m_default_oid = 0;
+	m_CorpusWindow = 0;
+	m_mixing_workers = 1;
+	m_mixing_rate = 0.1;
+	m_skip_threshold = 0.0;
+	m_skip_exact = 0;
+	m_coarse_prune = 0.0;
+	m_coarse_exact = true;
 }
 
 CRF::CRF(Logger *logger) {
@@ -38,6 +49,18 @@ CRF::CRF(Logger *logger) {
 	logger->report(MAX_HEADER);
 	logger->report(">> Conditional Random Fields << \n\n");
 	m_default_oid = 0;
+	m_CorpusWindow = 0;
+	m_mixing_workers = 1;
+	m_mixing_rate = 0.1;
+	m_skip_threshold = 0.0;
+	m_skip_exact = 0;
+	m_coarse_prune = 0.0;
+	m_coarse_exact = true;
+}
+
+CRF::~CRF() {
+	for (size_t t = 0; t < m_ThreadGradient.size(); t++)
+		delete m_ThreadGradient[t];
 }
 
 void CRF::clear() {
@@ -98,6 +121,7 @@ bool CRF::loadModel(const std::string& filename) {
     string line;
     getline(f, line);
     while (line.empty() || line[0] == '#') {
+		readMetadata(count, line);
 		if (count == 1) {
 			vector<string> tok = tokenize(line);
 			if (tok.size() < 2 || tok[1] != "CRF") {
@@ -115,20 +139,24 @@ bool CRF::loadModel(const std::string& filename) {
 	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
 	
 	/// to be used in inference
-	m_Param.makeStateIndex();
-	m_state_size = m_Param.sizeStateVec();
+	prepareInference();
 
 	return ret;
 }
 
-/**	Read the data from file
+void CRF::prepareInference() {
+	m_Param.makeStateIndex();
+	m_state_size = m_Param.sizeStateVec();
+}
+
+/**	Read the data from a stream
 */
-void CRF::readTrainData(const string& filename) {
-	/// File stream
+void CRF::readTrainData(istream& in) {
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 
 	// Make a state space Y
 	while ( getline(f, line) ) {
@@ -168,11 +196,16 @@ void CRF::readTrainData(const string& filename) {
 	/// To reduce the storage and computation
 	map<vector<vector<string> >, size_t> train_data_map;
 	vector<vector<string> > token_list;
+	CorpusWriter corpus;
+	if (m_CorpusFile != "")
+		corpus.open(m_CorpusFile);
 
 	while (getline(f,line)) {
 		vector<string> tokens = tokenize(line, " \t");
 		if (line.empty() || tokens.size() <= 0) {	 ///< sequence break
-			if (train_data_map.find(token_list) == train_data_map.end()) {
+			if (m_CorpusFile != "") {
+				corpus.write(seq);	///< streamed as it is, not to keep the corpus in memory
+			} else if (train_data_map.find(token_list) == train_data_map.end()) {
 				m_TrainSet.append(seq);
 				train_data_map.insert(make_pair(token_list, m_TrainSetCount.size()));
 				m_TrainSetCount.push_back(1.0);
@@ -209,20 +242,255 @@ void CRF::readTrainData(const string& filename) {
 	m_Param.endUpdate();
 
 	logger->report("  # of data = \t\t%d\n", count);
-	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
+	logger->report("  loading time = \t%.3f\n", stop_watch.elapsed());
+	if (m_CorpusFile != "") {
+		corpus.close();
+		m_Corpus.open(m_CorpusFile, m_CorpusWindow);
+		logger->report("  packed corpus = \t%s (%.1f MB)\n", m_CorpusFile.c_str(), corpus.bytes() / 1048576.0);
+	}
+	logger->report("\n");
+
+	m_CorpusPid.clear();
+	if (m_renumber) {
+		vector<size_t> pid_map = renumberFeatures();
+		if (m_CorpusFile != "")
+			m_CorpusPid.swap(pid_map);	///< the packed corpus is renumbered while streaming
+	}
+	if (m_CorpusFile == "")
+		reorderTrainSet();
 	
 	m_Param.makeStateIndex();
 	m_state_size = m_Param.sizeStateVec();
 }
 
-/**	Read the data from file
+/** Train out-of-core.
+	The training data are packed into a binary corpus file while reading,
+	and streamed from the file with a background read-ahead in each pass.
+	Duplicated sequences are not merged, since the merging needs the whole corpus in memory.
+	@param filename	packed corpus file
+	@param window	read-ahead window in bytes
+*/
+void CRF::setOutOfCore(const string& filename, size_t window) {
+	m_CorpusFile = filename;
+	m_CorpusWindow = window;
+}
+
+/** Start a pass over the training data.
+	@return cursor for nextTrainSeq()
+*/
+size_t CRF::firstTrainSeq() {
+	if (m_CorpusFile != "")
+		m_Corpus.rewind();
+	return 0;
+}
+
+/** Get the next training sequence.
+	@param n	cursor (in-memory training)
+	@param seq	sequence
+	@param count	count of the sequence
+	@return false at the end of the pass
+*/
+bool CRF::nextTrainSeq(size_t& n, Sequence*& seq, double& count) {
+	if (m_CorpusFile != "") {
+		if (!m_Corpus.next(m_StreamSeq, count))
+			return false;
+		for (size_t t = 0; m_CorpusPid.size() > 0 && t < m_StreamSeq.size(); t++) {
+			vector<pair<size_t, double> >& obs = m_StreamSeq[t].obs;
+			for (size_t j = 0; j < obs.size(); j++)
+				obs[j].first = m_CorpusPid[obs[j].first];
+		}
+		seq = &m_StreamSeq;
+		return true;
+	}
+	if (n >= m_TrainSet.size())
+		return false;
+	seq = &m_TrainSet[n];
+	count = m_TrainSetCount[n];
+	++n;
+	return true;
+}
+
+/** Gradient of one sequence (the expectation part), for the sequential, threaded and mixing training.
+	@param seq	training sequence
+	@param count	count of the sequence
+	@param buf	inference buffers
+	@param grad	gradient sink (GradientBuffer, or DirectGradient)
+	@param hypothesis	best path
+	@return prob. of the reference
 */
-void CRF::readDevData(const string& filename) {
-	/// File stream
+template <class G>
+long double CRF::sequenceGradient(Sequence& seq, double count, ChainBuffer& buf, G& grad, vector<size_t>& hypothesis) {
+	/// Forward-Backward  
+	calculateFactors(seq, buf.seq_size, buf.R);
+	forward(buf.seq_size, buf.R, buf.Alpha, buf.scale);
+	backward(buf.seq_size, buf.R, buf.Beta, buf.scale2);
+	long double zval = buf.Alpha[MAT2(buf.seq_size-1, m_default_oid)];
+
+	/// Evaluation
+	long double dummy_prob;
+	hypothesis = viterbiSearch(buf.seq_size, buf.R, dummy_prob);
+	long double y_seq_prob = calculateProb(seq, buf.seq_size, buf.R, buf.Alpha, buf.scale);
+
+	// for scaling factor
+	size_t seq_size = buf.seq_size;
+	vector<long double> prod_scale, prod_scale2;
+	long double prod = 1.0;
+	for (int a = seq_size-1; a >= 0; a--) {
+		prod *= buf.scale[a];
+		prod_scale.push_back(prod);
+	}
+	reverse(prod_scale.begin(), prod_scale.end());
+	prod = 1.0;
+	for (int a = seq_size-1; a >= 0; a--) {
+		prod *= buf.scale2[a];
+		prod_scale2.push_back(prod);
+	}
+	reverse(prod_scale2.begin(), prod_scale2.end());
+
+	/// E[~p] - E[p]
+	Sequence::iterator it = seq.begin();
+	for (size_t i = 0; it != seq.end(); ++it, ++i) {	 /// for each node
+		long double scale_factor = prod_scale2[i] / prod_scale[i+1];
+		long double scale_factor2 = prod_scale2[i] / prod_scale[i];
+
+		vector<pair<size_t, double> >::iterator iter = it->obs.begin();
+		for (; iter != it->obs.end(); iter++) {
+			vector<pair<size_t, size_t> >& param = m_Param.m_ParamIndex[iter->first];
+			for (size_t j = 0; j < param.size(); ++j) {
+				long double prob =  buf.Alpha[MAT2(i, param[j].first)] * buf.Beta[MAT2(i, param[j].first)] / zval;
+				prob *= scale_factor;
+				grad.add(param[j].second, prob * iter->second * count);
+			}
+		}
+
+		if (i > 0) {
+			vector<StateParam>::iterator iter = m_Param.m_StateIndex.begin();
+			for (; iter != m_Param.m_StateIndex.end(); ++iter) {
+				long double a_y = buf.Alpha[MAT2(i-1, iter->y1)];
+				long double b_y = buf.Beta[MAT2(i, iter->y2)];
+				long double m_yy = buf.R[MAT2(i,iter->y2)] * m_M2[MAT2(iter->y1,iter->y2)];
+				long double prob = a_y * b_y * m_yy / zval;
+				prob *= scale_factor2;
+				grad.add(iter->fid, prob * iter->fval * count);
+			}
+		}
+	} ///< for sequence
+
+	return y_seq_prob;
+}
+
+/** Estimated cost of the inference on a sequence.
+	@param seq	sequence
+	@return cost (length x (transitions + observation parameters))
+*/
+double CRF::sequenceCost(Sequence& seq) {
+	double cost = 0.0;
+	for (Sequence::iterator it = seq.begin(); it != seq.end(); ++it) {
+		cost += m_state_size * m_state_size;
+		for (size_t j = 0; j < it->obs.size(); j++) {
+			if (it->obs[j].first < m_Param.m_ParamIndex.size())
+				cost += m_Param.m_ParamIndex[it->obs[j].first].size();
+		}
+	}
+	return cost + 1.0;
+}
+
+/// Resize a list of gradient buffers
+static void resizeBuffers(vector<GradientBuffer*>& buffers, size_t n, size_t size) {
+	if (buffers.size() > 0 && buffers[0]->blocks() != (size + GradientBuffer::BLOCK_SIZE - 1) / GradientBuffer::BLOCK_SIZE) {
+		for (size_t i = 0; i < buffers.size(); i++)	///< the number of parameters changed (e.g. by feature induction)
+			delete buffers[i];
+		buffers.clear();
+	}
+	for (size_t i = n; i < buffers.size(); i++)
+		delete buffers[i];
+	buffers.resize(min(n, buffers.size()));
+	while (buffers.size() < n)
+		buffers.push_back(new GradientBuffer(size));
+}
+
+/** Schedule the training sequences on the threads by their cost.
+	In the deterministic mode, the number of chunks is fixed, and each chunk has its own gradient buffer.
+*/
+void CRF::scheduleTrainSet() {
+	vector<double> cost(m_TrainSet.size(), 0.0);
+	for (size_t n = 0; n < m_TrainSet.size(); n++) {
+		if (m_TrainSetCount[n] != 0.0)	///< not held out
+			cost[n] = sequenceCost(m_TrainSet[n]);
+	}
+	m_Scheduler.schedule(cost, m_threads, 8, (m_deterministic ? 64 : 0));
+
+	m_ThreadChain.resize(m_threads);
+	resizeBuffers(m_ThreadGradient, (m_deterministic ? m_Scheduler.chunks() : m_threads), m_Param.size());
+}
+
+/// Gradient of a training sequence in a thread
+class GradientTask : public ItemTask {
+public:
+	CRF *crf;
+	void run(size_t thread, size_t chunk, size_t item) { crf->gradientItem(thread, chunk, item); }
+};
+
+/** Gradient of a training sequence.
+	@param thread	thread index
+	@param chunk	chunk index
+	@param n	index of the sequence
+*/
+void CRF::gradientItem(size_t thread, size_t chunk, size_t n) {
+	if (m_Skip.skipped(n))	///< approximated in parallelGradient
+		return;
+	GradientBuffer& grad = *m_ThreadGradient[m_deterministic ? chunk : thread];
+	m_SeqProb[n] = sequenceGradient(m_TrainSet[n], m_TrainSetCount[n], m_ThreadChain[thread], grad, m_SeqHypothesis[n]);
+}
+
+/** Expectation part of the gradient and the evaluation of the training set with multiple threads.
+	The sequences are run by the work-stealing scheduler (see scheduleTrainSet()). Each thread 
+	(or each chunk, in the deterministic mode) accumulates the gradient in a sparse buffer, and the buffers 
+	are reduced into the gradient over the touched blocks only. The evaluation is made in the order of the sequences.
+	In the deterministic mode, every sum is made in an order which does not depend on the number of threads:
+	the sequences of a chunk in the order of the chunk, the chunks in order, and the objective in the order of the sequences.
+	@param eval	evaluator
+*/
+void CRF::parallelGradient(Evaluator& eval) {
+	for (size_t t = 0; t < m_ThreadGradient.size(); t++)
+		m_ThreadGradient[t]->clear();
+	m_SeqProb.resize(m_TrainSet.size());
+	m_SeqHypothesis.resize(m_TrainSet.size());
+
+	GradientTask task;
+	task.crf = this;
+	m_Scheduler.run(task);
+	reduceGradient(m_ThreadGradient, m_Param.getGradient(), m_Param.size(), m_threads);
+
+	for (size_t n = 0; n < m_TrainSet.size(); n++) {
+		double count = m_TrainSetCount[n];
+		if (count == 0.0)	///< held out (cross-validation)
+			continue;
+		vector<size_t> reference;
+		for (Sequence::iterator it = m_TrainSet[n].begin(); it != m_TrainSet[n].end(); ++it)
+			reference.push_back(it->label);
+		if (m_Skip.skipped(n)) {	///< well fit: the expected counts of the reference, and the last loss
+			addPathFeatures(m_TrainSet[n], reference, count, m_Param.getGradient());
+			for (size_t c = 0; c < count; c++)
+				eval.addLikelihood(m_Skip.prob(n));	///< not decoded: left out of the accuracy and F1
+			continue;
+		}
+		m_Skip.update(n, m_SeqProb[n], count);
+		for (size_t c = 0; c < count; c++) {
+			eval.addLikelihood(m_SeqProb[n]);	/// loglikelihood
+			eval.append(reference, m_SeqHypothesis[n]);	/// evaluation (accuracy and f1 score)
+		}
+	}
+}
+
+/**	Read the data from a stream
+*/
+void CRF::readDevData(istream& in) {
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	
 	/// initializing
 	Sequence seq;
@@ -285,15 +553,24 @@ void CRF::calculateEdge() {
 		2) C. Sutton and A. McCallum, An Introduction to Conditional Random Fields for Relational Learning, 2006, Introduction to Statistical Relational Learning. Edited by Lise Getoor and Ben Taskar. MIT Press. 2006.
 */
 void CRF::calculateFactors(Sequence &seq) {
+	calculateFactors(seq, m_seq_size, m_R);
+}
+
+/**	Calculate the factors into the given buffer.
+	@param seq	sequence
+	@param seq_size	sequence length (+1 for the <end> state)
+	@param R	node factors
+*/
+void CRF::calculateFactors(Sequence &seq, size_t& seq_size, vector<long double>& R) {
 	/// Initialization
-	m_seq_size = seq.size() + 1;	///< sequence length
+	seq_size = seq.size() + 1;	///< sequence length
 	double* theta = m_Param.getWeight();
 
 	/// Factor matrix initialization
-	//m_M.resize(m_seq_size * m_state_size * m_state_size);
-	m_R.resize(m_seq_size * m_state_size);
+	//m_M.resize(seq_size * m_state_size * m_state_size);
+	R.resize(seq_size * m_state_size);
 	//fill(m_M.begin(), m_M.end(), 1.0);
-	fill(m_R.begin(), m_R.end(), 1.0);
+	fill(R.begin(), R.end(), 1.0);
 
 	// for efficient alpha-beta
 	//m_IndexR.clear();
@@ -301,7 +578,7 @@ void CRF::calculateFactors(Sequence &seq) {
 
 	/// Calculation
 	double a = 0.0;
-	for (size_t i = 0; i < m_seq_size-1; i++) {
+	for (size_t i = 0; i < seq_size-1; i++) {
 
 		//vector<size_t> &pointer = m_IndexR[i];
 		//map<size_t, size_t> temp;
@@ -322,7 +599,7 @@ void CRF::calculateFactors(Sequence &seq) {
 		for (; iter != seq[i].obs.end(); iter++) {
 			vector<pair<size_t, size_t> >& param = m_Param.m_ParamIndex[iter->first];
 			for (size_t j = 0; j < param.size(); ++j) {
-				m_R[MAT2(i, param[j].first)] *= exp(theta[param[j].second] * iter->second);
+				R[MAT2(i, param[j].first)] *= exp(theta[param[j].second] * iter->second);
 			}
 		}
 
@@ -344,50 +621,25 @@ void CRF::calculateFactors(Sequence &seq) {
 	Computing and storing the alpha value.
 */
 void CRF::forward() {
-	m_Alpha.resize(m_seq_size * m_state_size);
-	fill(m_Alpha.begin(), m_Alpha.end(), 0.0);
+	forward(m_seq_size, m_R, m_Alpha, scale);
+}
 
-	scale.resize(m_seq_size);
-	fill(scale.begin(), scale.end(), 1.0);
-	
-	long double sum = 0.0;
-	for (size_t j = 0; j < m_state_size; j++) {
-	//vector<size_t> &indexR = m_IndexR[0];
-	//for (size_t y = 0; y < indexR.size(); y++) {
-	//	size_t j = indexR[y];
-
-		m_Alpha[MAT2(0, j)] += m_R[MAT2(0, j)] * 1.0; //m_M[MAT3(0, m_default_oid,j)];  // <start>->j transition is 1.0
-		sum += m_Alpha[MAT2(0, j)];
-	}
-	for (size_t j = 0; j < m_state_size; j++) 
-		m_Alpha[MAT2(0, j)] /= sum;
-	scale[0] = sum;
-	
-    for (size_t i = 1; i < m_seq_size-1; i++) {
-		long double sum = 0.0;
-        for (size_t j = 0; j < m_state_size; j++) {
-		//vector<size_t> &indexR = m_IndexR[i];
-		//for (size_t y = 0; y < indexR.size(); y++) {
-		//	size_t j = indexR[y];
-			size_t index = MAT2(i, j);
-            //for (size_t k = 0; k < m_state_size; k++) {
-			vector<size_t> &selectedState = m_Param.m_SelectedStateList1[j];
-			for (size_t x = 0; x < selectedState.size(); x++) {
-				size_t k = selectedState[x];
-                m_Alpha[index] += m_Alpha[MAT2(i-1, k)] * m_R[index] * (m_M2[MAT2(k,j)] - 1.0);
-           }
-			m_Alpha[index] += m_R[index];
-			sum += m_Alpha[index];
-        }
-		for (size_t j = 0; j < m_state_size; j++) 
-			m_Alpha[MAT2(i, j)] /= sum;
-		scale[i] = sum;
-    }
+void CRF::forward(size_t seq_size, const vector<long double>& R, vector<long double>& alpha, vector<long double>& sc) {
+	alpha.resize(seq_size * m_state_size);
+	sc.resize(seq_size);
 
+	/// 1 ~ T (<start>->j transition is 1.0)
+	DensePotential pot(&R[0], &m_M2[0], m_state_size);
+	if (m_state_size > CHAIN_FIXED_MAX)
+		pot.setSparse(&m_Param.m_SelectedStateList1, &m_Param.m_SelectedStateList2);
+	Chain<SumProduct>::forward(pot, seq_size-1, &alpha[0], &sc[0]);
+
+	/// <end> state
+	fill(alpha.begin() + MAT2(seq_size-1, 0), alpha.end(), 0.0);
 	for (size_t k = 0; k < m_state_size; k++) {
-		m_Alpha[MAT2(m_seq_size-1, m_default_oid)] += m_Alpha[MAT2(m_seq_size-2, k)]; 
+		alpha[MAT2(seq_size-1, m_default_oid)] += alpha[MAT2(seq_size-2, k)]; 
 	}
-	scale[m_seq_size-1] = m_Alpha[MAT2(m_seq_size-1, m_default_oid)];
+	sc[seq_size-1] = alpha[MAT2(seq_size-1, m_default_oid)];
 
 }
 
@@ -395,53 +647,23 @@ void CRF::forward() {
 	Computing and storing the beta value.
 */
 void CRF::backward() {
-	m_Beta.resize(m_seq_size * m_state_size);
-	fill(m_Beta.begin(), m_Beta.end(), 0.0);
-
-	scale2.resize(m_seq_size);
-	fill(scale2.begin(), scale2.end(), 1.0);
+	backward(m_seq_size, m_R, m_Beta, scale2);
+}
 
-	m_Beta[MAT2(m_seq_size-1, m_default_oid)] = 1.0; // / scale[m_seq_size-1];
-	long double sum = 0.0;
+void CRF::backward(size_t seq_size, const vector<long double>& R, vector<long double>& beta, vector<long double>& sc) {
+	beta.resize(seq_size * m_state_size);
+	sc.resize(seq_size);
 
-	for (size_t k = 0; k < m_state_size; k++) {
-	//vector<size_t> &indexR = m_IndexR[m_seq_size-2];
-	//for (size_t y = 0; y < indexR.size(); y++) {
-	///	size_t k = indexR[y];
-		m_Beta[MAT2(m_seq_size-2, k)] += 1.0;
-		sum += m_Beta[MAT2(m_seq_size-2, k)];
-	}
-	for (size_t k = 0; k < m_state_size; k++) 
-		m_Beta[MAT2(m_seq_size-2, k)] /= sum;
-	scale2[m_seq_size-2] = sum;
+	/// T ~ 1 (any state may precede <end>)
+	DensePotential pot(&R[0], &m_M2[0], m_state_size);
+	if (m_state_size > CHAIN_FIXED_MAX)
+		pot.setSparse(&m_Param.m_SelectedStateList1, &m_Param.m_SelectedStateList2);
+	Chain<SumProduct>::backward(pot, seq_size-1, CHAIN_OPEN, &beta[0], &sc[0]);
 
-    for (int i = m_seq_size-2; i >= 1; i--) {
-		long double sum = 0.0;
-		long double constant = 0.0;
-		for (size_t k = 0; k < m_state_size; k++)
-			constant += m_R[MAT2(i,k)] * m_Beta[MAT2(i, k)];
-
-		for (size_t j = 0; j < m_state_size; j++) {
-		//vector<size_t> &indexR = m_IndexR[i-1];
-		//for (size_t y = 0; y < indexR.size(); y++) {
-		//	size_t j = indexR[y];
-
-			size_t index = MAT2(i-1, j);
-			//for (size_t k = 0; k < m_state_size; k++) {
-			vector<size_t> &selectedState = m_Param.m_SelectedStateList2[j];
-			for (size_t x = 0; x < selectedState.size(); x++) {
-				size_t k = selectedState[x];
-                m_Beta[index] += m_R[MAT2(i,k)] * (m_M2[MAT2(j, k)] - 1.0) * m_Beta[MAT2(i, k)];
-           }
-			//m_Beta[MAT2(i-1, j)] /= scale[i-1];
-			m_Beta[MAT2(i-1, j)] += constant;
-			sum += m_Beta[index];
-        } // for j
-		for (size_t j = 0; j < m_state_size; j++) 
-			m_Beta[MAT2(i-1, j)] /= sum;
-		scale2[i-1] = sum;
-
-    } // for i
+	/// <end> state
+	fill(beta.begin() + MAT2(seq_size-1, 0), beta.end(), 0.0);
+	beta[MAT2(seq_size-1, m_default_oid)] = 1.0;
+	sc[seq_size-1] = 1.0;
 }
 
 /**	Partition function (Z).
@@ -456,25 +678,29 @@ long double CRF::getPartitionZ() {
 	@return probability
 */
 long double CRF::calculateProb(Sequence& seq) {
-	long double z = getPartitionZ();
+	return calculateProb(seq, m_seq_size, m_R, m_Alpha, scale);
+}
+
+long double CRF::calculateProb(Sequence& seq, size_t seq_size, const vector<long double>& R, const vector<long double>& alpha, const vector<long double>& sc) {
+	long double z = alpha[MAT2(seq_size-1, m_default_oid)];
 
     long double seq_prob = 1.0;
 	long double tran = 1.0;
     size_t prev_y = m_default_oid;
     size_t y;
-    for (size_t i=0; i < m_seq_size; i++) {
-        if (i < m_seq_size-1) {
+    for (size_t i=0; i < seq_size; i++) {
+        if (i < seq_size-1) {
             y = seq[i].label;
 			if (i > 0)
 				tran = m_M2[MAT2(prev_y, y)];
-			seq_prob *= m_R[MAT2(i,y)] * tran;
+			seq_prob *= R[MAT2(i,y)] * tran;
         } else {
             y = m_default_oid;
         }
 
         prev_y = y;
        
-		seq_prob /= scale[i];
+		seq_prob /= sc[i];
 
     }
     if (seq_prob == 0.0) {
@@ -491,122 +717,177 @@ long double CRF::calculateProb(Sequence& seq) {
  @return outcome sequence
 */
 vector<size_t> CRF::viterbiSearch(long double& prob) {
-	/// Initialization
-	vector<vector<size_t> > psi;
-    vector<vector<long double> > delta;
-
-	/// Search
-    size_t i, j, k;
-	size_t prev_max_j = m_default_oid;
-	long double prev_maxj = -100000.0;
-
-	// first node
-	/*
-    vector<size_t> tmp_psi_i;
-    vector<long double> tmp_delta_i;
-	long double maxj = -10000.0;
-	size_t max_j = 0;
-	for (j=0; j < m_state_size; j++) {
-		long double max = m_R[MAT2(0, j)] * 1.0;
-		tmp_delta_i.push_back(max / scale[0]);
-		tmp_psi_i.push_back(m_default_oid);
-		if (max > maxj) {
-			maxj = max;
-			max_j = j;
-		}
-	}
-	delta.push_back(tmp_delta_i);
-	psi.push_back(tmp_psi_i);
-
-	size_t prev_max_j = max_j;
-	long double prev_maxj = maxj;
-	*/
-	
-	// 1 ~ T
-    for (i=0; i < m_seq_size-1; i++) {
-        vector<size_t> psi_i;
-        vector<long double> delta_i;
-
-		long double maxj = -10000.0;
-		size_t max_j = 0;
-
-        for (j=0; j < m_state_size; j++) {
-            long double max = -10000.0;
-            size_t max_k = 0;
-            if (i == 0) {
-                max = 1.0; //m_M[MAT3(i,m_default_oid,j)];
-                max_k = m_default_oid;
-            } else {
-                for (k=0; k < m_state_size; k++) {
-				//vector<size_t> &selectedState = m_Param.m_SelectedStateList1[j];
-				//for (size_t x = 0; x < selectedState.size(); x++) {
-				//	size_t k = selectedState[x];
-					double val = delta[i-1][k] * m_M2[MAT2(k,j)];
-                    if (val > max) {
-                        max = val;
-                        max_k = k;
-                    }
-                }
-				
-				/*
-				// refer to Siddiqi and Moore, 2005
-				if (max < prev_maxj) {
-					max = prev_maxj;
-					max_k = prev_max_j;
-				}*/
-            }
-
-			max = max * m_R[MAT2(i, j)]; // / scale[i];
-
-            delta_i.push_back(max);
-            psi_i.push_back(max_k);
-
-			if (max > maxj) {
-				maxj = max;
-				max_j = j;
-			}
-        } // for j
+	return viterbiSearch(m_seq_size, m_R, prob);
+}
 
-        delta.push_back(delta_i);
-        psi.push_back(psi_i);
+vector<size_t> CRF::viterbiSearch(size_t seq_size, const vector<long double>& R, long double& prob) {
+	/// Initialization
+	size_t n_pos = seq_size - 1;
+	vector<size_t> psi(seq_size * m_state_size, 0);
+	vector<long double> delta(seq_size * m_state_size, -10000.0);
 
-		prev_max_j = max_j;
-		prev_maxj = maxj;
-	
-    } // for i
+	/// Search (1 ~ T, <start>->j transition is 1.0)
+	DensePotential pot(&R[0], &m_M2[0], m_state_size);
+	Chain<MaxProduct>::viterbi(pot, n_pos, &delta[0], &psi[0], m_default_oid);
 	
 	// last path
-	vector<size_t> psi_i(m_state_size, 0);
-	vector<long double> delta_i(m_state_size, -10000.0);
 	long double max = -10000.0;
 	size_t max_k = 0;
 	for (size_t k=0; k < m_state_size; k++) {
-		double val = delta[m_seq_size-2][k]; 
+		double val = delta[MAT2(n_pos-1, k)]; 
 		if (val > max) {
 			max = val;
 			max_k = k;
 		}
 	}
-	//max /= scale[m_seq_size-1];
-	delta_i[m_default_oid] = max;
-	psi_i[m_default_oid] = max_k;
-	delta.push_back(delta_i);
-	psi.push_back(psi_i);
+	delta[MAT2(n_pos, m_default_oid)] = max;
+	psi[MAT2(n_pos, m_default_oid)] = max_k;
 
 	/// Back-tracking
-    vector<size_t> y_seq;
-    size_t prev_y = m_default_oid;
-    for (i = m_seq_size-1; i >= 1; i--) {
-        size_t y = psi[i][prev_y];
-        y_seq.push_back(y);
-        prev_y = y;
-    }
-    reverse(y_seq.begin(), y_seq.end());
-    prob = delta[m_seq_size-1][m_default_oid];
+	prob = delta[MAT2(n_pos, m_default_oid)];
+	return chainBacktrack(&psi[0], seq_size, m_state_size, m_default_oid);
+}
 
+/** Viterbi search over the coarse-to-fine lattice (see CoarseToFine), or in full if it is disabled
+	or the path is not certified.
+	@param seq_size	sequence length + 1
+	@param R		node factors of the sequence
+	@param coarse	coarse-to-fine search (of the thread)
+	@param prob		unnormalized score of the path
+	@return outcome sequence
+*/
+vector<size_t> CRF::viterbiSearch(size_t seq_size, const vector<long double>& R, CoarseToFine& coarse, long double& prob) {
+	if (coarse.enabled()) {
+		vector<size_t> y_seq;
+		DensePotential pot(&R[0], &m_M2[0], m_state_size);
+		if (coarse.search(pot, seq_size - 1, m_default_oid, CHAIN_OPEN, y_seq, prob))
+			return y_seq;
+	}
+	return viterbiSearch(seq_size, R, prob);
+}
+
+/** Greedy labeling (the fallback of anytime decoding, see DecodeBudget).
+	@param seq_size	sequence length + 1
+	@param R		node factors of the sequence
+	@return outcome sequence
+*/
+vector<size_t> CRF::greedySearch(size_t seq_size, const vector<long double>& R) {
+	vector<size_t> y_seq(seq_size - 1);
+	if (y_seq.size() == 0)
+		return y_seq;
+	DensePotential pot(&R[0], &m_M2[0], m_state_size);
+	Chain<MaxProduct>::greedy(pot, seq_size - 1, &y_seq[0]);
 	return y_seq;
 }
 
+/** N-best search (list Viterbi).
+ @param n		number of paths
+ @param prob	unnormalized score of each path
+ @return outcome sequences, best first
+*/
+vector<vector<size_t> > CRF::nbestSearch(size_t n, vector<long double>& prob) {
+	vector<vector<size_t> > y_seqs;
+	DensePotential pot(&m_R[0], &m_M2[0], m_state_size);
+	Chain<MaxProduct>::kbest(pot, m_seq_size-1, CHAIN_OPEN, n, y_seqs, prob);
+	return y_seqs;
+}
+
+/** Constructor.
+	@param threshold	loss (-log prob. of the reference) below which a sequence is well fit (0 for no skipping)
+	@param exact_every	every exact_every-th iteration evaluates all the sequences
+*/
+SkipTracker::SkipTracker(double threshold, size_t exact_every) {
+	m_Threshold = threshold;
+	m_ExactEvery = exact_every;
+	m_Exact = true;
+	m_Restart = false;
+	m_NumSkipped = 0;
+	m_TotalSkipped = 0;
+	m_TotalSeq = 0;
+	m_ExactPasses = 0;
+	m_Drift = 0.0;
+	m_MaxDrift = 0.0;
+}
+
+/** Plan the sequences skipped in an iteration: none in an exact iteration, and after it, those below
+	the threshold at their last two evaluations. The set is kept until the next exact iteration, so that
+	L-BFGS minimizes the same (approximated) objective between the exact iterations; it is restarted
+	whenever the set changes (see restart()).
+	@param iter	iteration
+	@param n_seq	number of training sequences
+*/
+void SkipTracker::begin(size_t iter, size_t n_seq) {
+	m_NumSkipped = 0;
+	if (!enabled())
+		return;
+	if (m_Skip.size() != n_seq) {
+		m_Skip.assign(n_seq, false);
+		m_Prob.assign(n_seq, 0.0);
+		m_Fit.assign(n_seq, 0);
+	}
+	m_WasSkipped = m_Skip;
+	bool plan = m_Exact;	///< the first iteration after an exact one
+	m_Exact = (iter % m_ExactEvery == 0);
+	for (size_t n = 0; n < n_seq; n++) {
+		if (m_Exact)
+			m_Skip[n] = false;
+		else if (plan)
+			m_Skip[n] = (m_Fit[n] >= 2);
+		if (m_Skip[n])
+			++m_NumSkipped;
+	}
+	m_Restart = false;	///< the objective changes with the skip set (at the exact iterations and the ones after them)
+	for (size_t n = 0; n < n_seq && !m_Restart; n++)
+		m_Restart = (m_Skip[n] != m_WasSkipped[n]);
+	m_Drift = 0.0;
+}
+
+/** Record the prob. of the reference of an evaluated sequence.
+	In an exact iteration, the sequences skipped in the previous one give the error of their approximated loss.
+	@param n	index of the sequence
+	@param prob	prob. of the reference
+	@param count	count of the sequence
+*/
+void SkipTracker::update(size_t n, long double prob, double count) {
+	if (!enabled())
+		return;
+	++m_TotalSeq;
+	if (m_Exact && m_WasSkipped[n] && prob > 0.0 && m_Prob[n] > 0.0)
+		m_Drift += count * fabs((double)log(m_Prob[n]) - (double)log(prob));
+	m_Prob[n] = prob;
+	if (prob > 0.0 && -(double)log(prob) < m_Threshold) {
+		if (m_Fit[n] < 255)
+			++m_Fit[n];
+	} else {
+		m_Fit[n] = 0;
+	}
+}
+
+/// Finish an iteration
+void SkipTracker::end() {
+	if (!enabled())
+		return;
+	m_TotalSkipped += m_NumSkipped;
+	m_TotalSeq += m_NumSkipped;
+	if (m_Exact) {
+		++m_ExactPasses;
+		if (m_Drift > m_MaxDrift)
+			m_MaxDrift = m_Drift;
+	}
+}
+
+/// Report the skipped evaluations and the error of the approximation
+void SkipTracker::report(Logger *logger) const {
+	if (!enabled())
+		return;
+	logger->report("[Skipping well-fit sequences]\n");
+	logger->report("  threshold = \t\t%g\n", m_Threshold);
+	logger->report("  exact iterations = \t%d (every %d)\n", m_ExactPasses, m_ExactEvery);
+	logger->report("  skipped = \t\t%d of %d evaluations (%.1f%%)\n", m_TotalSkipped, m_TotalSeq, 
+		(m_TotalSeq > 0 ? 100.0 * m_TotalSkipped / m_TotalSeq : 0.0));
+	logger->report("  max drift = \t\t%g (loglikelihood of the skipped sequences, at the exact iterations)\n\n", m_MaxDrift);
+}
+
 /** Training with LBFGS optimizer.
 	@param max_iter	maximum number of iteration
 	@param sigma	Gaussian prior variance
@@ -627,11 +908,39 @@ bool CRF::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta)
 	logger->report("  Penalty value = \t%.2f\n\n", sigma);
 	logger->report("[Inference]\n");
 	logger->report("  Method = \t\tStandard\n");
+	bool parallel = ((m_threads > 1 || m_deterministic) && m_CorpusFile == "");	///< out-of-core training is sequential
+	if (parallel) {
+		scheduleTrainSet();
+		logger->report("  Threads = \t\t%d (%d chunks%s)\n", m_threads, m_Scheduler.chunks(), (m_deterministic ? ", deterministic" : ""));
+	}
+	if (m_skip_threshold > 0.0 && m_CorpusFile != "")
+		logger->report("  Skipping the well-fit sequences needs the training data in memory (out_of_core); ignored\n");
+	m_Skip = SkipTracker(m_CorpusFile == "" ? m_skip_threshold : 0.0, m_skip_exact);
+	if (m_Skip.enabled()) {
+		logger->report("  Skipping = \t\tloss < %g (exact every %d iterations)\n", m_skip_threshold, m_skip_exact);
+		makeEdgeIndex();
+	}
+	Grafting graft(m_graft_init, m_graft_every, m_graft_grow, m_graft_threshold);
+	if (graft.enabled()) {
+		graft.start(m_Param);
+		theta = m_Param.getWeight();
+		gradient = m_Param.getGradient();
+		paramChanged(parallel);
+		logger->report("  Feature induction = \t%d active parameters at the start\n", m_Param.size());
+	}
+	L1ActiveSet zero_set((L1 && sigma && !graft.enabled()) ? m_l1_patience : 0, m_l1_recheck);	///< not with the feature induction
+	if (zero_set.enabled()) {
+		zero_set.start(m_Param);
+		logger->report("  L1 active set = \tskip after %d iterations at zero (recheck every %d)\n", m_l1_patience, m_l1_recheck);
+	}
 	logger->report("[Iterations]\n");
 	logger->report("%4s %15s %8s %8s %8s %8s\n", "iter", "loglikelihood", "acc", "micro-f1", "macro-f1", "sec");
 	
 	double old_obj = 1e+37;
 	int converge = 0;
+	double time_for_gradient = 0.0;	///< objective and gradient, summed over the iterations
+	size_t n_gradient = 0;
+	ChainBuffer chain;	///< inference buffers of the sequential loop
 
 	/// Training iteration
 	m_Param.makeActiveIndex(0.0);
@@ -640,145 +949,57 @@ bool CRF::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta)
 		
 		/// Initializing local variables
         timer t2;	///< elapsed time for one iteration
+		bool grow = graft.due(niter);
+		bool recheck = zero_set.due(niter);
+		if (grow || recheck) {	///< the gradient of all the parameters
+			if (grow)
+				graft.expand(m_Param);
+			else
+				zero_set.expand(m_Param);
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+			paramChanged(parallel);
+		}
 		m_Param.initializeGradient();	///< gradient vector initialization
 		eval.initialize();	///< evaluator intialization
-		double time_for_inference = 0.0;
-		double time_for_inference2 = 0.0;
-		double time_for_factor = 0.0;
-		double time_for_estimation = 0.0;
-		double time_for_viterbi = 0.0;
-		timer time_for_fb;
-
-		
 		calculateEdge();
-
-		/// for each training set
-        vector<Sequence>::iterator sit = m_TrainSet.begin();
-		vector<double>::iterator count_it = m_TrainSetCount.begin();
-        for (; sit != m_TrainSet.end(); ++sit, ++count_it) {
+		m_Skip.begin(niter, m_TrainSet.size());
+		if (parallel)
+			parallelGradient(eval);
+
+		/// for each training set (in memory, or streamed from the packed corpus)
+		size_t n_seq = firstTrainSeq();
+		Sequence* sit;
+		double count;
+		DirectGradient sink(gradient);
+		while (!parallel && nextTrainSeq(n_seq, sit, count)) {
 			Sequence::iterator it = sit->begin();
-			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 			vector<size_t> reference, hypothesis;
 
-			/// Forward-Backward  
-			timer stop_watch;
-			calculateFactors(*sit);
-			time_for_factor += stop_watch.elapsed();
-			stop_watch.restart();
-			forward();
-			time_for_inference += stop_watch.elapsed();
-			stop_watch.restart();
-			backward();
-			time_for_inference2 += stop_watch.elapsed();
-			long double zval = getPartitionZ();
-			
-			/// Evaluation
-			stop_watch.restart();
-            long double dummy_prob;
-			vector<size_t> y_seq = viterbiSearch(dummy_prob);
-			time_for_viterbi += stop_watch.elapsed();
-
-			// calculate Y sequence
-			long double y_seq_prob = calculateProb(*sit);
-            if (!finite((double)y_seq_prob)) {
-                cerr << "calculateProb:" << y_seq_prob << endl;
-            }
-			
-			// for scaling factor
-			vector<long double> prod_scale, prod_scale2;
-			prod_scale.clear();
-			prod_scale2.clear();
-			long double prod = 1.0;
-			for (int a = m_seq_size-1; a >= 0; a--) {
-				prod *= scale[a];
-				prod_scale.push_back(prod);
-			}
-			reverse(prod_scale.begin(), prod_scale.end());
-			prod = 1.0;
-			for (int a = m_seq_size-1; a >= 0; a--) {
-				prod *= scale2[a];
-				prod_scale2.push_back(prod);
+			if (m_Skip.skipped(n_seq - 1)) {	///< well fit: the expected counts of the reference, and the last loss
+				for (; it != sit->end(); ++it)
+					reference.push_back(it->label);
+				addPathFeatures(*sit, reference, count, gradient);
+				for (size_t c = 0; c < count; c++)
+					eval.addLikelihood(m_Skip.prob(n_seq - 1));	///< not decoded: left out of the accuracy and F1
+				continue;
 			}
-			reverse(prod_scale2.begin(), prod_scale2.end());
 
-			stop_watch.restart();
-			size_t prev_outcome = 0;
-			size_t i = 0;
-			for (; it != sit->end(); ++it, ++i) {	 /// for each node
-				size_t outcome = it->label;
+			long double y_seq_prob = sequenceGradient(*sit, count, chain, sink, hypothesis);
+			for (; it != sit->end(); ++it)
 				reference.push_back(it->label);
-				hypothesis.push_back(y_seq[i]);
-
-				/// calculate the expectation
-				/// E[~p] - E[p]
-				
-				long double scale_factor = prod_scale2[i] / prod_scale[i+1];
-				long double scale_factor2 = prod_scale2[i] / prod_scale[i];
-				
-				/*
-				vector<ObsParam> obs_param = m_Param.makeObsIndex(it->obs);
-				vector<ObsParam>::iterator iter = obs_param.begin();
-				for(; iter != obs_param.end(); ++iter) {
-					long double prob =  m_Alpha[MAT2(i, iter->y)] * m_Beta[MAT2(i, iter->y)] / zval;
-					prob *= scale_factor;
-					//prob *= scale[i];
-					gradient[iter->fid] += prob * iter->fval * count;
-				}
-				*/
-				vector<pair<size_t, double> >::iterator iter = it->obs.begin();
-				for (; iter != it->obs.end(); iter++) {
-					vector<pair<size_t, size_t> >& param = m_Param.m_ParamIndex[iter->first];
-					for (size_t j = 0; j < param.size(); ++j) {
-						long double prob =  m_Alpha[MAT2(i, param[j].first)] * m_Beta[MAT2(i, param[j].first)] / zval;
-						prob *= scale_factor;
-						//prob *= scale[i];
-						gradient[param[j].second] += prob * iter->second * count;
-					}
-				}
-
-				if (i > 0) {
-
-					vector<StateParam>::iterator iter = m_Param.m_StateIndex.begin();
-					for (; iter != m_Param.m_StateIndex.end(); ++iter) {
-						long double a_y;
-						//if (i == 0) {
-						//	if (iter->y1 == m_default_oid) 
-						//		a_y = 1.0;
-						//	else 
-						//		a_y = 0.0;
-						//} else {
-							a_y = m_Alpha[MAT2(i-1, iter->y1)];
-						//}
-						long double b_y = m_Beta[MAT2(i, iter->y2)];
-						long double m_yy = m_R[MAT2(i,iter->y2)] * m_M2[MAT2(iter->y1,iter->y2)];
-						long double prob = a_y * b_y * m_yy / zval;
-						prob *= scale_factor2;
-						gradient[iter->fid] += prob * iter->fval * count;
-					}
-				}
-
-				prev_outcome = outcome;
-		
-			} ///< for sequence
-			time_for_estimation += stop_watch.elapsed();
 
+			if (m_CorpusFile == "")
+				m_Skip.update(n_seq - 1, y_seq_prob, count);
 			for (size_t c = 0; c < count; c++) {
 				eval.addLikelihood(y_seq_prob);	/// loglikelihood
 				eval.append(reference, hypothesis);	/// evaluation (accuracy and f1 score)
 			}
 			
 		} ///< for m_TrainSet
-		
-		/*
-		cout << "time for factor : " << time_for_factor << endl; 
-		cout << "time for alpha : " << time_for_inference << endl; 
-		cout << "time for beta : " << time_for_inference2 <<  endl;
-		cout << "time for viterbi : " << time_for_viterbi << endl;
-		//cout << "avg. state : "  << (double)xxx / (double)yyy << endl;
-		cout << "time for estimation : " << time_for_estimation <<  endl;
-		cout << "total : " << time_for_fb.elapsed() << endl;
-		*/
-		time_for_inference = 0.0;
+		m_Skip.end();
 
 		/////////////////////////////////////////////////////////////////////////////////
 		/// Evaluation for dev set 
@@ -788,20 +1009,20 @@ bool CRF::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta)
 		timer stop_watch;
 		double time_for_dev = 0.0;
 		/// for each dev data
-        sit = m_DevSet.begin();
-		count_it = m_DevSetCount.begin();
-        for (; sit != m_DevSet.end(); ++sit, ++count_it) {
-			Sequence::iterator it = sit->begin();
+        vector<Sequence>::iterator dev_it = m_DevSet.begin();
+		vector<double>::iterator count_it = m_DevSetCount.begin();
+        for (; dev_it != m_DevSet.end(); ++dev_it, ++count_it) {
+			Sequence::iterator it = dev_it->begin();
 			double count = *count_it;
-			calculateFactors(*sit);
+			calculateFactors(*dev_it);
   			forward();
 			long double zval = getPartitionZ();
             long double dummy_prob;
 			vector<size_t> y_seq = viterbiSearch(dummy_prob);
-			assert(y_seq.size() == sit->size());
+			assert(y_seq.size() == dev_it->size());
 
 			vector<size_t> reference, hypothesis;
-			for (size_t i = 0; it != sit->end(); ++it, ++i) {	 /// for each node
+			for (size_t i = 0; it != dev_it->end(); ++it, ++i) {	 /// for each node
 				reference.push_back(it->label);
 				hypothesis.push_back(y_seq[i]);
 			}
@@ -831,21 +1052,52 @@ bool CRF::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta)
 			}
         }
 		
+		time_for_gradient += t2.elapsed();
+		++n_gradient;
+
+		if (grow) {	///< add the candidates, and restart LBFGS on the new active set
+			graft.grow(m_Param, sigma, L1);
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+			paramChanged(parallel);
+			lbfgs.clear();
+		}
+		if (recheck) {	///< add back and drop the weights, and restart LBFGS if the active set changed
+			if (zero_set.recheck(m_Param, sigma))
+				lbfgs.clear();
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+			paramChanged(parallel);
+		} else
+			zero_set.track(m_Param, sigma);
+
 		double diff = (niter == 0 ? 1.0 : abs(old_obj - eval.getObjFunc()) / old_obj);
-		if (diff < eta) 
-			converge++;
-		else
+		if (diff < eta) {
+			if (!m_Skip.approximate())	///< converged on the exact objective only
+				converge++;
+		} else
 			converge = 0;
 		old_obj = eval.getObjFunc();
-		if (converge == 3)
+		if (converge == 3 && graft.pending()) {	///< converged on the active set
+			graft.force();
+			converge = 0;
+		} else if (converge == 3)
 			break;
 
-		/// LBFGS optimizer
+		/// LBFGS optimizer (restarted when the skipped sequences change the objective)
+		if (m_Skip.restart())
+			lbfgs.clear();
 		int ret = lbfgs.optimize(m_Param.size(), theta, eval.getObjFunc(), gradient, L1, sigma);
 		if (ret < 0)
 			return false;
-		else if (ret == 0)
+		else if (ret == 0 && graft.pending())
+			graft.force();
+		else if (ret == 0) {
+			m_Skip.report(logger);
+			graft.report(logger);
+			zero_set.report(logger);
 			return true;
+		}
 
 		eval.calculateF1();
 		if (m_DevSet.size() > 0) {
@@ -863,12 +1115,246 @@ bool CRF::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta)
 
 	} ///< for iter
 
-	logger->report("  training time = \t%.3f\n\n", t.elapsed());
+	logger->report("  training time = \t%.3f\n", t.elapsed());
+	logger->report("  gradient time/iter = \t%.3f\n\n", (n_gradient > 0 ? time_for_gradient / n_gradient : 0.0));
+	m_Skip.report(logger);
+	graft.report(logger);
+	zero_set.report(logger);
 
 	return true;
 
 }
 
+/// An online epoch of a worker of the iterative parameter mixing
+class MixingEpochTask : public MixingTask {
+public:
+	CRF *crf;
+	bool perceptron;
+	double sigma;
+
+	vector<double> epoch(size_t worker, size_t n_workers, size_t iter, double* weight) {
+		return crf->mixingEpoch(worker, n_workers, iter, weight, perceptron, sigma);
+	}
+};
+
+/** Set the iterative parameter mixing.
+	@param workers	number of worker processes (shards of the training data)
+	@param rate	initial learning rate of SGD (divided by 1 + the iteration)
+*/
+void CRF::setMixing(size_t workers, double rate) {
+	m_mixing_workers = (workers > 0 ? workers : 1);
+	m_mixing_rate = rate;
+}
+
+bool CRF::trainMixing(size_t max_iter, double sigma, bool perceptron) {
+	return estimateWithMixing(max_iter, sigma, perceptron);
+}
+
+/** Set the skipping of the well-fit sequences in L-BFGS (see SkipTracker).
+	@param threshold	loss (-log prob. of the reference) below which a sequence is well fit (0 for no skipping)
+	@param exact_every	every exact_every-th iteration evaluates all the sequences
+*/
+void CRF::setSkipping(double threshold, size_t exact_every) {
+	m_skip_threshold = threshold;
+	m_skip_exact = exact_every;
+}
+
+/** Set the coarse-to-fine decoding (see CoarseToFine).
+	@param prune	coarse states below the best / prune are pruned (0 for none)
+	@param exact	whether the paths not certified by the coarse bound are searched in full
+	@param mapping	label (or type) -> coarse label, for the labels not projected by their names
+*/
+void CRF::setCoarseToFine(double prune, bool exact, const map<string, string>& mapping) {
+	m_coarse_prune = prune;
+	m_coarse_exact = exact;
+	m_coarse_map = mapping;
+}
+
+/** Rebuild the indexes following the parameters after the active set changed (see Grafting).
+	@param parallel	the gradient is computed by threads
+*/
+void CRF::paramChanged(bool parallel) {
+	if (parallel)
+		scheduleTrainSet();
+	if (m_Skip.enabled())
+		makeEdgeIndex();
+	m_Param.makeActiveIndex(0.0);
+}
+
+/// Parameter of each transition (S x S, -1 for none)
+void CRF::makeEdgeIndex() {
+	m_EdgeFid.assign(m_state_size * m_state_size, -1);
+	for (size_t i = 0; i < m_Param.m_StateIndex.size(); i++)
+		m_EdgeFid[MAT2(m_Param.m_StateIndex[i].y1, m_Param.m_StateIndex[i].y2)] = m_Param.m_StateIndex[i].fid;
+}
+
+/** Add the features of a labeling of a sequence to the weights.
+	@param seq	sequence
+	@param y	labels
+	@param scale	value added for each feature (times its value)
+	@param weight	weights
+*/
+void CRF::addPathFeatures(Sequence& seq, const vector<size_t>& y, double scale, double* weight) {
+	for (size_t i = 0; i < seq.size(); i++) {
+		vector<pair<size_t, double> >& obs = seq[i].obs;
+		for (size_t j = 0; j < obs.size(); j++) {
+			if (obs[j].first >= m_Param.m_ParamIndex.size())
+				continue;
+			vector<pair<size_t, size_t> >& param = m_Param.m_ParamIndex[obs[j].first];
+			for (size_t k = 0; k < param.size(); k++) {
+				if (param[k].first == y[i]) {
+					weight[param[k].second] += scale * obs[j].second;
+					break;
+				}
+			}
+		}
+		if (i > 0) {
+			long fid = m_EdgeFid[MAT2(y[i-1], y[i])];
+			if (fid >= 0)
+				weight[fid] += scale * seq[i].fval;
+		}
+	}
+}
+
+/** An online epoch over the shard of a worker (run in the worker process).
+	The perceptron adds the features of the reference and subtracts those of the best path when they differ.
+	SGD takes a step along the gradient of the log-likelihood of each sequence, with the learning rate divided
+	by 1 + the iteration; the L2 prior shrinks the weights once at the end of the epoch.
+	@param worker	worker (the shard is every n_workers-th training sequence from the worker)
+	@param n_workers	number of workers
+	@param iter	iteration (seeds the order of the shard)
+	@param weight	weights, updated in place
+	@param perceptron	perceptron or SGD
+	@param sigma	Gaussian prior variance (SGD; 0 for none)
+	@return number of sequences, tokens, and token errors of the best paths before the updates
+*/
+vector<double> CRF::mixingEpoch(size_t worker, size_t n_workers, size_t iter, double* weight, bool perceptron, double sigma) {
+	double* theta = m_Param.getWeight();
+	copy(weight, weight + m_Param.size(), theta);
+
+	/// shard of the worker, shuffled for each epoch
+	vector<size_t> shard;
+	for (size_t n = worker; n < m_TrainSet.size(); n += n_workers) {
+		if (m_TrainSetCount[n] > 0.0)	///< not held out
+			shard.push_back(n);
+	}
+	srand((unsigned int)(iter * n_workers + worker + 1));
+	random_shuffle(shard.begin(), shard.end());
+
+	double rate = m_mixing_rate / (1.0 + iter);
+	ChainBuffer buf;
+	GradientBuffer grad(m_Param.size());
+	double n_seq = 0.0, n_token = 0.0, n_error = 0.0;
+	for (size_t k = 0; k < shard.size(); k++) {
+		Sequence& seq = m_TrainSet[shard[k]];
+		double count = m_TrainSetCount[shard[k]];
+		vector<size_t> reference, hypothesis;
+		for (size_t i = 0; i < seq.size(); i++)
+			reference.push_back(seq[i].label);
+
+		calculateEdge();
+		if (perceptron) {
+			long double dummy_prob;
+			calculateFactors(seq, buf.seq_size, buf.R);
+			hypothesis = viterbiSearch(buf.seq_size, buf.R, dummy_prob);
+			if (hypothesis != reference) {
+				addPathFeatures(seq, reference, count, theta);
+				addPathFeatures(seq, hypothesis, -count, theta);
+			}
+		} else {
+			/// w -= rate * (E[f] - f(reference))
+			grad.clear();
+			sequenceGradient(seq, count, buf, grad, hypothesis);
+			const vector<size_t>& touched = grad.touched();
+			for (size_t t = 0; t < touched.size(); t++) {
+				const double* g = grad.block(touched[t]);
+				size_t base = touched[t] << GradientBuffer::BLOCK_BITS;
+				size_t end = min(base + GradientBuffer::BLOCK_SIZE, m_Param.size());
+				for (size_t i = base; i < end; i++)
+					theta[i] -= rate * g[i - base];
+			}
+			addPathFeatures(seq, reference, rate * count, theta);
+		}
+
+		n_seq += count;
+		n_token += count * seq.size();
+		for (size_t i = 0; i < seq.size(); i++) {
+			if (hypothesis[i] != reference[i])
+				n_error += count;
+		}
+	}
+	if (!perceptron && sigma > 0.0) {
+		double shrink = exp(-rate / sigma);
+		for (size_t i = 0; i < m_Param.size(); i++)
+			theta[i] *= shrink;
+	}
+
+	copy(theta, theta + m_Param.size(), weight);
+	vector<double> stats;
+	stats.push_back(n_seq);
+	stats.push_back(n_token);
+	stats.push_back(n_error);
+	return stats;
+}
+
+/** Training by iterative parameter mixing (McDonald et al., 2010).
+	The training sequences are split into shards, each trained online (perceptron or SGD) by a worker process
+	for an epoch from the same weights; the weights of the workers are then averaged and sent back (see MixingPool).
+	@param max_iter	number of epochs
+	@param sigma	Gaussian prior variance (SGD)
+	@param perceptron	perceptron or SGD
+	@return success or fail
+*/
+bool CRF::estimateWithMixing(size_t max_iter, double sigma, bool perceptron) {
+	if (m_CorpusFile != "") {
+		logger->report("Iterative parameter mixing needs the training data in memory (out_of_core is not supported)\n");
+		return false;
+	}
+	double* theta = m_Param.getWeight();
+	wall_timer t;
+
+	/// Reporting
+	m_Param.print(logger);
+	logger->report("[Parameter estimation]\n");
+	logger->report("  Method = \t\tIPM-%s\n", (perceptron ? "Perceptron" : "SGD"));
+	logger->report("  Workers = \t\t%d\n", m_mixing_workers);
+	if (!perceptron) {
+		logger->report("  Learning rate = \t%.4f\n", m_mixing_rate);
+		logger->report("  Regularization = \t%s\n", (sigma ? "L2" : "none"));
+		logger->report("  Penalty value = \t%.2f\n", sigma);
+	}
+	logger->report("\n[Iterations]\n");
+	logger->report("%4s %8s %8s %8s %8s %8s\n", "iter", "err", "dev-acc", "micro-f1", "macro-f1", "sec");
+
+	makeEdgeIndex();
+
+	MixingEpochTask task;
+	task.crf = this;
+	task.perceptron = perceptron;
+	task.sigma = sigma;
+	MixingPool pool(task, m_mixing_workers, m_Param.size());
+
+	vector<double> weight(theta, theta + m_Param.size());
+	for (size_t niter = 0; niter < max_iter; ++niter) {
+		wall_timer t2;
+		vector<double> stats;
+		if (!pool.mix(niter, &weight[0], stats) || stats.size() < 3) {
+			logger->report("a worker of the parameter mixing failed\n");
+			return false;
+		}
+		copy(weight.begin(), weight.end(), theta);
+
+		Score dev = evaluateDev();
+		double err = (stats[1] > 0 ? 100.0 * stats[2] / stats[1] : 0.0);
+		logger->report("%4d %8.3f %8.3f %8.3f %8.3f %8.3f\n", niter, err, dev.accuracy, dev.micro_f1, dev.macro_f1, t2.elapsed());
+	}
+	pool.shutdown();
+
+	logger->report("  training time = \t%.3f\n", t.elapsed());
+	logger->report("  communication = \t%.1f MB\n\n", pool.bytes() / 1048576.0);
+	return true;
+}
+
 /** Training with Pseudo-Likelihood
 	@param max_iter	maximum number of iteration
 	@param sigma	Gaussian prior variance
@@ -901,12 +1387,14 @@ bool CRF::estimateWithPL(size_t max_iter, double sigma, bool L1, double eta) {
 		m_Param.initializeGradient();	///< gradient vector initialization
 		eval.initialize();	///< evaluator intialization
 
-		/// for each training set
-        vector<Sequence>::iterator sit = m_TrainSet.begin();
-		vector<double>::iterator count_it = m_TrainSetCount.begin();
-        for (; sit != m_TrainSet.end(); ++sit, ++count_it) {
+		/// for each training set (in memory, or streamed from the packed corpus)
+		size_t n_seq = firstTrainSeq();
+		Sequence* sit;
+		double count;
+		while (nextTrainSeq(n_seq, sit, count)) {
 			Sequence::iterator it = sit->begin();
-			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 			size_t prev_outcome = m_default_oid;
 			vector<size_t> reference, hypothesis;
 
@@ -1085,6 +1573,26 @@ void CRF::evals(Sequence seq, std::vector<std::string> &output, std::vector<long
 
 }
 
+void CRF::evals(Sequence seq, size_t n, std::vector<std::vector<std::string> > &output, std::vector<long double> &prob) {
+	calculateEdge();
+	calculateFactors(seq);
+	forward();
+
+	long double zval = getPartitionZ();
+	for (size_t i = 0; i < m_seq_size - 1; i++)
+		zval *= scale[i];
+
+	vector<vector<size_t> > y_seqs = nbestSearch(n, prob);
+	output.clear();
+	for (size_t k = 0; k < y_seqs.size(); k++) {
+		vector<string> y_seq_s;
+		for (size_t i = 0; i < y_seqs[k].size(); i++)
+			y_seq_s.push_back(m_Param.getState().second[y_seqs[k][i]]);
+		output.push_back(y_seq_s);
+		prob[k] /= zval;
+	}
+}
+
 void CRF::eval(Sequence seq, std::vector<std::string> &output, long double &prob) {
 	calculateEdge();
 	calculateFactors(seq);
@@ -1159,20 +1667,135 @@ void CRF::eval(Sequence seq, std::vector<std::string> &output, std::vector<long
 	
 }
 	
-bool CRF::test(const std::string& filename, const std::string& outputfile, bool confidence) {
-	/// File stream
+/** Decode a test sequence.
+	@param seq	sequence
+	@param buf	inference buffers
+	@param coarse	coarse-to-fine search of the thread
+	@param state_vec	state names
+	@param write	whether to format the output lines
+	@param confidence	whether to output the confidence of each label
+	@param text	output lines of the sequence
+	@param reference	reference labels
+	@param hypothesis	best path labels
+	@param other	if not NULL, labels of the other decoder (Viterbi or greedy) to be compared
+	@param seconds	search time of the Viterbi and the greedy decoding (with other)
+*/
+void CRF::decodeSequence(Sequence& seq, ChainBuffer& buf, DecodeBudget& budget, CoarseToFine& coarse, const vector<string>& state_vec, bool write, bool confidence, string& text, vector<string>& reference, vector<string>& hypothesis, vector<string>* other, double* seconds) {
+	budget.start();
+	calculateFactors(seq, buf.seq_size, buf.R);
+	vector<size_t> y_seq;
+	double cells = (double)buf.seq_size * m_state_size * m_state_size;
+	wall_timer stop_watch;
+	if (m_greedy) {
+		y_seq = greedySearch(buf.seq_size, buf.R);
+		budget.finish(DecodeBudget::GREEDY);
+	} else if (budget.fits(cells)) {
+		long double dummy_prob;
+		y_seq = viterbiSearch(buf.seq_size, buf.R, coarse, dummy_prob);
+		budget.measure(cells, stop_watch.elapsed());
+		budget.finish(DecodeBudget::FULL);
+	} else {
+		y_seq = greedySearch(buf.seq_size, buf.R);
+		budget.finish(DecodeBudget::GREEDY);
+	}
+	if (other != NULL) {
+		seconds[m_greedy ? 1 : 0] = stop_watch.elapsed();
+		wall_timer other_watch;
+		vector<size_t> y_other;
+		if (m_greedy) {
+			long double dummy_prob;
+			y_other = viterbiSearch(buf.seq_size, buf.R, dummy_prob);
+		} else
+			y_other = greedySearch(buf.seq_size, buf.R);
+		seconds[m_greedy ? 0 : 1] = other_watch.elapsed();
+		for (size_t i = 0; i < y_other.size(); i++)
+			other->push_back(state_vec[y_other[i]]);
+	}
+	assert(y_seq.size() == seq.size());
+
+	ostringstream out;
+	out.precision(20);
+	Sequence::iterator it = seq.begin();
+	size_t prev_y = m_default_oid;
+
+	for (size_t i = 0; it != seq.end(); ++it, ++i) {	 /// for each node
+
+		string outcome_s;
+		if (state_vec.size() <= it->label) 
+			outcome_s = "!OUT_OF_CLASS!";
+		else
+			outcome_s = state_vec[it->label];
+		reference.push_back(outcome_s);
+		hypothesis.push_back(state_vec[y_seq[i]]);
+
+		if (write) {
+			out << state_vec[y_seq[i]];
+			if (confidence) {
+				double norm = 0.0;
+				for (size_t j = 0; j < m_state_size; j++) {
+					if (i > 0)
+						norm += buf.R[MAT2(i, j)] * m_M2[MAT2(prev_y, j)];
+					else
+						norm += buf.R[MAT2(i, j)];
+				}
+				double prob;
+				if (i > 0)
+					prob = buf.R[MAT2(i,y_seq[i])] * m_M2[MAT2(prev_y,y_seq[i])] / norm;
+				else
+					prob = buf.R[MAT2(i,y_seq[i])] / norm;
+				out << " " << prob;
+				prev_y = y_seq[i];
+			}
+			out << endl; 
+		}
+	}
+	if (write)
+		out << endl;
+	text = out.str();
+}
+
+/// Decoding a batch of test sequences in threads
+class DecodeTask : public ItemTask {
+public:
+	CRF *crf;
+	std::vector<Sequence>* batch;
+	std::vector<ChainBuffer> chain;		///< per-thread inference buffers
+	std::vector<DecodeBudget> budget;	///< per-thread decoding budgets
+	std::vector<CoarseToFine> coarse;	///< per-thread coarse-to-fine search
+	std::vector<std::string> state_vec;
+	bool write, confidence;
+	std::vector<std::string> text;
+	std::vector<std::vector<std::string> > reference, hypothesis;
+	bool compare;
+	std::vector<std::vector<std::string> > other;	///< labels of the other decoder (compare)
+	std::vector<double> seconds;	///< search time of the Viterbi and the greedy decoding (compare)
+
+	void run(size_t thread, size_t chunk, size_t n) {
+		crf->decodeSequence((*batch)[n], chain[thread], budget[thread], coarse[thread], state_vec, write, confidence, text[n], reference[n], hypothesis[n], 
+			compare ? &other[n] : NULL, compare ? &seconds[2*n] : NULL);
+	}
+};
+
+/** Testing.
+	The sequences are decoded in batches; with multiple threads, a batch is run by the work-stealing scheduler
+	and the results are written in the order of the input.
+	@param in	test data
+	@param output	output stream (NULL not to write)
+	@param confidence	whether to output the confidence of each label
+	@return success or fail
+*/
+bool CRF::test(istream& in, ostream* output, bool confidence) {
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 
 	/// output
-	ofstream out;
-	vector<string> state_vec;
-	if (outputfile != "") {
-		out.open(outputfile.c_str());
+	ostream null_out(NULL);
+	ostream& out = (output != NULL ? *output : null_out);
+	if (output != NULL) {
 		out.precision(20);
-		state_vec = m_Param.getState().second;
 	}
 	
 	/// initializing
@@ -1184,80 +1807,183 @@ bool CRF::test(const std::string& filename, const std::string& outputfile, bool
 	test_eval.initialize(); ///< Evaluator intialization
 
 	calculateEdge();
+
+	DecodeTask task;
+	task.crf = this;
+	task.chain.resize(m_threads);
+	task.budget.assign(m_threads, DecodeBudget(m_decode_budget));
+	task.state_vec = m_Param.getState().second;
+	CoarseToFine coarse(m_coarse_prune, m_coarse_exact);
+	if (m_coarse_prune > 0.0) {
+		coarse.build(task.state_vec, m_coarse_map);
+		coarse.bound(DensePotential(NULL, &m_M2[0], m_state_size));
+	}
+	task.coarse.assign(m_threads, coarse);
+	task.write = (output != NULL);
+	task.confidence = confidence;
+	task.compare = m_compare_decoders;
+	DecoderComparison compare(m_Param);
+	vector<Sequence> batch;
+	task.batch = &batch;
+	const size_t batch_size = 4096;
 	
 	/// reading the text
-	while (getline(f,line)) {
-		if (line.empty()) {
-			/// test
-			calculateFactors(seq);
-  			forward();
-
-			long double zval = getPartitionZ();
-            long double dummy_prob;
-			vector<size_t> y_seq = viterbiSearch(dummy_prob);
-			assert(y_seq.size() == seq.size());
-
-			vector<string> reference, hypothesis;
-			
-			Sequence::iterator it = seq.begin();
-			size_t prev_y = m_default_oid;
-
-			for (size_t i = 0; it != seq.end(); ++it, ++i) {	 /// for each node
-
-				string outcome_s;
-				if (m_Param.sizeStateVec() <= it->label) 
-					outcome_s = "!OUT_OF_CLASS!";
-				else
-					outcome_s = m_Param.getState().second[it->label];
-				string y_seq_s = m_Param.getState().second[y_seq[i]];
-				reference.push_back(outcome_s);
-				hypothesis.push_back(y_seq_s);
-
-				if (outputfile != "") {
-					out << state_vec[y_seq[i]];
-					if (confidence) {
-						double norm = 0.0;
-						for (size_t j = 0; j < m_state_size; j++) {
-							if (i > 0)
-								norm += m_R[MAT2(i, j)] * m_M2[MAT2(prev_y, j)];
-							else
-								norm += m_R[MAT2(i, j)];
-						}
-						double prob;
-						if (i > 0)
-							prob = m_R[MAT2(i,y_seq[i])] * m_M2[MAT2(prev_y,y_seq[i])] / norm;
-						else
-							prob = m_R[MAT2(i,y_seq[i])] / norm;
-						out << " " << prob;
-						prev_y = y_seq[i];
-					}
-					out << endl; 
-				}
-			}
-			if (outputfile != "")
-				out << endl;
-
-				
-			test_eval.append(m_Param, reference, hypothesis);	
-			seq.clear();
-			++count;
-		} else {
+	for (;;) {
+		bool eof = !getline(f, line);
+		if (!eof && !line.empty()) {
 			vector<string> tokens = tokenize(line);
 			Event ev = packEvent(tokens, &m_Param, true);	///< observation features
 			seq.push_back(ev);						///< append
-
-		}	///< else
-	}	///< while
+			continue;
+		}
+		if (!eof) {	///< end of a sequence
+			batch.push_back(seq);
+			seq.clear();
+		}
+		if (batch.size() >= batch_size || (eof && batch.size() > 0)) {
+			/// test
+			task.text.assign(batch.size(), "");
+			task.reference.assign(batch.size(), vector<string>());
+			task.hypothesis.assign(batch.size(), vector<string>());
+			if (task.compare) {
+				task.other.assign(batch.size(), vector<string>());
+				task.seconds.assign(2 * batch.size(), 0.0);
+			}
+			if (m_threads > 1) {
+				vector<double> cost(batch.size());
+				for (size_t n = 0; n < batch.size(); n++)
+					cost[n] = sequenceCost(batch[n]);
+				WorkStealing scheduler;
+				scheduler.schedule(cost, m_threads);
+				scheduler.run(task);
+			} else {
+				for (size_t n = 0; n < batch.size(); n++)
+					task.run(0, 0, n);
+			}
+			for (size_t n = 0; n < batch.size(); n++) {
+				if (output != NULL)
+					out << task.text[n];
+				test_eval.append(m_Param, task.reference[n], task.hypothesis[n]);	
+				if (task.compare)
+					compare.append(task.reference[n], m_greedy ? task.other[n] : task.hypothesis[n], m_greedy ? task.hypothesis[n] : task.other[n], task.seconds[2*n], task.seconds[2*n+1]);
+				++count;
+			}
+			batch.clear();
+		}
+		if (eof)
+			break;
+	}	///< for
 
 	test_eval.calculateF1();
 	logger->report("  # of data = \t\t%d\n", count);
 	logger->report("  testing time = \t%.3f\n\n", stop_watch.elapsed());
+	for (size_t i = 1; i < task.budget.size(); i++)
+		task.budget[0].merge(task.budget[i]);
+	task.budget[0].report(logger);
+	for (size_t i = 1; i < task.coarse.size(); i++)
+		task.coarse[0].merge(task.coarse[i]);
+	task.coarse[0].report(logger);
+	if (task.compare)
+		compare.report(logger);
 	logger->report("  Acc = \t\t%8.3f\n", test_eval.getAccuracy());
 	logger->report("  MicroF1 = \t\t%8.3f\n", test_eval.getMicroF1()[2]);
 	//logger->report("  MacroF1 = \t\t%8.3f\n", test_eval.getMacroF1()[2]);
 	test_eval.Print(logger);
+
+	return true;
 }
 
+/** Evaluate the current weights on the dev set.
+	@return accuracy and F1 scores (zero if there is no dev data)
+*/
+Score CRF::evaluateDev() {
+	Score score;
+	if (m_DevSet.size() == 0)
+		return score;
+
+	calculateEdge();
+	Evaluator dev_eval(m_Param);
+	dev_eval.initialize();
+	Data<Sequence>::iterator sit = m_DevSet.begin();
+	vector<double>::iterator count_it = m_DevSetCount.begin();
+	for (; sit != m_DevSet.end(); ++sit, ++count_it) {
+		calculateFactors(*sit);
+		forward();
+		long double dummy_prob;
+		vector<size_t> y_seq = viterbiSearch(dummy_prob);
+		assert(y_seq.size() == sit->size());
+
+		vector<size_t> reference, hypothesis;
+		Sequence::iterator it = sit->begin();
+		for (size_t i = 0; it != sit->end(); ++it, ++i) {
+			reference.push_back(it->label);
+			hypothesis.push_back(y_seq[i]);
+		}
+		for (size_t c = 0; c < *count_it; c++)
+			dev_eval.append(reference, hypothesis);
+	}
+	dev_eval.calculateF1();
+
+	score.accuracy = dev_eval.getAccuracy();
+	score.micro_f1 = dev_eval.getMicroF1()[2];
+	score.macro_f1 = dev_eval.getMacroF1()[2];
+	return score;
+}
+
+/** Check the log-sum-exp semiring against the scaled sum-product on the dev set.
+	log Z of each sequence is computed by both forward recursions with the current weights.
+	@param tolerance	largest difference of log Z allowed
+	@return whether every sequence is within the tolerance
+*/
+bool CRF::checkChain(double tolerance) {
+	logger->report("[Chain check]\n");
+	calculateEdge();
+	vector<long double> R, alpha, sc, log_alpha;
+	long double max_diff = 0.0, max_log_z = 0.0;
+	for (Data<Sequence>::iterator sit = m_DevSet.begin(); sit != m_DevSet.end(); ++sit) {
+		size_t seq_size;
+		calculateFactors(*sit, seq_size, R);
+
+		/// scaled sum-product: Z is the product of the scaling factors
+		forward(seq_size, R, alpha, sc);
+		long double log_z = 0.0;
+		for (size_t i = 0; i < seq_size; i++)
+			log_z += log(sc[i]);
+
+		/// log-sum-exp, without scaling
+		log_alpha.resize((seq_size-1) * m_state_size);
+		DensePotential pot(&R[0], &m_M2[0], m_state_size);
+		Chain<LogSumExp>::forward(pot, seq_size-1, &log_alpha[0]);
+		long double log_z2 = LogSumExp::zero();
+		for (size_t k = 0; k < m_state_size; k++)
+			log_z2 = LogSumExp::plus(log_z2, log_alpha[MAT2(seq_size-2, k)]);
+
+		max_diff = max(max_diff, fabsl(log_z - log_z2));
+		max_log_z = max(max_log_z, fabsl(log_z));
+	}
+	logger->report("  sequences = \t\t%d\n", m_DevSet.size());
+	logger->report("  max |log Z| = \t%.6Lf\n", max_log_z);
+	logger->report("  max difference = \t%.3Le (tolerance %g)\n\n", max_diff, tolerance);
+	return max_diff <= tolerance;
+}
+
+/** Recount the empirical feature counts of the training set (observation and transition features).
+*/
+void CRF::recount() {
+	MaxEnt::recount();
+	vector<string> states = m_Param.getState().second;
+	for (size_t n = 0; n < m_TrainSet.size(); ++n) {
+		double count = m_TrainSetCount[n];
+		if (count == 0.0)
+			continue;
+		Sequence& seq = m_TrainSet[n];
+		for (size_t i = 1; i < seq.size(); ++i) {
+			int pid = m_Param.findObs("@" + states[seq[i-1].label]);
+			if (pid >= 0)
+				m_Param.addCount(seq[i].label, pid, seq[i].fval * count);
+		}
+	}
+}
 
 }	///< namespace tricrf
 
@@ -11,6 +11,10 @@
 /// max headers
 #include "MaxEnt.h"
 #include "Data.h"
+#include "Corpus.h"
+#include "Parallel.h"
+#include "Anytime.h"
+#include "CoarseToFine.h"
 /// standard headers
 #include <vector>
 #include <string>
@@ -19,6 +23,50 @@
 
 namespace tricrf {
 
+/** Inference buffers of one sequence.
+	Each training thread has its own, and so do the sequential training loop and each mixing worker.
+*/
+struct ChainBuffer {
+	size_t seq_size;
+	std::vector<long double> R, Alpha, Beta, scale, scale2;
+};
+
+/** Skipping the well-fit training sequences in the L-BFGS iterations.
+	A sequence whose loss (-log prob. of the reference) stays below the threshold at two evaluations in a row
+	is skipped until the next exact iteration: its loss is taken from the last evaluation, and its expected
+	feature counts are approximated by the counts of the reference (prob. 1), so that its gradient is zero.
+	A skipped sequence is not decoded, so the training accuracy and F1 of an iteration are those of
+	the evaluated sequences only.
+	Every exact_every-th iteration evaluates all the sequences, measures how far the approximated
+	objective was from the exact one. L-BFGS is restarted whenever the skip set (and so the objective) changes.
+*/
+class SkipTracker {
+public:
+	SkipTracker(double threshold = 0.0, size_t exact_every = 0);
+	bool enabled() const { return m_Threshold > 0.0 && m_ExactEvery > 1; }
+	void begin(size_t iter, size_t n_seq);	///< Plan the skipped sequences of an iteration
+	bool skipped(size_t n) const { return n < m_Skip.size() && m_Skip[n]; }
+	bool approximate() const { return m_NumSkipped > 0; }	///< Whether the current iteration skips some sequences
+	bool restart() const { return m_Restart; }	///< Whether the objective changed since the previous iteration
+	long double prob(size_t n) const { return m_Prob[n]; }	///< Prob. of the reference at the last evaluation
+	void update(size_t n, long double prob, double count);	///< Record an evaluated sequence
+	void end();
+	void report(Logger *logger) const;
+
+private:
+	double m_Threshold;
+	size_t m_ExactEvery;
+	bool m_Exact;						///< the current iteration is exact
+	bool m_Restart;
+	std::vector<bool> m_Skip;			///< skipped in the current iteration
+	std::vector<bool> m_WasSkipped;	///< skipped in the previous iteration
+	std::vector<long double> m_Prob;
+	std::vector<unsigned char> m_Fit;	///< number of evaluations in a row below the threshold
+	size_t m_NumSkipped;		///< skipped sequences in the current iteration
+	size_t m_TotalSkipped, m_TotalSeq, m_ExactPasses;
+	double m_Drift, m_MaxDrift;	///< objective error of the skipped sequences (at the exact iterations)
+};
+
 /** (Linear-chain) Conditional Random Fields.
 	@class CRF
 */
@@ -51,11 +99,67 @@ protected:
 	virtual void backward();	///< Backward recursion
 	virtual long double getPartitionZ();	///< Z
 	virtual std::vector<size_t> viterbiSearch(long double& prob);	///< Find the best path
+	virtual std::vector<std::vector<size_t> > nbestSearch(size_t n, std::vector<long double>& prob);	///< Find the n-best paths
+	void calculateFactors(Sequence &seq, size_t& seq_size, std::vector<long double>& R);
+	void forward(size_t seq_size, const std::vector<long double>& R, std::vector<long double>& alpha, std::vector<long double>& sc);
+	void backward(size_t seq_size, const std::vector<long double>& R, std::vector<long double>& beta, std::vector<long double>& sc);
+	long double calculateProb(Sequence& seq, size_t seq_size, const std::vector<long double>& R, const std::vector<long double>& alpha, const std::vector<long double>& sc);
+	std::vector<size_t> viterbiSearch(size_t seq_size, const std::vector<long double>& R, long double& prob);
+	std::vector<size_t> viterbiSearch(size_t seq_size, const std::vector<long double>& R, CoarseToFine& coarse, long double& prob);	///< Coarse-to-fine if enabled
+	std::vector<size_t> greedySearch(size_t seq_size, const std::vector<long double>& R);	///< Greedy labeling
 
 	/// Parameter Estimation
 	virtual bool estimateWithLBFGS(size_t max_iter, double sigma, bool L1 = false, double eta = 1E-05);
 	virtual bool estimateWithPL(size_t max_iter, double sigma, bool L1 = false, double eta = 1E-05);
-	virtual bool averageParam() {};
+	virtual bool averageParam() { return true; };
+	virtual void recount();
+	virtual void prepareInference();
+
+	/// Out-of-core training
+	std::string m_CorpusFile;		///< packed corpus file (empty for in-memory training)
+	size_t m_CorpusWindow;			///< read-ahead window in bytes
+	CorpusReader m_Corpus;
+	Sequence m_StreamSeq;			///< current sequence streamed from the corpus
+	std::vector<size_t> m_CorpusPid;	///< renumbered feature ids of the corpus (empty if not renumbered)
+	size_t firstTrainSeq();	///< Start a pass over the training data
+	bool nextTrainSeq(size_t& n, Sequence*& seq, double& count);	///< Next training sequence
+
+	/// Parallel training
+	std::vector<ChainBuffer> m_ThreadChain;			///< per-thread inference buffers
+	std::vector<GradientBuffer*> m_ThreadGradient;	///< per-thread (or per-chunk in the deterministic mode) gradient
+	std::vector<long double> m_SeqProb;				///< prob. of the reference of each training sequence
+	std::vector<std::vector<size_t> > m_SeqHypothesis;	///< best path of each training sequence
+	template <class G> long double sequenceGradient(Sequence& seq, double count, ChainBuffer& buf, G& grad, std::vector<size_t>& hypothesis);
+	WorkStealing m_Scheduler;
+	double sequenceCost(Sequence& seq);	///< Estimated cost of the inference
+	void scheduleTrainSet();
+	void gradientItem(size_t thread, size_t chunk, size_t n);
+	void parallelGradient(Evaluator& eval);	///< Gradient and evaluation of the training set with threads
+	friend class GradientTask;
+
+	/// Iterative parameter mixing (distributed online training, see MixingPool)
+	size_t m_mixing_workers;		///< number of worker processes (shards)
+	double m_mixing_rate;			///< initial learning rate (SGD)
+	std::vector<long> m_EdgeFid;	///< parameter of each transition (S x S, -1 for none)
+	bool estimateWithMixing(size_t max_iter, double sigma, bool perceptron);
+	std::vector<double> mixingEpoch(size_t worker, size_t n_workers, size_t iter, double* weight, bool perceptron, double sigma);
+	void addPathFeatures(Sequence& seq, const std::vector<size_t>& y, double scale, double* weight);
+	void makeEdgeIndex();	///< m_EdgeFid
+	void paramChanged(bool parallel);
+	friend class MixingEpochTask;
+
+	/// Skipping the well-fit sequences (see SkipTracker)
+	double m_skip_threshold;	///< loss below which a sequence is well fit (0 for no skipping)
+	size_t m_skip_exact;		///< every m_skip_exact-th iteration is exact
+	SkipTracker m_Skip;
+	void decodeSequence(Sequence& seq, ChainBuffer& buf, DecodeBudget& budget, CoarseToFine& coarse, const std::vector<std::string>& state_vec, bool write, bool confidence, 
+		std::string& text, std::vector<std::string>& reference, std::vector<std::string>& hypothesis, std::vector<std::string>* other = NULL, double* seconds = NULL);	///< Decoding a test sequence
+	friend class DecodeTask;
+
+	/// Coarse-to-fine decoding options (see CoarseToFine), for the chain and for each topic chain of TriCRF
+	double m_coarse_prune;		///< coarse states below the best / prune are pruned (0 for none)
+	bool m_coarse_exact;		///< the paths not certified are searched in full
+	std::map<std::string, std::string> m_coarse_map;	///< label (or type) -> coarse label
 	
 	std::vector<std::vector<size_t> > m_Beam;
 	std::vector<std::map<size_t, size_t> > m_BeamMap;
@@ -66,26 +170,38 @@ protected:
 public:
 	CRF();
 	CRF(Logger *logger);
+	~CRF();
 	
 	/// Data manipulation
-	virtual void readTrainData(const std::string& filename);
-	virtual void readDevData(const std::string& filename);
+	using MaxEnt::readTrainData;
+	using MaxEnt::readDevData;
+	virtual void readTrainData(std::istream& in);
+	virtual void readDevData(std::istream& in);
+	void setOutOfCore(const std::string& filename, size_t window);
 
 	/// Model 
 	virtual bool loadModel(const std::string& filename);
 	virtual bool saveModel(const std::string& filename);
 
 	/// Testing
-	virtual bool test(const std::string& filename, const std::string& outputfile = "", bool confidence = false);	
+	using MaxEnt::test;
+	virtual bool test(std::istream& in, std::ostream* output = NULL, bool confidence = false);
 	virtual void eval(Sequence seq, std::vector<std::string> &output, long double &prob);
 	virtual void eval(Sequence seq, std::vector<std::string> &output, std::vector<long double> &prob);
 	virtual void evals(Sequence seq, std::vector<std::string> &output, std::vector<long double> &prob);
+	virtual void evals(Sequence seq, size_t n, std::vector<std::vector<std::string> > &output, std::vector<long double> &prob);
+	virtual Score evaluateDev();
+	bool checkChain(double tolerance);	///< Log-sum-exp against the scaled sum-product forward on the dev set (check mode)
 		
 	/// Training 
 	virtual void clear();
 	virtual bool pretrain(size_t max_iter = 100, double sigma = 20, bool L1 = false);
 	virtual bool train(size_t max_iter = 100, double sigma = 20, bool L1 = false); 
 	virtual long double calculateProb(Sequence& seq);	///< Prob(y|x)
+	void setMixing(size_t workers, double rate);
+	bool trainMixing(size_t max_iter = 10, double sigma = 20, bool perceptron = false);	///< Train by iterative parameter mixing (perceptron or SGD)
+	void setSkipping(double threshold, size_t exact_every);	///< Skip the well-fit sequences in L-BFGS (see SkipTracker)
+	void setCoarseToFine(double prune, bool exact, const std::map<std::string, std::string>& mapping);	///< Coarse-to-fine Viterbi over a label hierarchy
 
 };	///< CRF
 
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __CHAIN_H__
+#define __CHAIN_H__
+
+/// standard headers
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/// largest state count with a compile-time specialized kernel (override with -DCHAIN_FIXED_MAX=n)
+#ifndef CHAIN_FIXED_MAX
+#define CHAIN_FIXED_MAX 32
+#endif
+
+namespace tricrf {
+
+/// state index meaning "no fixed end state" (every state may end the chain)
+const size_t CHAIN_OPEN = (size_t)-1;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Semirings
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Sum-product semiring (probabilities).
+	@class SumProduct
+*/
+struct SumProduct {
+	typedef long double value;
+	static const bool ring = true;	///< has subtraction; enables the sparse transition trick
+	static inline value zero() { return 0.0; }
+	static inline value one() { return 1.0; }
+	static inline value lift(long double p) { return p; }
+	static inline value plus(value a, value b) { return a + b; }
+	static inline value times(value a, value b) { return a * b; }
+	static inline bool better(value a, value b) { return a > b; }
+	/// divide by the sum and return it
+	static inline long double normalize(value* v, size_t n) {
+		long double sum = 0.0;
+		for (size_t j = 0; j < n; j++)
+			sum += v[j];
+		for (size_t j = 0; j < n; j++)
+			v[j] /= sum;
+		return sum;
+	}
+};
+
+/** Log-sum-exp semiring (log probabilities).
+	@class LogSumExp
+*/
+struct LogSumExp {
+	typedef long double value;
+	static const bool ring = false;
+	static inline value zero() { return -HUGE_VAL; }
+	static inline value one() { return 0.0; }
+	static inline value lift(long double p) { return p > 0 ? std::log(p) : zero(); }
+	static inline value plus(value a, value b) {
+		if (a == zero())
+			return b;
+		if (b == zero())
+			return a;
+		return (a > b) ? a + std::log1p(std::exp(b - a)) : b + std::log1p(std::exp(a - b));
+	}
+	static inline value times(value a, value b) { return a + b; }
+	static inline bool better(value a, value b) { return a > b; }
+	/// subtract the log-sum and return it
+	static inline long double normalize(value* v, size_t n) {
+		value sum = zero();
+		for (size_t j = 0; j < n; j++)
+			sum = plus(sum, v[j]);
+		for (size_t j = 0; j < n; j++)
+			v[j] -= sum;
+		return sum;
+	}
+};
+
+/** Max-product semiring (Viterbi).
+	The k-best variant is ChainEngine::kbest over this semiring.
+	@class MaxProduct
+*/
+struct MaxProduct {
+	typedef long double value;
+	static const bool ring = false;
+	static inline value zero() { return 0.0; }
+	static inline value one() { return 1.0; }
+	static inline value lift(long double p) { return p; }
+	static inline value plus(value a, value b) { return (a > b) ? a : b; }
+	static inline value times(value a, value b) { return a * b; }
+	static inline bool better(value a, value b) { return a > b; }
+	/// divide by the max and return it
+	static inline long double normalize(value* v, size_t n) {
+		long double max = 0.0;
+		for (size_t j = 0; j < n; j++)
+			max = plus(max, v[j]);
+		if (max > 0)
+			for (size_t j = 0; j < n; j++)
+				v[j] /= max;
+		return max;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Potential providers
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Dense potentials: node factor R (T x S, MAT2/ZMAT2 layout) and edge factor M (S x S, M[k*S+j] for k->j).
+	Used by CRF and by the topic chains of TriCRF1/3.
+	@class DensePotential
+*/
+struct DensePotential {
+	const long double* R;	///< node factor
+	const long double* M;	///< edge factor
+	const long double* init;	///< factor into the first position (NULL: 1.0)
+	size_t n;	///< number of states
+	const std::vector<std::vector<size_t> >* pred;	///< optional: per j, states k whose edge(k,j) != 1
+	const std::vector<std::vector<size_t> >* succ;	///< optional: per j, states k whose edge(j,k) != 1
+
+	DensePotential(const long double* r, const long double* m, size_t size, const long double* start = NULL)
+		: R(r), M(m), init(start), n(size), pred(NULL), succ(NULL) {}
+
+	/// use sparse transition lists (sum-product only)
+	void setSparse(const std::vector<std::vector<size_t> >* p, const std::vector<std::vector<size_t> >* s) { pred = p; succ = s; }
+
+	inline size_t size() const { return n; }
+	inline bool sparse() const { return pred != NULL && succ != NULL; }
+	inline long double start(size_t j) const { return init ? init[j] : 1.0; }
+	inline long double node(size_t i, size_t j) const { return R[n * i + j]; }
+	inline long double edge(size_t k, size_t j) const { return M[n * k + j]; }
+	inline const std::vector<size_t>& predecessors(size_t j) const { return (*pred)[j]; }
+	inline const std::vector<size_t>& successors(size_t j) const { return (*succ)[j]; }
+};
+
+/** Potentials over a subset of a larger state space (TriCRF2).
+	Local state s stands for global state state[s]; node factors are R (T x N) times the topic row Z (N).
+	@class ReducedPotential
+*/
+struct ReducedPotential {
+	const long double* R;	///< node factor (global states)
+	const long double* M;	///< edge factor (global states)
+	const long double* Z;	///< topic-state factor (global states)
+	size_t n_global;	///< number of global states
+	const std::vector<size_t>& state;	///< local -> global state
+	size_t start_state;	///< global start state
+
+	ReducedPotential(const long double* r, const long double* m, const long double* z, size_t n, const std::vector<size_t>& states, size_t start)
+		: R(r), M(m), Z(z), n_global(n), state(states), start_state(start) {}
+
+	inline size_t size() const { return state.size(); }
+	inline bool sparse() const { return false; }
+	inline long double start(size_t j) const { return M[n_global * start_state + state[j]]; }
+	inline long double node(size_t i, size_t j) const { return R[n_global * i + state[j]] * Z[state[j]]; }
+	inline long double edge(size_t k, size_t j) const { return M[n_global * state[k] + state[j]]; }
+	/// dense only
+	inline const std::vector<size_t>& predecessors(size_t) const { static const std::vector<size_t> none; return none; }
+	inline const std::vector<size_t>& successors(size_t) const { static const std::vector<size_t> none; return none; }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Engine
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Chain inference over a semiring and a potential provider.
+	All matrices are row-major T x S. When N > 0 the state count is a compile-time constant,
+	so the compiler can unroll and vectorize the inner loops; N = 0 takes it from the provider.
+	@class ChainEngine
+*/
+template <class SR, size_t N = 0>
+struct ChainEngine {
+	typedef typename SR::value value;
+
+	/** Forward recursion.
+		@param pot		potentials
+		@param T		number of positions
+		@param alpha	output matrix (T x S)
+		@param scale	if not NULL, each position is normalized and its factor stored here (T)
+	*/
+	template <class P>
+	static void forward(const P& pot, size_t T, value* alpha, long double* scale = NULL) {
+		const size_t S = N ? N : pot.size();
+		for (size_t j = 0; j < S; j++)
+			alpha[j] = SR::times(SR::lift(pot.start(j)), SR::lift(pot.node(0, j)));
+		if (scale)
+			scale[0] = SR::normalize(alpha, S);
+
+		for (size_t i = 1; i < T; i++) {
+			const value* prev = alpha + S * (i-1);
+			value* cur = alpha + S * i;
+			if (SR::ring && pot.sparse()) {
+				/// sum_k a_k M(k,j) = sum_k a_k + sum_{k : M(k,j) != 1} a_k (M(k,j) - 1)
+				value total = SR::zero();
+				for (size_t k = 0; k < S; k++)
+					total += prev[k];
+				for (size_t j = 0; j < S; j++) {
+					value r = pot.node(i, j);
+					value acc = total;
+					const std::vector<size_t>& pred = pot.predecessors(j);
+					for (size_t x = 0; x < pred.size(); x++)
+						acc += prev[pred[x]] * (pot.edge(pred[x], j) - 1.0);
+					cur[j] = acc * r;
+				}
+			} else {
+				for (size_t j = 0; j < S; j++) {
+					value r = SR::lift(pot.node(i, j));
+					value acc = SR::zero();
+					if (r != SR::zero()) {
+						for (size_t k = 0; k < S; k++)
+							acc = SR::plus(acc, SR::times(SR::times(prev[k], SR::lift(pot.edge(k, j))), r));
+					}
+					cur[j] = acc;
+				}
+			}
+			if (scale)
+				scale[i] = SR::normalize(cur, S);
+		}
+	}
+
+	/** Backward recursion.
+		@param pot		potentials
+		@param T		number of positions
+		@param end		end state at position T-1, or CHAIN_OPEN
+		@param beta		output matrix (T x S)
+		@param scale	if not NULL, each position is normalized and its factor stored here (T)
+	*/
+	template <class P>
+	static void backward(const P& pot, size_t T, size_t end, value* beta, long double* scale = NULL) {
+		const size_t S = N ? N : pot.size();
+		value* last = beta + S * (T-1);
+		for (size_t j = 0; j < S; j++)
+			last[j] = (end == CHAIN_OPEN || j == end) ? SR::one() : SR::zero();
+		if (scale)
+			scale[T-1] = SR::normalize(last, S);
+
+		for (size_t i = T-1; i >= 1; i--) {
+			const value* cur = beta + S * i;
+			value* prev = beta + S * (i-1);
+			if (SR::ring && pot.sparse()) {
+				/// sum_k R(k) b_k M(j,k) = sum_k R(k) b_k + sum_{k : M(j,k) != 1} R(k) b_k (M(j,k) - 1)
+				value constant = SR::zero();
+				for (size_t k = 0; k < S; k++)
+					constant += pot.node(i, k) * cur[k];
+				for (size_t j = 0; j < S; j++) {
+					value acc = constant;
+					const std::vector<size_t>& succ = pot.successors(j);
+					for (size_t x = 0; x < succ.size(); x++)
+						acc += pot.node(i, succ[x]) * (pot.edge(j, succ[x]) - 1.0) * cur[succ[x]];
+					prev[j] = acc;
+				}
+			} else {
+				for (size_t j = 0; j < S; j++)
+					prev[j] = SR::zero();
+				for (size_t k = 0; k < S; k++) {
+					value r = SR::lift(pot.node(i, k));
+					if (r == SR::zero())
+						continue;
+					for (size_t j = 0; j < S; j++)
+						prev[j] = SR::plus(prev[j], SR::times(SR::times(cur[k], SR::lift(pot.edge(j, k))), r));
+				}
+			}
+			if (scale)
+				scale[i-1] = SR::normalize(prev, S);
+		}
+	}
+
+	/** Best-path recursion (max-product).
+		@param pot		potentials
+		@param T		number of positions
+		@param delta	output score matrix (T x S)
+		@param psi		output back-pointer matrix (T x S)
+		@param start	back-pointer stored at the first position
+	*/
+	template <class P>
+	static void viterbi(const P& pot, size_t T, value* delta, size_t* psi, size_t start) {
+		const size_t S = N ? N : pot.size();
+		for (size_t j = 0; j < S; j++) {
+			delta[j] = SR::times(SR::lift(pot.start(j)), SR::lift(pot.node(0, j)));
+			psi[j] = start;
+		}
+		for (size_t i = 1; i < T; i++) {
+			const value* prev = delta + S * (i-1);
+			for (size_t j = 0; j < S; j++) {
+				value r = SR::lift(pot.node(i, j));
+				value max = SR::zero();
+				size_t max_k = 0;
+				for (size_t k = 0; k < S; k++) {
+					value val = SR::times(SR::times(prev[k], r), SR::lift(pot.edge(k, j)));
+					if (SR::better(val, max)) {
+						max = val;
+						max_k = k;
+					}
+				}
+				delta[S * i + j] = max;
+				psi[S * i + j] = max_k;
+			}
+		}
+	}
+
+	/** Best-path recursion over a lattice of allowed states (coarse-to-fine decoding, see CoarseToFine).
+		The work is the sum of |allowed(i-1)| x |allowed(i)| instead of T x S x S; the other states score zero.
+		@param pot		potentials
+		@param T		number of positions
+		@param allowed	states allowed at each position (T lists)
+		@param delta	output score matrix (T x S)
+		@param psi		output back-pointer matrix (T x S)
+		@param start	back-pointer stored at the first position
+	*/
+	template <class P>
+	static void viterbi(const P& pot, size_t T, const std::vector<std::vector<size_t> >& allowed, value* delta, size_t* psi, size_t start) {
+		const size_t S = N ? N : pot.size();
+		std::fill(delta, delta + T * S, SR::zero());
+		std::fill(psi, psi + T * S, start);
+		for (size_t x = 0; x < allowed[0].size(); x++) {
+			size_t j = allowed[0][x];
+			delta[j] = SR::times(SR::lift(pot.start(j)), SR::lift(pot.node(0, j)));
+		}
+		for (size_t i = 1; i < T; i++) {
+			const value* prev = delta + S * (i-1);
+			const std::vector<size_t>& from = allowed[i-1];
+			for (size_t x = 0; x < allowed[i].size(); x++) {
+				size_t j = allowed[i][x];
+				value r = SR::lift(pot.node(i, j));
+				value max = SR::zero();
+				size_t max_k = (from.empty() ? 0 : from[0]);
+				for (size_t y = 0; y < from.size(); y++) {
+					size_t k = from[y];
+					value val = SR::times(SR::times(prev[k], r), SR::lift(pot.edge(k, j)));
+					if (SR::better(val, max)) {
+						max = val;
+						max_k = k;
+					}
+				}
+				delta[S * i + j] = max;
+				psi[S * i + j] = max_k;
+			}
+		}
+	}
+
+	/** Greedy left-to-right labeling: each position takes the best state given the previous one.
+		The choice maximizes the locally normalized distribution of the position (as a MEMM), and
+		the work is T x S instead of T x S x S of the best-path recursion.
+		@param pot		potentials
+		@param T		number of positions
+		@param y		output states (T)
+		@param end		end state at position T-1, or CHAIN_OPEN
+		@return score of the path (comparable with the best-path score delta of the same end)
+	*/
+	template <class P>
+	static value greedy(const P& pot, size_t T, size_t* y, size_t end = CHAIN_OPEN) {
+		const size_t S = N ? N : pot.size();
+		value score = SR::one();
+		for (size_t i = 0; i < T; i++) {
+			value max = SR::zero();
+			size_t max_j = 0;
+			for (size_t j = 0; j < S; j++) {
+				if (i == T-1 && end != CHAIN_OPEN && j != end)
+					continue;
+				value e = SR::lift(i > 0 ? pot.edge(y[i-1], j) : pot.start(j));
+				value val = SR::times(e, SR::lift(pot.node(i, j)));
+				if (SR::better(val, max) || (i == T-1 && j == end)) {
+					max = val;
+					max_j = j;
+				}
+			}
+			y[i] = max_j;
+			score = SR::times(score, max);
+		}
+		return score;
+	}
+
+	/// k-best lattice entry
+	struct Hypothesis {
+		value score;
+		size_t state;	///< previous state
+		size_t rank;	///< rank of the previous entry
+		Hypothesis(value s, size_t y, size_t r) : score(s), state(y), rank(r) {}
+		bool operator<(const Hypothesis& h) const { return SR::better(score, h.score); }
+	};
+
+	/** K-best paths (list Viterbi).
+		@param pot		potentials
+		@param T		number of positions
+		@param end		end state at position T-1, or CHAIN_OPEN
+		@param K		number of paths
+		@param paths	output state sequences of positions 0..T-1, best first
+		@param scores	output path scores
+	*/
+	template <class P>
+	static void kbest(const P& pot, size_t T, size_t end, size_t K, std::vector<std::vector<size_t> >& paths, std::vector<value>& scores) {
+		const size_t S = N ? N : pot.size();
+		std::vector<std::vector<Hypothesis> > lattice(T * S);
+		for (size_t j = 0; j < S; j++)
+			lattice[j].push_back(Hypothesis(SR::times(SR::lift(pot.start(j)), SR::lift(pot.node(0, j))), CHAIN_OPEN, 0));
+
+		for (size_t i = 1; i < T; i++) {
+			for (size_t j = 0; j < S; j++) {
+				value r = SR::lift(pot.node(i, j));
+				std::vector<Hypothesis>& cell = lattice[S * i + j];
+				for (size_t k = 0; k < S; k++) {
+					const std::vector<Hypothesis>& prev = lattice[S * (i-1) + k];
+					value e = SR::lift(pot.edge(k, j));
+					for (size_t r_k = 0; r_k < prev.size(); r_k++)
+						cell.push_back(Hypothesis(SR::times(SR::times(prev[r_k].score, r), e), k, r_k));
+				}
+				size_t keep = std::min(K, cell.size());
+				std::partial_sort(cell.begin(), cell.begin() + keep, cell.end());
+				cell.erase(cell.begin() + keep, cell.end());
+			}
+		}
+
+		/// final candidates: (score, last state, rank)
+		std::vector<Hypothesis> tail;
+		for (size_t j = 0; j < S; j++) {
+			if (end != CHAIN_OPEN && j != end)
+				continue;
+			const std::vector<Hypothesis>& cell = lattice[S * (T-1) + j];
+			for (size_t r = 0; r < cell.size(); r++)
+				tail.push_back(Hypothesis(cell[r].score, j, r));
+		}
+		size_t keep = std::min(K, tail.size());
+		std::partial_sort(tail.begin(), tail.begin() + keep, tail.end());
+
+		paths.clear();
+		scores.clear();
+		for (size_t n = 0; n < keep; n++) {
+			std::vector<size_t> y_seq(T);
+			size_t y = tail[n].state, rank = tail[n].rank;
+			for (size_t i = T; i >= 1; i--) {
+				y_seq[i-1] = y;
+				const Hypothesis& h = lattice[S * (i-1) + y][rank];
+				y = h.state;
+				rank = h.rank;
+			}
+			paths.push_back(y_seq);
+			scores.push_back(tail[n].score);
+		}
+	}
+};
+
+/** Runtime dispatch from the state count to the engine specialized for it.
+	Tries N, N-1, ..., 1 and falls back to the generic engine (N = 0).
+	@class Chain
+*/
+template <class SR, size_t N = CHAIN_FIXED_MAX>
+struct Chain {
+	typedef typename SR::value value;
+
+	template <class P>
+	static void forward(const P& pot, size_t T, value* alpha, long double* scale = NULL) {
+		if (pot.size() == N)
+			ChainEngine<SR, N>::forward(pot, T, alpha, scale);
+		else
+			Chain<SR, N-1>::forward(pot, T, alpha, scale);
+	}
+	template <class P>
+	static void backward(const P& pot, size_t T, size_t end, value* beta, long double* scale = NULL) {
+		if (pot.size() == N)
+			ChainEngine<SR, N>::backward(pot, T, end, beta, scale);
+		else
+			Chain<SR, N-1>::backward(pot, T, end, beta, scale);
+	}
+	template <class P>
+	static void viterbi(const P& pot, size_t T, value* delta, size_t* psi, size_t start) {
+		if (pot.size() == N)
+			ChainEngine<SR, N>::viterbi(pot, T, delta, psi, start);
+		else
+			Chain<SR, N-1>::viterbi(pot, T, delta, psi, start);
+	}
+	template <class P>
+	static void kbest(const P& pot, size_t T, size_t end, size_t K, std::vector<std::vector<size_t> >& paths, std::vector<value>& scores) {
+		ChainEngine<SR, 0>::kbest(pot, T, end, K, paths, scores);
+	}
+	template <class P>
+	static void viterbi(const P& pot, size_t T, const std::vector<std::vector<size_t> >& allowed, value* delta, size_t* psi, size_t start) {
+		ChainEngine<SR, 0>::viterbi(pot, T, allowed, delta, psi, start);
+	}
+	template <class P>
+	static value greedy(const P& pot, size_t T, size_t* y, size_t end = CHAIN_OPEN) {
+		return ChainEngine<SR, 0>::greedy(pot, T, y, end);
+	}
+};
+
+template <class SR>
+struct Chain<SR, 0> {
+	typedef typename SR::value value;
+
+	template <class P>
+	static void forward(const P& pot, size_t T, value* alpha, long double* scale = NULL) {
+		ChainEngine<SR, 0>::forward(pot, T, alpha, scale);
+	}
+	template <class P>
+	static void backward(const P& pot, size_t T, size_t end, value* beta, long double* scale = NULL) {
+		ChainEngine<SR, 0>::backward(pot, T, end, beta, scale);
+	}
+	template <class P>
+	static void viterbi(const P& pot, size_t T, value* delta, size_t* psi, size_t start) {
+		ChainEngine<SR, 0>::viterbi(pot, T, delta, psi, start);
+	}
+	template <class P>
+	static void kbest(const P& pot, size_t T, size_t end, size_t K, std::vector<std::vector<size_t> >& paths, std::vector<value>& scores) {
+		ChainEngine<SR, 0>::kbest(pot, T, end, K, paths, scores);
+	}
+	template <class P>
+	static void viterbi(const P& pot, size_t T, const std::vector<std::vector<size_t> >& allowed, value* delta, size_t* psi, size_t start) {
+		ChainEngine<SR, 0>::viterbi(pot, T, allowed, delta, psi, start);
+	}
+	template <class P>
+	static value greedy(const P& pot, size_t T, size_t* y, size_t end = CHAIN_OPEN) {
+		return ChainEngine<SR, 0>::greedy(pot, T, y, end);
+	}
+};
+
+/** Back-tracking of the best path.
+	@param psi		back-pointer matrix (T x S)
+	@param T		number of positions
+	@param S		number of states
+	@param last		state at the last position
+	@return state sequence of positions 0..T-2
+*/
+inline std::vector<size_t> chainBacktrack(const size_t* psi, size_t T, size_t S, size_t last) {
+	std::vector<size_t> y_seq;
+	size_t prev_y = last;
+	for (size_t i = T-1; i >= 1; i--) {
+		size_t y = psi[S * i + prev_y];
+		y_seq.push_back(y);
+		prev_y = y;
+	}
+	std::reverse(y_seq.begin(), y_seq.end());
+	return y_seq;
+}
+
+} // namespace tricrf
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "CoarseToFine.h"
+
+using namespace std;
+
+namespace tricrf {
+
+/** Constructor.
+	@param prune	coarse states below the best / prune are pruned (0 for no coarse-to-fine decoding)
+	@param exact	search in full when the path is not certified
+*/
+CoarseToFine::CoarseToFine(double prune, bool exact) {
+	m_Prune = prune;
+	m_Exact = exact;
+	m_Count = 0;
+	m_Uncertified = 0;
+	m_Cells = 0.0;
+	m_FullCells = 0.0;
+	m_Seconds = 0.0;
+}
+
+/** Coarse label of a label.
+	The mapping is looked up with the label, and then with the label without its B/I suffix;
+	without an entry, it is the label without the suffix and without the part after the first '.'.
+	@param label	fine label (e.g. FROMLOC.CITY_NAME-B)
+	@param mapping	fine label (or type) -> coarse label
+	@return coarse label (e.g. FROMLOC)
+*/
+string CoarseToFine::project(const string& label, const map<string, string>& mapping) {
+	map<string, string>::const_iterator it = mapping.find(label);
+	if (it != mapping.end())
+		return it->second;
+	string type = label;
+	if (type.size() > 2 && type[type.size()-2] == '-' && (type[type.size()-1] == 'B' || type[type.size()-1] == 'I'))
+		type.erase(type.size()-2);
+	it = mapping.find(type);
+	if (it != mapping.end())
+		return it->second;
+	size_t dot = type.find('.');
+	if (dot != string::npos && dot > 0)
+		type.erase(dot);
+	return type;
+}
+
+/** Load a mapping file.
+	@param filename	one "label coarse_label" pair per line (the label may be a type without the B/I suffix)
+	@param mapping	output mapping
+	@return success or fail
+*/
+bool CoarseToFine::readMap(const string& filename, map<string, string>& mapping) {
+	ifstream f(filename.c_str());
+	if (!f)
+		return false;
+	string line;
+	while (getline(f, line)) {
+		vector<string> tokens = tokenize(line, " \t\r");
+		if (tokens.size() >= 2)
+			mapping[tokens[0]] = tokens[1];
+	}
+	return true;
+}
+
+/** Build the coarse states of a chain.
+	@param labels	label of each fine state
+	@param mapping	fine label (or type) -> coarse label
+*/
+void CoarseToFine::build(const vector<string>& labels, const map<string, string>& mapping) {
+	map<string, size_t> coarse_id;
+	m_Coarse.resize(labels.size());
+	m_Members.clear();
+	for (size_t j = 0; j < labels.size(); j++) {
+		string coarse = project(labels[j], mapping);
+		map<string, size_t>::iterator it = coarse_id.find(coarse);
+		if (it == coarse_id.end()) {
+			it = coarse_id.insert(make_pair(coarse, m_Members.size())).first;
+			m_Members.push_back(vector<size_t>());
+		}
+		m_Coarse[j] = it->second;
+		m_Members[it->second].push_back(j);
+	}
+}
+
+/// Add the counts of another chain or thread
+void CoarseToFine::merge(const CoarseToFine& other) {
+	m_Count += other.m_Count;
+	m_Uncertified += other.m_Uncertified;
+	m_Cells += other.m_Cells;
+	m_FullCells += other.m_FullCells;
+	m_Seconds += other.m_Seconds;
+}
+
+/// Report the pruning and the certified paths
+void CoarseToFine::report(Logger *logger) const {
+	if (m_Prune <= 0.0)
+		return;
+	logger->report("[Coarse-to-fine decoding]\n");
+	logger->report("  prune = \t\t%g\n", m_Prune);
+	if (m_Coarse.size() > 0)
+		logger->report("  states = \t\t%d fine, %d coarse\n", m_Coarse.size(), m_Members.size());
+	logger->report("  chains = \t\t%d\n", m_Count);
+	logger->report("  uncertified = \t%d (%s)\n", m_Uncertified, m_Exact ? "searched in full" : "kept");
+	logger->report("  fine cells = \t\t%.2f%% of the full Viterbi\n", m_FullCells > 0.0 ? 100.0 * m_Cells / m_FullCells : 0.0);
+	logger->report("  search time = \t%.3f\n\n", m_Seconds);
+}
+
+} // namespace tricrf
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __COARSETOFINE_H__
+#define __COARSETOFINE_H__
+
+/// max headers
+#include "Utility.h"
+#include "Chain.h"
+/// standard headers
+#include <vector>
+#include <string>
+#include <map>
+
+namespace tricrf {
+
+/** Coarse-to-fine Viterbi decoding over a label hierarchy (CRF and TriCRF chains).
+	Each label is projected to a coarse label: its entry in the mapping file if any, otherwise the label
+	without the B/I suffix and without the part after the first '.' (FROMLOC.CITY_NAME-B -> FROMLOC).
+	The coarse chain takes the largest node and edge factors of the members, so the max-marginal of
+	a coarse state at a position bounds the score of every fine path through it. The coarse states
+	below the best / prune are pruned, and Viterbi searches only the members of the remaining ones.
+	The path is exact if no pruned state bounds a better score; otherwise it is searched again in full
+	(exact mode) or kept (counted as uncertified).
+	@class CoarseToFine
+*/
+class CoarseToFine {
+	double m_Prune;			///< coarse states below the best / m_Prune are pruned (0 for none)
+	bool m_Exact;			///< search in full when the path is not certified
+	std::vector<size_t> m_Coarse;	///< coarse state of each fine state
+	std::vector<std::vector<size_t> > m_Members;	///< fine states of each coarse state
+	std::vector<long double> m_Edge;	///< coarse edge factor (C x C)
+	std::vector<long double> m_Start;	///< coarse factor into the first position
+	size_t m_Count;			///< chains searched
+	size_t m_Uncertified;	///< chains whose path was not certified
+	double m_Cells, m_FullCells;	///< fine cells searched (with the full searches), and those of the full Viterbi
+	double m_Seconds;		///< search time
+
+public:
+	CoarseToFine(double prune = 0.0, bool exact = true);
+	static std::string project(const std::string& label, const std::map<std::string, std::string>& mapping);
+	static bool readMap(const std::string& filename, std::map<std::string, std::string>& mapping);
+	void build(const std::vector<std::string>& labels, const std::map<std::string, std::string>& mapping);
+	bool enabled() const { return m_Prune > 0.0 && m_Members.size() < m_Coarse.size(); };
+	template <class P> void bound(const P& pot);	///< Coarse edge factors (after the edge factors change)
+	template <class P> bool search(const P& pot, size_t T, size_t start, size_t end, std::vector<size_t>& y, long double& score);
+	void merge(const CoarseToFine& other);
+	void report(Logger *logger) const;
+};
+
+/** Coarse edge and start factors: the largest factor among the members.
+	@param pot	potentials of the fine chain (only the edge and start factors are used)
+*/
+template <class P>
+void CoarseToFine::bound(const P& pot) {
+	const size_t C = m_Members.size();
+	m_Edge.assign(C * C, 0.0);
+	m_Start.assign(C, 0.0);
+	for (size_t k = 0; k < m_Coarse.size(); k++) {
+		m_Start[m_Coarse[k]] = std::max(m_Start[m_Coarse[k]], (long double)pot.start(k));
+		for (size_t j = 0; j < m_Coarse.size(); j++) {
+			long double& edge = m_Edge[C * m_Coarse[k] + m_Coarse[j]];
+			edge = std::max(edge, (long double)pot.edge(k, j));
+		}
+	}
+}
+
+/** Best path of a chain, searched over the members of the coarse states kept at each position.
+	@param pot		potentials of the fine chain
+	@param T		number of positions
+	@param start	back-pointer of the first position
+	@param end		end state at position T-1, or CHAIN_OPEN
+	@param y		output states of positions 0..T-1
+	@param score	output score of the path (as delta of the full Viterbi)
+	@return false if the chain is to be searched in full
+*/
+template <class P>
+bool CoarseToFine::search(const P& pot, size_t T, size_t start, size_t end, std::vector<size_t>& y, long double& score) {
+	if (T == 0)
+		return false;
+	wall_timer stop_watch;
+	const size_t S = pot.size(), C = m_Members.size();
+
+	/// Coarse node factors, and max-marginals of the coarse chain
+	std::vector<long double> R(T * C), alpha(T * C), beta(T * C);
+	for (size_t i = 0; i < T; i++) {
+		for (size_t c = 0; c < C; c++) {
+			long double max = 0.0;
+			for (size_t x = 0; x < m_Members[c].size(); x++)
+				max = std::max(max, (long double)pot.node(i, m_Members[c][x]));
+			R[C * i + c] = max;
+		}
+	}
+	DensePotential coarse(&R[0], &m_Edge[0], C, &m_Start[0]);
+	Chain<MaxProduct>::forward(coarse, T, &alpha[0]);
+	Chain<MaxProduct>::backward(coarse, T, (end == CHAIN_OPEN ? CHAIN_OPEN : m_Coarse[end]), &beta[0]);
+	long double best = 0.0;
+	for (size_t c = 0; c < C; c++)
+		best = std::max(best, alpha[C * (T-1) + c] * beta[C * (T-1) + c]);
+
+	/// Pruning: the fine states of the coarse states above the threshold
+	long double threshold = best / m_Prune, pruned = 0.0;
+	std::vector<std::vector<size_t> > allowed(T);
+	std::vector<bool> keep(C);
+	double cells = 0.0;
+	for (size_t i = 0; i < T; i++) {
+		for (size_t c = 0; c < C; c++) {
+			long double mm = alpha[C * i + c] * beta[C * i + c];
+			keep[c] = (mm > 0.0 && mm >= threshold);
+			if (!keep[c])
+				pruned = std::max(pruned, mm);
+		}
+		if (i == T-1 && end != CHAIN_OPEN)
+			allowed[i].assign(1, end);
+		else {
+			for (size_t j = 0; j < S; j++)
+				if (keep[m_Coarse[j]])
+					allowed[i].push_back(j);
+		}
+		cells += (double)allowed[i].size() * (i > 0 ? allowed[i-1].size() : 1);
+	}
+
+	/// Fine search over the lattice
+	bool certified = false;
+	score = 0.0;
+	if (best > 0.0 && allowed[T-1].size() > 0) {
+		std::vector<long double> delta(T * S);
+		std::vector<size_t> psi(T * S);
+		Chain<MaxProduct>::viterbi(pot, T, allowed, &delta[0], &psi[0], start);
+		size_t last = allowed[T-1][0];
+		for (size_t x = 1; x < allowed[T-1].size(); x++)
+			if (delta[S * (T-1) + allowed[T-1][x]] > delta[S * (T-1) + last])
+				last = allowed[T-1][x];
+		score = delta[S * (T-1) + last];
+		y.resize(T);
+		y[T-1] = last;
+		for (size_t i = T-1; i >= 1; i--)
+			y[i-1] = psi[S * i + y[i]];
+		certified = (score > 0.0 && score >= pruned);	///< no pruned state may hold a better path
+	}
+
+	++m_Count;
+	m_FullCells += (double)T * S * S;
+	m_Cells += cells;
+	if (!certified) {
+		++m_Uncertified;
+		if (m_Exact || score <= 0.0)
+			m_Cells += (double)T * S * S;	///< searched again in full by the caller
+	}
+	m_Seconds += stop_watch.elapsed();
+	return certified || (!m_Exact && score > 0.0);
+}
+
+} // namespace tricrf
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "Corpus.h"
+/// standard headers
+#include <stdexcept>
+#include <stdint.h>
+
+using namespace std;
+
+namespace tricrf {
+
+////////////////////////////////////////////////////////////////////////
+/// CorpusWriter
+////////////////////////////////////////////////////////////////////////
+
+CorpusWriter::CorpusWriter() {
+	m_File = NULL;
+	m_Size = 0;
+	m_Bytes = 0;
+}
+
+CorpusWriter::~CorpusWriter() {
+	close();
+}
+
+void CorpusWriter::open(const string& filename) {
+	close();
+	if (!(m_File = fopen(filename.c_str(), "wb")))
+		throw runtime_error("cannot open corpus file to write");
+	m_Size = 0;
+	m_Bytes = 0;
+}
+
+void CorpusWriter::write(const Sequence& seq, double count) {
+	uint32_t n = seq.size();
+	bool ok = (fwrite(&count, sizeof(double), 1, m_File) == 1);
+	ok = ok && (fwrite(&n, sizeof(uint32_t), 1, m_File) == 1);
+	m_Bytes += sizeof(double) + sizeof(uint32_t);
+	for (Sequence::const_iterator it = seq.begin(); ok && it != seq.end(); ++it) {
+		uint32_t label = it->label;
+		uint32_t n_obs = it->obs.size();
+		ok = ok && (fwrite(&label, sizeof(uint32_t), 1, m_File) == 1);
+		ok = ok && (fwrite(&it->fval, sizeof(double), 1, m_File) == 1);
+		ok = ok && (fwrite(&n_obs, sizeof(uint32_t), 1, m_File) == 1);
+		for (size_t i = 0; ok && i < it->obs.size(); i++) {
+			uint32_t pid = it->obs[i].first;
+			ok = ok && (fwrite(&pid, sizeof(uint32_t), 1, m_File) == 1);
+			ok = ok && (fwrite(&it->obs[i].second, sizeof(double), 1, m_File) == 1);
+		}
+		m_Bytes += 2 * sizeof(uint32_t) + sizeof(double) + n_obs * (sizeof(uint32_t) + sizeof(double));
+	}
+	if (!ok)
+		throw runtime_error("cannot write corpus file");
+	++m_Size;
+}
+
+void CorpusWriter::close() {
+	if (m_File) {
+		fclose(m_File);
+		m_File = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+/// CorpusReader
+////////////////////////////////////////////////////////////////////////
+
+CorpusReader::CorpusReader() {
+	m_Window = 0;
+	m_Running = false;
+	pthread_mutex_init(&m_Mutex, NULL);
+	pthread_cond_init(&m_NotEmpty, NULL);
+	pthread_cond_init(&m_NotFull, NULL);
+}
+
+CorpusReader::~CorpusReader() {
+	stop();
+	pthread_mutex_destroy(&m_Mutex);
+	pthread_cond_destroy(&m_NotEmpty);
+	pthread_cond_destroy(&m_NotFull);
+}
+
+/** Open a packed corpus file.
+	@param filename	packed corpus file
+	@param window	maximum bytes of sequences read ahead
+*/
+void CorpusReader::open(const string& filename, size_t window) {
+	stop();
+	m_Filename = filename;
+	m_Window = window;
+}
+
+void CorpusReader::rewind() {
+	stop();
+	m_Queue.clear();
+	m_QueueBytes.clear();
+	m_Bytes = 0;
+	m_Eof = false;
+	m_Stop = false;
+	m_Error = "";
+	if (pthread_create(&m_Thread, NULL, &CorpusReader::readAhead, this) != 0)
+		throw runtime_error("cannot create the read-ahead thread");
+	m_Running = true;
+}
+
+void CorpusReader::stop() {
+	if (!m_Running)
+		return;
+	pthread_mutex_lock(&m_Mutex);
+	m_Stop = true;
+	pthread_cond_broadcast(&m_NotFull);
+	pthread_mutex_unlock(&m_Mutex);
+	pthread_join(m_Thread, NULL);
+	m_Running = false;
+}
+
+void* CorpusReader::readAhead(void* reader) {
+	((CorpusReader*)reader)->run();
+	return NULL;
+}
+
+/// Read-ahead loop (in the background thread)
+void CorpusReader::run() {
+	string error = "";
+	FILE *f = fopen(m_Filename.c_str(), "rb");
+	if (!f)
+		error = "cannot open corpus file";
+	vector<char> buffer(1 << 20);
+	if (f)
+		setvbuf(f, &buffer[0], _IOFBF, buffer.size());
+
+	while (f) {
+		pair<Sequence, double> record;
+		uint32_t n;
+		if (fread(&record.second, sizeof(double), 1, f) != 1)
+			break;	///< end of file
+		bool ok = (fread(&n, sizeof(uint32_t), 1, f) == 1);
+		size_t bytes = sizeof(record) + n * sizeof(Event);
+		record.first.resize(n);
+		for (size_t i = 0; ok && i < n; i++) {
+			Event& ev = record.first[i];
+			uint32_t label, n_obs;
+			ok = ok && (fread(&label, sizeof(uint32_t), 1, f) == 1);
+			ok = ok && (fread(&ev.fval, sizeof(double), 1, f) == 1);
+			ok = ok && (fread(&n_obs, sizeof(uint32_t), 1, f) == 1);
+			ev.label = label;
+			if (!ok)
+				break;
+			ev.obs.resize(n_obs);
+			for (size_t j = 0; ok && j < n_obs; j++) {
+				uint32_t pid;
+				ok = ok && (fread(&pid, sizeof(uint32_t), 1, f) == 1);
+				ok = ok && (fread(&ev.obs[j].second, sizeof(double), 1, f) == 1);
+				ev.obs[j].first = pid;
+			}
+			bytes += n_obs * sizeof(pair<size_t, double>);
+		}
+		if (!ok) {
+			error = "corrupted corpus file";
+			break;
+		}
+
+		/// waiting for room in the window
+		pthread_mutex_lock(&m_Mutex);
+		while (!m_Stop && !m_Queue.empty() && m_Bytes + bytes > m_Window)
+			pthread_cond_wait(&m_NotFull, &m_Mutex);
+		if (m_Stop) {
+			pthread_mutex_unlock(&m_Mutex);
+			break;
+		}
+		m_Queue.push_back(pair<Sequence, double>());
+		m_Queue.back().first.swap(record.first);
+		m_Queue.back().second = record.second;
+		m_QueueBytes.push_back(bytes);
+		m_Bytes += bytes;
+		pthread_cond_signal(&m_NotEmpty);
+		pthread_mutex_unlock(&m_Mutex);
+	}
+	if (f)
+		fclose(f);
+
+	pthread_mutex_lock(&m_Mutex);
+	m_Eof = true;
+	m_Error = error;
+	pthread_cond_signal(&m_NotEmpty);
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+/** Get the next sequence of the current pass.
+	@param seq	sequence (swapped out of the window)
+	@param count	count of the sequence
+	@return false at the end of the pass
+*/
+bool CorpusReader::next(Sequence& seq, double& count) {
+	pthread_mutex_lock(&m_Mutex);
+	while (m_Queue.empty() && !m_Eof)
+		pthread_cond_wait(&m_NotEmpty, &m_Mutex);
+	if (m_Queue.empty()) {
+		string error = m_Error;
+		pthread_mutex_unlock(&m_Mutex);
+		stop();		///< the read-ahead thread has finished
+		if (error != "")
+			throw runtime_error(error);
+		return false;
+	}
+	seq.swap(m_Queue.front().first);
+	count = m_Queue.front().second;
+	m_Bytes -= m_QueueBytes.front();
+	m_Queue.pop_front();
+	m_QueueBytes.pop_front();
+	pthread_cond_signal(&m_NotFull);
+	pthread_mutex_unlock(&m_Mutex);
+	return true;
+}
+
+} // namespace tricrf
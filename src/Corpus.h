@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+/// max headers
+#include "Data.h"
+/// standard headers
+#include <string>
+#include <deque>
+#include <cstdio>
+#include <pthread.h>
+
+namespace tricrf {
+
+/** Writer of a packed (binary, id-based) corpus file for out-of-core training.
+	A record is a sequence: count (double), # of events (uint32), and for each event
+	label (uint32), fval (double), # of observations (uint32), and (pid (uint32), value (double)) pairs.
+	@class CorpusWriter
+*/
+class CorpusWriter {
+private:
+	FILE *m_File;
+	size_t m_Size;		///< number of sequences
+	size_t m_Bytes;		///< file size
+public:
+	CorpusWriter();
+	~CorpusWriter();
+	void open(const std::string& filename);
+	void write(const Sequence& seq, double count = 1.0);
+	void close();
+	size_t size() { return m_Size; };
+	size_t bytes() { return m_Bytes; };
+};
+
+/** Streaming reader of a packed corpus file.
+	A background thread reads ahead and decodes the sequences into a bounded window,
+	so that the disk I/O overlaps with the computation on the sequences already read.
+	@class CorpusReader
+*/
+class CorpusReader {
+private:
+	std::string m_Filename;
+	size_t m_Window;		///< maximum bytes of decoded sequences in memory
+
+	/// Read-ahead thread and its queue
+	pthread_t m_Thread;
+	bool m_Running;
+	pthread_mutex_t m_Mutex;
+	pthread_cond_t m_NotEmpty;
+	pthread_cond_t m_NotFull;
+	std::deque<std::pair<Sequence, double> > m_Queue;
+	std::deque<size_t> m_QueueBytes;
+	size_t m_Bytes;
+	bool m_Eof;
+	bool m_Stop;
+	std::string m_Error;
+
+	static void* readAhead(void* reader);
+	void run();
+	void stop();
+
+public:
+	CorpusReader();
+	~CorpusReader();
+	void open(const std::string& filename, size_t window);
+	void rewind();		///< Start a new pass over the corpus
+	bool next(Sequence& seq, double& count);	///< Next sequence of the pass (false at the end)
+};
+
+} // namespace tricrf
+
+#endif
@@ -38,6 +38,11 @@ struct StringEvent {
 typedef std::vector<Event> Sequence;
 typedef std::vector<StringEvent> StringSequence;
 
+/** Tokenized sequence: the tokens of each line of a data file (the label first, then the features),
+	e.g. made by a feature extraction in memory. For a triangular-chain model, the first line is the topic.
+*/
+typedef std::vector<std::vector<std::string> > TokenSequence;
+
 /** TriSequence.
 	@class TriSequence
 */
@@ -64,10 +69,52 @@ class Data : public std::vector<T> {
 private:
 	size_t n_element;
 public:
-	void append(T element) { push_back(element); n_element += element.size(); };
+	Data() : n_element(0) {}
+	void append(T element) { this->push_back(element); n_element += element.size(); };
+	void clear() { std::vector<T>::clear(); n_element = 0; };
 	size_t size_element() { return n_element; };
 };
 
+/** Hold out some elements of a data set (e.g. a cross-validation fold).
+	The held-out elements are copied to the other data set, and their counts in the original set are 
+	set to zero (training skips them) so that the memory of the original set is not modified.
+	@param data	data set
+	@param count	counts of the data set
+	@param held_out	elements to be held out
+	@param other	held-out data set (cleared before)
+	@param other_count	counts of the held-out data set
+*/
+template <typename T>
+void holdOutData(Data<T>& data, std::vector<double>& count, const std::vector<bool>& held_out, Data<T>& other, std::vector<double>& other_count) {
+	other.clear();
+	other_count.clear();
+	for (size_t i = 0; i < data.size() && i < held_out.size(); i++) {
+		if (held_out[i] && count[i] > 0.0) {
+			other.append(data[i]);
+			other_count.push_back(count[i]);
+			count[i] = 0.0;
+		}
+	}
+}
+
+/** Reorder the elements of a data set.
+	@param data	data set
+	@param count	counts of the data set
+	@param order	old index of each new element
+*/
+template <typename T>
+void reorderData(Data<T>& data, std::vector<double>& count, const std::vector<size_t>& order) {
+	std::vector<T> element(order.size());
+	std::vector<double> element_count(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		element[i].swap(data[order[i]]);
+		element_count[i] = count[order[i]];
+	}
+	for (size_t i = 0; i < order.size(); i++)
+		data[i].swap(element[i]);
+	count.swap(element_count);
+}
+
 } // namespace tricrf
 
 #endif
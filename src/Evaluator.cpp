@@ -341,6 +341,7 @@ double Evaluator::addLikelihood(double p, double w) {
 */
 double Evaluator::subLoglikelihood(double p) {
 	loglikelihood += p;
+	return loglikelihood;
 }
 
 /** Get loglikelihood.
@@ -403,6 +404,81 @@ void Evaluator::Print(Logger *logger) {
 	}
 }
 
+/** Constructor.
+	@param param	parameter of the sequence labels
+*/
+DecoderComparison::DecoderComparison(Parameter& param) : m_Param(param) {
+	for (size_t d = 0; d < 2; d++) {
+		m_Eval[d].encode(param);
+		m_Eval[d].initialize();
+		m_Time[d] = 0.0;
+		m_TopicCorrect[d] = 0;
+	}
+	m_Topic = m_TopicSame = 0;
+	m_Token = m_TokenSame = 0;
+	m_Sequence = m_SequenceSame = 0;
+}
+
+/** Append the labels of a sequence.
+	@param reference	true labels
+	@param viterbi	labels of the Viterbi decoding
+	@param greedy	labels of the greedy decoding
+	@param viterbi_time	search time of the Viterbi decoding
+	@param greedy_time	search time of the greedy decoding
+*/
+void DecoderComparison::append(const vector<string>& reference, const vector<string>& viterbi, const vector<string>& greedy, double viterbi_time, double greedy_time) {
+	m_Eval[0].append(m_Param, reference, viterbi);
+	m_Eval[1].append(m_Param, reference, greedy);
+	m_Time[0] += viterbi_time;
+	m_Time[1] += greedy_time;
+	size_t same = 0;
+	for (size_t i = 0; i < viterbi.size(); i++)
+		if (viterbi[i] == greedy[i])
+			++same;
+	m_Token += viterbi.size();
+	m_TokenSame += same;
+	++m_Sequence;
+	if (same == viterbi.size())
+		++m_SequenceSame;
+}
+
+/** Append the topic of a sequence (triangular-chain models).
+	@param reference	true topic
+	@param viterbi	topic of the Viterbi decoding
+	@param greedy	topic of the greedy decoding
+*/
+void DecoderComparison::appendTopic(size_t reference, size_t viterbi, size_t greedy) {
+	++m_Topic;
+	if (viterbi == reference)
+		++m_TopicCorrect[0];
+	if (greedy == reference)
+		++m_TopicCorrect[1];
+	if (viterbi == greedy)
+		++m_TopicSame;
+}
+
+/// Report the two decoders side by side
+void DecoderComparison::report(Logger *logger) {
+	const char* name[2] = { "viterbi", "greedy" };
+	logger->report("[Decoder comparison]\n");
+	logger->report("  %-9s %10s %10s %14s", "decoder", "Acc", "MicroF1", "search(ms/seq)");
+	if (m_Topic > 0)
+		logger->report(" %10s", "TopicAcc");
+	logger->report("\n");
+	for (size_t d = 0; d < 2; d++) {
+		m_Eval[d].calculateF1();
+		double ms = (m_Sequence > 0 ? 1000.0 * m_Time[d] / m_Sequence : 0.0);
+		logger->report("  %-9s %10.3f %10.3f %14.4f", name[d], m_Eval[d].getAccuracy(), m_Eval[d].getMicroF1()[2], ms);
+		if (m_Topic > 0)
+			logger->report(" %10.3f", 100.0 * m_TopicCorrect[d] / m_Topic);
+		logger->report("\n");
+	}
+	logger->report("  same labels = \t%8.3f\n", (m_Token > 0 ? 100.0 * m_TokenSame / m_Token : 0.0));
+	logger->report("  same sequences = \t%8.3f\n", (m_Sequence > 0 ? 100.0 * m_SequenceSame / m_Sequence : 0.0));
+	if (m_Topic > 0)
+		logger->report("  same topics = \t%8.3f\n", 100.0 * m_TopicSame / m_Topic);
+	logger->report("\n");
+}
 
 }	// namespace tricrf
 
@@ -19,6 +19,17 @@
 
 namespace tricrf {
 
+/** Summary scores of an evaluation on held-out data.
+	@struct Score
+*/
+struct Score {
+	double accuracy;			///< accuracy (sequence labeling)
+	double micro_f1;			///< micro averaged F1 score
+	double macro_f1;			///< macro averaged F1 score
+	double topic_accuracy;	///< topic accuracy (only for triangular-chain models, otherwise -1)
+	Score() : accuracy(0.0), micro_f1(0.0), macro_f1(0.0), topic_accuracy(-1.0) {}
+};
+
 /** Evaluator class.
 	@class Evaluator
 */
@@ -91,6 +102,27 @@ public:
 };
 
 
+/** Comparison of the greedy decoding with the best-path (Viterbi) decoding on the same sequences.
+	It reports the accuracy and F1 score of each decoder, how often they agree and their search time.
+	@class DecoderComparison
+*/
+class DecoderComparison {
+private:
+	Parameter& m_Param;
+	Evaluator m_Eval[2];		///< Viterbi, greedy
+	double m_Time[2];		///< search time
+	size_t m_TopicCorrect[2];
+	size_t m_Topic, m_TopicSame;
+	size_t m_Token, m_TokenSame;
+	size_t m_Sequence, m_SequenceSame;
+
+public:
+	DecoderComparison(Parameter& param);
+	void append(const std::vector<std::string>& reference, const std::vector<std::string>& viterbi, const std::vector<std::string>& greedy, double viterbi_time, double greedy_time);
+	void appendTopic(size_t reference, size_t viterbi, size_t greedy);
+	void report(Logger *logger);
+};
+
 } // namespace tricrf
 
 #endif
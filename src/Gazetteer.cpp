@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "Gazetteer.h"
+#include "Utility.h"
+/// standard headers
+#include <deque>
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+namespace tricrf {
+
+/// Lowercased word
+static string normalize(const string& word) {
+	string w = word;
+	for (size_t i = 0; i < w.size(); i++)
+		w[i] = tolower((unsigned char)w[i]);
+	return w;
+}
+
+////////////////////////////////////////////////////////////////////////
+/// Gazetteer
+////////////////////////////////////////////////////////////////////////
+
+Gazetteer::Gazetteer() {
+	m_TokenPrefix = "word=";
+	m_Phrases = 0;
+	addState();		///< root
+}
+
+size_t Gazetteer::addState() {
+	m_Next.push_back(map<size_t, size_t>());
+	m_Fail.push_back(0);
+	m_Output.push_back(vector<pair<size_t, size_t> >());
+	return m_Next.size() - 1;
+}
+
+/** Load a phrase list.
+	@param filename	phrase list (one phrase per line, the words separated by spaces)
+	@param type	type of the phrases (e.g. CITY)
+	@return success or fail
+*/
+bool Gazetteer::load(const string& filename, const string& type) {
+	ifstream f(filename.c_str());
+	if (!f)
+		return false;
+	string line;
+	while (getline(f, line))
+		addPhrase(line, type);
+	build();
+	return true;
+}
+
+/** Add a phrase to the trie.
+	@param phrase	words separated by spaces (an empty phrase is ignored)
+	@param type	type of the phrase
+*/
+void Gazetteer::addPhrase(const string& phrase, const string& type) {
+	vector<string> words = tokenize(phrase, " \t\r");
+	if (words.size() == 0)
+		return;
+
+	size_t type_id = find(m_Types.begin(), m_Types.end(), type) - m_Types.begin();
+	if (type_id == m_Types.size())
+		m_Types.push_back(type);
+
+	size_t state = 0;
+	for (size_t i = 0; i < words.size(); i++) {
+		string w = normalize(words[i]);
+		map<string, size_t>::iterator vit = m_Vocab.find(w);
+		if (vit == m_Vocab.end())
+			vit = m_Vocab.insert(make_pair(w, m_Vocab.size())).first;
+		map<size_t, size_t>::iterator it = m_Next[state].find(vit->second);
+		if (it == m_Next[state].end()) {
+			size_t next = addState();
+			m_Next[state][vit->second] = next;
+			state = next;
+		} else
+			state = it->second;
+	}
+	pair<size_t, size_t> out(type_id, words.size());
+	if (find(m_Output[state].begin(), m_Output[state].end(), out) == m_Output[state].end()) {
+		m_Output[state].push_back(out);
+		++m_Phrases;
+	}
+}
+
+/** Make the failure function in breadth-first order.
+	The outputs of a state are merged with those of its failure state,
+	so that a match reports every phrase ending at the position.
+*/
+void Gazetteer::build() {
+	/// the outputs of the trie only (in case of rebuilding)
+	vector<size_t> depth(m_Next.size(), 0);
+	deque<size_t> queue;
+	queue.push_back(0);
+	while (!queue.empty()) {
+		size_t u = queue.front();
+		queue.pop_front();
+		for (map<size_t, size_t>::iterator it = m_Next[u].begin(); it != m_Next[u].end(); ++it) {
+			depth[it->second] = depth[u] + 1;
+			queue.push_back(it->second);
+		}
+	}
+	for (size_t s = 0; s < m_Output.size(); s++) {
+		vector<pair<size_t, size_t> > own;
+		for (size_t j = 0; j < m_Output[s].size(); j++)
+			if (m_Output[s][j].second == depth[s])
+				own.push_back(m_Output[s][j]);
+		m_Output[s].swap(own);
+	}
+
+	queue.push_back(0);
+	while (!queue.empty()) {
+		size_t u = queue.front();
+		queue.pop_front();
+		for (map<size_t, size_t>::iterator it = m_Next[u].begin(); it != m_Next[u].end(); ++it) {
+			size_t w = it->first, v = it->second;
+			size_t f = 0;
+			if (u != 0) {
+				f = m_Fail[u];
+				while (f != 0 && m_Next[f].find(w) == m_Next[f].end())
+					f = m_Fail[f];
+				map<size_t, size_t>::iterator fit = m_Next[f].find(w);
+				f = (fit != m_Next[f].end() ? fit->second : 0);
+			}
+			m_Fail[v] = f;
+			m_Output[v].insert(m_Output[v].end(), m_Output[f].begin(), m_Output[f].end());
+			queue.push_back(v);
+		}
+	}
+}
+
+/** Match the phrases over a sequence of words in one pass.
+	@param words	words of the tokens ("" for a token without a word)
+	@param features	BIO-position features of each token (e.g. gaz=CITY-B)
+*/
+void Gazetteer::match(const vector<string>& words, vector<vector<string> >& features) const {
+	features.assign(words.size(), vector<string>());
+	size_t state = 0;
+	for (size_t i = 0; i < words.size(); i++) {
+		map<string, size_t>::const_iterator vit = m_Vocab.find(normalize(words[i]));
+		if (vit == m_Vocab.end()) {
+			state = 0;
+			continue;
+		}
+		while (state != 0 && m_Next[state].find(vit->second) == m_Next[state].end())
+			state = m_Fail[state];
+		map<size_t, size_t>::const_iterator it = m_Next[state].find(vit->second);
+		state = (it != m_Next[state].end() ? it->second : 0);
+
+		const vector<pair<size_t, size_t> >& out = m_Output[state];
+		for (size_t j = 0; j < out.size(); j++) {
+			size_t begin = i + 1 - out[j].second;
+			for (size_t t = begin; t <= i; t++) {
+				string fstr = "gaz=" + m_Types[out[j].first] + (t == begin ? "-B" : "-I");
+				if (find(features[t].begin(), features[t].end(), fstr) == features[t].end())
+					features[t].push_back(fstr);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+/// GazetteerFilter
+////////////////////////////////////////////////////////////////////////
+
+GazetteerFilter::GazetteerFilter(istream& in, const Gazetteer& gazetteer)
+	: m_In(in), m_Gazetteer(gazetteer) {
+	setg(NULL, NULL, NULL);
+}
+
+/// Read the next sequence and add the features
+GazetteerFilter::int_type GazetteerFilter::underflow() {
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	/// token lines of a sequence (up to a blank line)
+	vector<string> lines;
+	string line;
+	bool brk = false;
+	while (getline(m_In, line)) {
+		if (tokenize(line, " \t").size() == 0) {
+			brk = true;
+			break;
+		}
+		lines.push_back(line);
+	}
+	if (lines.empty() && !brk)
+		return traits_type::eof();
+
+	/// words of the tokens ("" for a line without the word feature)
+	const string& prefix = m_Gazetteer.getTokenPrefix();
+	vector<string> words(lines.size(), "");
+	for (size_t i = 0; i < lines.size(); i++) {
+		vector<string> tokens = tokenize(lines[i], " \t");
+		for (size_t j = 1; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, prefix.size(), prefix) == 0) {
+				words[i] = tokens[j].substr(prefix.size());
+				break;
+			}
+		}
+	}
+	vector<vector<string> > features;
+	m_Gazetteer.match(words, features);
+
+	m_Buffer.clear();
+	for (size_t i = 0; i < lines.size(); i++) {
+		m_Buffer += lines[i];
+		for (size_t j = 0; j < features[i].size(); j++)
+			m_Buffer += " " + features[i][j];
+		m_Buffer += "\n";
+	}
+	if (brk)
+		m_Buffer += "\n";
+
+	char *p = &m_Buffer[0];
+	setg(p, p, p + m_Buffer.size());
+	return traits_type::to_int_type(*gptr());
+}
+
+/// Rewinding to the beginning
+GazetteerFilter::pos_type GazetteerFilter::seekoff(off_type off, ios_base::seekdir way, ios_base::openmode which) {
+	if (off != 0 || way != ios_base::beg || !(which & ios_base::in))
+		return pos_type(off_type(-1));
+	m_In.clear();
+	m_In.seekg(0, ios::beg);
+	if (!m_In)
+		return pos_type(off_type(-1));
+	m_Buffer.clear();
+	setg(NULL, NULL, NULL);
+	return pos_type(0);
+}
+
+GazetteerFilter::pos_type GazetteerFilter::seekpos(pos_type pos, ios_base::openmode which) {
+	return seekoff(off_type(pos), ios_base::beg, which);
+}
+
+////////////////////////////////////////////////////////////////////////
+/// DataStream
+////////////////////////////////////////////////////////////////////////
+
+/** Open a data stream.
+	@param in	data
+	@param gazetteer	gazetteer (NULL or empty for none)
+*/
+DataStream::DataStream(istream& in, const Gazetteer* gazetteer)
+	: istream(NULL), m_Copy(NULL), m_Filter(NULL) {
+	istream* source = &in;
+	bool good = in.good();
+	if (good && in.tellg() != istream::pos_type(0)) {
+		m_Copy = new stringstream();
+		if (in.peek() != EOF)
+			*m_Copy << in.rdbuf();
+		m_Copy->clear();
+		source = m_Copy;
+	}
+	if (gazetteer != NULL && !gazetteer->empty()) {
+		m_Filter = new GazetteerFilter(*source, *gazetteer);
+		rdbuf(m_Filter);
+	} else
+		rdbuf(source->rdbuf());
+	if (!good)
+		setstate(ios::failbit);
+}
+
+DataStream::~DataStream() {
+	delete m_Filter;
+	delete m_Copy;
+}
+
+} // namespace tricrf
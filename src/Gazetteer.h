@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __GAZETTEER_H__
+#define __GAZETTEER_H__
+
+/// standard headers
+#include <vector>
+#include <string>
+#include <map>
+#include <istream>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+
+namespace tricrf {
+
+/** Gazetteer (phrase lists, e.g. city or airline names) matched with an Aho-Corasick automaton.
+	The automaton is built over words, so all the phrases are matched in one linear pass over
+	a sequence. Each token covered by a match gets a BIO-position feature of the phrase type
+	("gaz=CITY-B" for the first word, "gaz=CITY-I" for the others); overlapping matches give
+	all of their features. Words are matched case-insensitively.
+	@class Gazetteer
+*/
+class Gazetteer {
+private:
+	std::string m_TokenPrefix;		///< feature of the word of a token (e.g. "word=")
+	std::vector<std::string> m_Types;	///< phrase types
+	std::map<std::string, size_t> m_Vocab;	///< word -> word id
+
+	/// Automaton (state 0 is the root)
+	std::vector<std::map<size_t, size_t> > m_Next;	///< goto function
+	std::vector<size_t> m_Fail;		///< failure function
+	std::vector<std::vector<std::pair<size_t, size_t> > > m_Output;	///< (type, length) of the phrases ending in a state
+	size_t m_Phrases;
+
+	size_t addState();
+
+public:
+	Gazetteer();
+	void setTokenPrefix(const std::string& prefix) { m_TokenPrefix = prefix; };
+	const std::string& getTokenPrefix() const { return m_TokenPrefix; };
+	bool load(const std::string& filename, const std::string& type);	///< Load a phrase list (one phrase per line)
+	void addPhrase(const std::string& phrase, const std::string& type);
+	void build();	///< Make the failure function (after adding the phrases)
+	void match(const std::vector<std::string>& words, std::vector<std::vector<std::string> >& features) const;
+	bool empty() const { return m_Phrases == 0; };
+	size_t sizePhrase() const { return m_Phrases; };
+	size_t sizeType() const { return m_Types.size(); };
+	size_t sizeState() const { return m_Next.size(); };
+};
+
+/** Stream buffer adding the gazetteer features to the lines of a data file.
+	It reads a whole sequence (up to a blank line), matches the words of the tokens
+	and appends the features to the token lines. Lines without the word feature
+	(e.g. the topic line of a triangular-chain sequence) are passed as they are.
+	@class GazetteerFilter
+*/
+class GazetteerFilter : public std::streambuf {
+private:
+	std::istream& m_In;
+	const Gazetteer& m_Gazetteer;
+	std::string m_Buffer;	///< the current sequence with the features
+
+protected:
+	int_type underflow();
+	pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which = std::ios_base::in);
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in);
+
+public:
+	GazetteerFilter(std::istream& in, const Gazetteer& gazetteer);
+};
+
+/** Input stream of data, with the gazetteer features if a gazetteer is given.
+	Without a gazetteer, it reads the given stream directly. A stream that cannot be rewound
+	to its beginning (e.g. a pipe, or a stream not at its beginning) is read into memory first,
+	since the readers may read the data twice. Only the rewinding to the beginning is supported by seekg.
+	@class DataStream
+*/
+class DataStream : public std::istream {
+private:
+	std::stringstream *m_Copy;	///< the data in memory (if the stream cannot be rewound)
+	GazetteerFilter *m_Filter;
+public:
+	DataStream(std::istream& in, const Gazetteer* gazetteer = NULL);
+	~DataStream();
+};
+
+} // namespace tricrf
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "Grafting.h"
+/// standard headers
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace tricrf {
+
+/// Keep the full set of the parameters, all active
+void ActiveSet::keep(Parameter& param) {
+	size_t n = param.size();
+	m_Index.assign(param.m_ParamIndex.begin(), param.m_ParamIndex.end());
+	m_Weight.assign(param.getWeight(), param.getWeight() + n);
+	m_Gradient.assign(n, 0.0);
+	m_Count.assign(param.getCount(), param.getCount() + n);
+	m_Active.assign(n, true);
+	m_NumActive = n;
+	m_Id.resize(n);
+	for (size_t i = 0; i < n; i++)
+		m_Id[i] = i;
+}
+
+/// Weights and gradient of the model to the full set (the inactive ones are zero)
+void ActiveSet::save(Parameter& param) {
+	fill(m_Weight.begin(), m_Weight.end(), 0.0);
+	fill(m_Gradient.begin(), m_Gradient.end(), 0.0);
+	double* weight = param.getWeight();
+	double* gradient = param.getGradient();
+	for (size_t fid = 0; fid < m_Id.size(); fid++) {
+		m_Weight[m_Id[fid]] = weight[fid];
+		m_Gradient[m_Id[fid]] = gradient[fid];
+	}
+}
+
+void ActiveSet::apply(Parameter& param) {
+	m_Id = param.setActive(m_Index, m_Active, &m_Weight[0], &m_Gradient[0], &m_Count[0]);
+}
+
+/// All the parameters, the inactive ones at zero (to compute their gradient)
+void ActiveSet::expand(Parameter& param) {
+	save(param);
+	m_Id = param.setActive(m_Index, vector<bool>(m_Active.size(), true), &m_Weight[0], &m_Gradient[0], &m_Count[0]);
+}
+
+/** Constructor.
+	@param init	fraction of the observation parameters active at the start, the most frequent first (0 for no grafting)
+	@param every	candidates are scored every this number of iterations
+	@param grow	parameters added at a time, as a fraction of the active set
+	@param threshold	minimum gradient of a candidate (difference of the expected and empirical counts)
+*/
+Grafting::Grafting(double init, size_t every, double grow, double threshold) {
+	m_Init = init;
+	m_Every = every;
+	m_Grow = grow;
+	m_Threshold = threshold;
+	m_Done = false;
+	m_Force = false;
+	m_Rounds = 0;
+	m_Added = 0;
+}
+
+/** Keep the full parameter set, and activate the transitions and the most frequent observation parameters.
+	@param param	parameters (all of them, with the empirical counts)
+*/
+void Grafting::start(Parameter& param) {
+	if (!enabled())
+		return;
+	keep(param);
+	size_t n = param.size();
+	m_Active.assign(n, false);
+	vector<pair<double, size_t> > freq;
+	for (size_t i = 0; i < param.m_StateIndex.size(); i++)
+		m_Active[param.m_StateIndex[i].fid] = true;
+	for (size_t i = 0; i < n; i++) {
+		if (!m_Active[i])
+			freq.push_back(make_pair(-m_Count[i], i));
+	}
+	size_t n_init = (size_t)ceil(m_Init * freq.size());
+	stable_sort(freq.begin(), freq.end());
+	for (size_t i = 0; i < n_init && i < freq.size(); i++)
+		m_Active[freq[i].second] = true;
+	m_NumActive = count(m_Active.begin(), m_Active.end(), true);
+	m_Done = (m_NumActive == n);
+	for (size_t i = 0; i < n; i++) {
+		if (!m_Active[i])
+			m_Weight[i] = 0.0;
+	}
+	apply(param);
+}
+
+bool Grafting::due(size_t iter) const {
+	return pending() && (m_Force || (iter > 0 && iter % m_Every == 0));
+}
+
+/** Add the inactive parameters with the largest gradient above the threshold, and keep the active ones.
+	@param param	expanded parameters, with the gradient of the objective
+	@param sigma	penalty value
+	@param L1	with L1, a parameter is a candidate only if its gradient also exceeds the penalty (1 / sigma)
+	@return number of the parameters added
+*/
+size_t Grafting::grow(Parameter& param, double sigma, bool L1) {
+	save(param);
+	m_Force = false;
+	++m_Rounds;
+	double min_score = (L1 && sigma ? max(m_Threshold, 1.0 / sigma) : m_Threshold);
+	vector<pair<double, size_t> > candidates;
+	for (size_t i = 0; i < m_Active.size(); i++) {
+		double score = fabs(m_Gradient[i]);
+		if (!m_Active[i] && score > min_score)
+			candidates.push_back(make_pair(-score, i));
+	}
+	size_t n_add = min(candidates.size(), max((size_t)1, (size_t)ceil(m_Grow * m_NumActive)));
+	partial_sort(candidates.begin(), candidates.begin() + n_add, candidates.end());
+	for (size_t i = 0; i < n_add; i++)
+		m_Active[candidates[i].second] = true;
+	m_NumActive += n_add;
+	m_Added += n_add;
+	m_Done = (n_add == 0 || m_NumActive == m_Active.size());
+	apply(param);
+	return n_add;
+}
+
+/// Report the active set
+void Grafting::report(Logger *logger) const {
+	if (!enabled())
+		return;
+	logger->report("[Feature induction]\n");
+	logger->report("  rounds = \t\t%d (every %d iterations)\n", m_Rounds, m_Every);
+	logger->report("  added = \t\t%d\n", m_Added);
+	logger->report("  active = \t\t%d of %d parameters (%.1f%%)\n\n", m_NumActive, m_Active.size(), 
+		(m_Active.size() > 0 ? 100.0 * m_NumActive / m_Active.size() : 0.0));
+}
+
+/// Margin of the gradient inside the L1 penalty for a weight to be counted at zero
+static const double L1_SAFE = 0.9;
+
+/** Constructor.
+	@param patience	iterations at zero before a weight is dropped (0 for none)
+	@param recheck	the dropped weights are rechecked every this number of iterations
+*/
+L1ActiveSet::L1ActiveSet(size_t patience, size_t recheck) {
+	m_Patience = patience;
+	m_Recheck = recheck;
+	m_Rounds = 0;
+	m_Dropped = 0;
+	m_Added = 0;
+	m_Skipped = 0.0;
+	m_Total = 0.0;
+}
+
+/// Keep the full parameter set (all active at the start)
+void L1ActiveSet::start(Parameter& param) {
+	if (!enabled())
+		return;
+	keep(param);
+	m_Zero.assign(param.size(), 0);
+}
+
+/** Count the iterations of the active weights at zero inside the penalty (after the gradient of an iteration).
+	@param param	parameters, with the gradient of the objective
+	@param sigma	penalty value
+*/
+void L1ActiveSet::track(Parameter& param, double sigma) {
+	if (!enabled())
+		return;
+	countZero(param, sigma);
+	m_Skipped += m_Active.size() - m_NumActive;
+	m_Total += m_Active.size();
+}
+
+void L1ActiveSet::countZero(Parameter& param, double sigma) {
+	double* weight = param.getWeight();
+	double* gradient = param.getGradient();
+	for (size_t fid = 0; fid < m_Id.size(); fid++) {
+		unsigned char& zero = m_Zero[m_Id[fid]];
+		if (weight[fid] == 0.0 && fabs(gradient[fid]) < L1_SAFE / sigma)
+			zero = (zero < 255 ? zero + 1 : zero);
+		else
+			zero = 0;
+	}
+}
+
+/** Add back the dropped weights which would move, and drop the weights at zero long enough.
+	@param param	expanded parameters, with the gradient of the objective
+	@param sigma	penalty value
+	@return whether the active set changed
+*/
+bool L1ActiveSet::recheck(Parameter& param, double sigma) {
+	countZero(param, sigma);
+	m_Total += m_Active.size();
+	save(param);
+	++m_Rounds;
+	bool changed = false;
+	for (size_t i = 0; i < m_Active.size(); i++) {
+		if (!m_Active[i] && fabs(m_Gradient[i]) >= 1.0 / sigma) {
+			m_Active[i] = true;
+			m_Zero[i] = 0;
+			++m_Added;
+			++m_NumActive;
+			changed = true;
+		} else if (m_Active[i] && m_Zero[i] >= m_Patience) {
+			m_Active[i] = false;
+			++m_Dropped;
+			--m_NumActive;
+			changed = true;
+		}
+	}
+	apply(param);
+	return changed;
+}
+
+/// Report the skipped weights
+void L1ActiveSet::report(Logger *logger) const {
+	if (!enabled())
+		return;
+	logger->report("[L1 active set]\n");
+	logger->report("  rechecks = \t\t%d (every %d iterations)\n", m_Rounds, m_Recheck);
+	logger->report("  dropped = \t\t%d, added back = %d\n", m_Dropped, m_Added);
+	logger->report("  active = \t\t%d of %d parameters\n", m_NumActive, m_Active.size());
+	logger->report("  skipped = \t\t%.1f%% of the parameters over the iterations\n\n", (m_Total > 0 ? 100.0 * m_Skipped / m_Total : 0.0));
+}
+
+} // namespace tricrf
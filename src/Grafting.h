@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __GRAFTING_H__
+#define __GRAFTING_H__
+
+/// max headers
+#include "Param.h"
+#include "Utility.h"
+/// standard headers
+#include <vector>
+#include <utility>
+
+namespace tricrf {
+
+/** Active subset of the parameters in L-BFGS training.
+	The full parameter set is kept aside, while the model holds only the active parameters
+	(see Parameter::setActive); the inactive ones are zero.
+	@class ActiveSet
+*/
+class ActiveSet {
+protected:
+	std::vector<std::vector<std::pair<size_t, size_t> > > m_Index;	///< all the parameters (feature -> (label, id))
+	std::vector<bool> m_Active;		///< active parameters (by id)
+	std::vector<size_t> m_Id;		///< id of each parameter of the model
+	std::vector<double> m_Weight, m_Gradient, m_Count;	///< all the parameters (by id)
+	size_t m_NumActive;
+
+	void keep(Parameter& param);	///< Keep the full set (all active)
+	void save(Parameter& param);	///< Weights and gradient of the model to the full set
+	void apply(Parameter& param);	///< The active parameters to the model
+
+public:
+	ActiveSet() : m_NumActive(0) {};
+	void expand(Parameter& param);	///< All the parameters (the inactive ones at zero), before the gradient
+};
+
+/** Gradient-based feature induction (grafting) in L-BFGS training.
+	Training starts with a small active set: the transitions and the most frequent observation parameters.
+	Every few iterations, the gradient is computed over all the parameters (the inactive ones at zero),
+	and the inactive parameters with the largest gradient above the threshold are added (with L1, also above
+	the penalty, so that they would move from zero). The parameters never added are not in the trained model.
+	@class Grafting
+*/
+class Grafting : public ActiveSet {
+	double m_Init;		///< fraction of the observation parameters active at the start (0 for no grafting)
+	size_t m_Every;		///< candidates are scored every m_Every iterations
+	double m_Grow;		///< parameters added at a time, as a fraction of the active set
+	double m_Threshold;	///< minimum gradient of a candidate
+	bool m_Done;		///< no candidate left to be added
+	bool m_Force;		///< score the candidates at the next iteration
+	size_t m_Rounds, m_Added;
+
+public:
+	Grafting(double init = 0.0, size_t every = 0, double grow = 0.25, double threshold = 1.0);
+	bool enabled() const { return m_Init > 0.0 && m_Init < 1.0 && m_Every > 0; };
+	void start(Parameter& param);	///< Keep the full set and activate the initial parameters
+	bool due(size_t iter) const;	///< Whether the candidates are scored in the iteration
+	bool pending() const { return enabled() && !m_Done; };	///< Whether some candidates may be added
+	void force() { m_Force = true; };	///< Score the candidates at the next iteration (e.g. converged on the active set)
+	size_t grow(Parameter& param, double sigma, bool L1);	///< Add the best candidates by the gradient, and keep the active ones
+	void report(Logger *logger) const;
+};
+
+/** Skipping the zero weights of L1 training.
+	A weight which stays at zero with its gradient safely inside the penalty (|g| < 1 / sigma, by a margin)
+	for a number of iterations will not move under the orthant-wise update, so it is dropped from the model,
+	i.e. from the factors and the gradient. Every few iterations, the gradient of all the parameters is
+	computed, the dropped weights which would move (|g| >= 1 / sigma) are added back, and the weights
+	at zero long enough are dropped.
+	@class L1ActiveSet
+*/
+class L1ActiveSet : public ActiveSet {
+	size_t m_Patience;	///< iterations at zero before a weight is dropped (0 for none)
+	size_t m_Recheck;	///< the dropped weights are rechecked every m_Recheck iterations
+	std::vector<unsigned char> m_Zero;	///< iterations at zero inside the penalty in a row (by id)
+	size_t m_Rounds, m_Dropped, m_Added;
+	double m_Skipped, m_Total;	///< parameters skipped, and all, summed over the iterations
+	void countZero(Parameter& param, double sigma);
+
+public:
+	L1ActiveSet(size_t patience = 0, size_t recheck = 0);
+	bool enabled() const { return m_Patience > 0 && m_Recheck > 0; };
+	void start(Parameter& param);
+	bool due(size_t iter) const { return enabled() && iter > 0 && iter % m_Recheck == 0; };	///< Whether the iteration rechecks
+	void track(Parameter& param, double sigma);	///< Count the zero weights, after the gradient
+	bool recheck(Parameter& param, double sigma);	///< Add back and drop the weights (expanded before the gradient)
+	void report(Logger *logger) const;
+};
+
+} // namespace tricrf
+
+#endif
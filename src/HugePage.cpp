@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "HugePage.h"
+/// standard headers
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <sys/mman.h>
+#include <pthread.h>
+
+using namespace std;
+
+namespace tricrf {
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;	///< 2MB (x86-64)
+
+static bool g_HugePages = false;
+static pthread_mutex_t g_HugeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Huge page mappings: address -> (mapped bytes, explicit huge pages)
+static map<void*, pair<size_t, bool> > g_HugeMap;
+
+void setHugePages(bool enable) {
+	g_HugePages = enable;
+}
+
+bool useHugePages() {
+	return g_HugePages;
+}
+
+/** Allocate memory.
+	A large block is mapped with explicit huge pages if possible, or aligned to the huge page size and
+	advised for transparent huge pages; small blocks (or when disabled) use the usual allocator.
+	@param bytes	size
+	@return memory
+*/
+void* allocateHuge(size_t bytes) {
+	if (!g_HugePages || bytes < HUGE_PAGE_SIZE)
+		return ::operator new(bytes);
+
+	size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	bool hugetlb = false;
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	/// explicit huge pages (if reserved)
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	hugetlb = (p != MAP_FAILED);
+#endif
+	if (p == MAP_FAILED) {
+		/// transparent huge pages: aligned to the huge page size
+		char *q = (char*)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ((void*)q == MAP_FAILED)
+			throw std::bad_alloc();
+		size_t head = (HUGE_PAGE_SIZE - (size_t)q % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+		if (head > 0)
+			munmap(q, head);
+		munmap(q + head + size, HUGE_PAGE_SIZE - head);
+		p = q + head;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);	///< fails quietly if not supported
+#endif
+	}
+
+	pthread_mutex_lock(&g_HugeLock);
+	g_HugeMap[p] = make_pair(size, hugetlb);
+	pthread_mutex_unlock(&g_HugeLock);
+	return p;
+}
+
+void freeHuge(void* p, size_t bytes) {
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&g_HugeLock);
+	map<void*, pair<size_t, bool> >::iterator it = g_HugeMap.find(p);
+	bool mapped = (it != g_HugeMap.end());
+	size_t size = (mapped ? it->second.first : 0);
+	if (mapped)
+		g_HugeMap.erase(it);
+	pthread_mutex_unlock(&g_HugeLock);
+
+	if (mapped)
+		munmap(p, size);
+	else
+		::operator delete(p);
+}
+
+/// Transparent huge page mode of the kernel
+static string transparentMode() {
+	ifstream f("/sys/kernel/mm/transparent_hugepage/enabled");
+	string line;
+	if (!f || !getline(f, line))
+		return "unavailable";
+	size_t begin = line.find('['), end = line.find(']');
+	if (begin == string::npos || end == string::npos || end < begin)
+		return line;
+	return line.substr(begin + 1, end - begin - 1);
+}
+
+/** Report of the huge pages obtained for the current allocations.
+	The pages are counted from /proc/self/smaps (AnonHugePages for the transparent huge pages).
+	@return report (e.g. "12.0 of 16.0 MB (transparent: madvise)")
+*/
+string hugePageReport() {
+	pthread_mutex_lock(&g_HugeLock);
+	map<void*, pair<size_t, bool> > regions = g_HugeMap;
+	pthread_mutex_unlock(&g_HugeLock);
+
+	size_t total = 0, huge = 0;
+	map<size_t, size_t> thp;	///< start -> end of the regions for the transparent huge pages
+	for (map<void*, pair<size_t, bool> >::iterator it = regions.begin(); it != regions.end(); ++it) {
+		total += it->second.first;
+		if (it->second.second)
+			huge += it->second.first;
+		else
+			thp[(size_t)it->first] = (size_t)it->first + it->second.first;
+	}
+
+	/// AnonHugePages of the mappings overlapping the regions
+	ifstream f("/proc/self/smaps");
+	string line;
+	bool inside = false;
+	while (f && getline(f, line)) {
+		unsigned long start, end;
+		char dash;
+		istringstream head(line);
+		if (line.size() > 0 && isxdigit(line[0]) && (head >> hex >> start >> dash >> end) && dash == '-') {
+			inside = false;
+			map<size_t, size_t>::iterator it = thp.upper_bound(start);
+			if (it != thp.begin()) {
+				--it;
+				inside = (it->second > start);
+			}
+			it = thp.lower_bound(start);
+			if (it != thp.end() && it->first < end)
+				inside = true;
+		} else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+			huge += (size_t)atol(line.c_str() + 14) * 1024;
+		}
+	}
+
+	if (huge > total)	///< adjacent mappings may be merged
+		huge = total;
+
+	char buf[128];
+	sprintf(buf, "%.1f of %.1f MB (transparent: %s)", huge / 1048576.0, total / 1048576.0, transparentMode().c_str());
+	return buf;
+}
+
+} // namespace tricrf
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __HUGEPAGE_H__
+#define __HUGEPAGE_H__
+
+/// standard headers
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <new>
+
+namespace tricrf {
+
+/// Enable (or disable) the huge page allocations
+void setHugePages(bool enable);
+bool useHugePages();
+/// Allocate memory, on huge pages if it is enabled and the size is at least a huge page
+void* allocateHuge(size_t bytes);
+void freeHuge(void* p, size_t bytes);
+/// Report of the huge pages obtained for the current allocations
+std::string hugePageReport();
+
+/** STL allocator on huge pages.
+	Large arrays accessed randomly by feature id (weights, gradients, counts, optimizer history)
+	are mapped with explicit huge pages (MAP_HUGETLB) if the system has them reserved, or else
+	aligned to huge pages and advised for transparent huge pages (MADV_HUGEPAGE).
+	Small arrays are allocated as usual.
+	@class HugePageAllocator
+*/
+template <class T>
+class HugePageAllocator {
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	template <class U> struct rebind { typedef HugePageAllocator<U> other; };
+
+	HugePageAllocator() {}
+	template <class U> HugePageAllocator(const HugePageAllocator<U>&) {}
+
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+	pointer allocate(size_type n, const void* = 0) { return (pointer)allocateHuge(n * sizeof(T)); }
+	void deallocate(pointer p, size_type n) { freeHuge(p, n * sizeof(T)); }
+	size_type max_size() const { return (size_t)-1 / sizeof(T); }
+	void construct(pointer p, const T& val) { new ((void*)p) T(val); }
+	void destroy(pointer p) { p->~T(); }
+};
+
+template <class T, class U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+/// Vector of doubles on huge pages
+typedef std::vector<double, HugePageAllocator<double> > HugeVector;
+
+} // namespace tricrf
+
+#endif
@@ -8,6 +8,7 @@
 #ifndef __LBFGS_H_
 #define __LBFGS_H_
 
+#include "HugePage.h"
 #include <vector>
 #include <iostream>
 
@@ -24,8 +25,8 @@ namespace tricrf {
     class Mcsrch;
     int iflag_, iscn, nfev, iycn, point, npt, iter, info, ispt, isyt, iypt, maxfev;
     double stp, stp1;
-    std::vector <double> diag_;
-    std::vector <double> w_;
+    HugeVector diag_;		///< on huge pages
+    HugeVector w_;
     Mcsrch *mcsrch_;
 
     void lbfgs_optimize(int size,
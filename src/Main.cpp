@@ -11,6 +11,9 @@
 #include "TriCRF1.h"
 #include "TriCRF2.h"
 #include "TriCRF3.h"
+#include "Parallel.h"
+#include "ModelDelta.h"
+#include "Gazetteer.h"
 /// standard headers
 #include <cassert>
 #include <cfloat>
@@ -20,9 +23,413 @@
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
 
 using namespace std;
 
+/// Gazetteer shared by the models (empty if not configured)
+static tricrf::Gazetteer g_Gazetteer;
+
+/** One training run on the shared model (a configuration of a sweep, or a cross-validation fold).
+	It trains the model, evaluates it on the dev set and saves it.
+	The result is returned as "success accuracy micro_f1 macro_f1 topic_accuracy wall_time".
+*/
+class TrainJob : public tricrf::Job {
+public:
+	tricrf::MaxEnt *model;
+	bool L1;
+	double prior;
+	size_t iter;
+	double prune;
+	bool pretrain;			///< PL initialization before training
+	std::vector<bool> held_out;	///< training sequences held out as the dev set (cross-validation)
+	std::string model_file;	///< "" not to save the model
+	std::string log_file;	///< per-job log ("" to keep the current logger)
+	size_t log_mode;
+	tricrf::Logger *log;		///< logger to be restored
+
+	std::string run() {
+		tricrf::Logger *job_log = NULL;
+		if (log_file != "") {
+			job_log = new tricrf::Logger(log_file, log_mode);
+			model->setLogger(job_log);
+		}
+		tricrf::wall_timer stop_watch;
+		if (held_out.size() > 0)
+			model->holdOut(held_out);
+		model->setPrune(prune);
+		if (pretrain) {
+			if (!model->pretrain(iter, prior, true)) 
+				cerr << "PL training terminates with error. anyway, we will go.\n\n";
+		}
+		bool success = model->train(iter, prior, L1);
+		if (!success)
+			cerr << "training terminates with error\n\n";
+		tricrf::Score score = model->evaluateDev();
+		if (model_file != "")
+			model->saveModel(model_file);
+		if (job_log != NULL) {
+			model->setLogger(log);
+			delete job_log;
+		}
+
+		char buf[256];
+		sprintf(buf, "%d %f %f %f %f %f", (success ? 1 : 0), score.accuracy, score.micro_f1, score.macro_f1, score.topic_accuracy, stop_watch.elapsed());
+		return buf;
+	}
+};
+
+/// Parse the result of a TrainJob
+static bool parseResult(const string& result, tricrf::Score& score, double& elapsed) {
+	int success = 0;
+	elapsed = 0.0;
+	sscanf(result.c_str(), "%d %lf %lf %lf %lf %lf", &success, &score.accuracy, &score.micro_f1, &score.macro_f1, &score.topic_accuracy, &elapsed);
+	return (success != 0);
+}
+
+/// Values of a (possibly multi-valued) numeric key
+static vector<double> getValues(tricrf::Configurator& config, const string& key, double default_value) {
+	vector<double> values;
+	if (config.isValid(key)) {
+		vector<string> tokens = config.gets(key);
+		for (size_t i = 0; i < tokens.size(); i++)
+			values.push_back(atof(tokens[i].c_str()));
+	} else
+		values.push_back(default_value);
+	return values;
+}
+
+/** Estimation method of the sweep and cv modes, which train the shared model by LBFGS.
+	@param config	configuration
+	@param L1	whether it is LBFGS-L1
+	@return false for iterative parameter mixing (IPM-*), which is not supported by these modes
+*/
+static bool lbfgsEstimation(tricrf::Configurator& config, bool& L1) {
+	string estimation = (config.isValid("estimation") ? config.get("estimation") : "LBFGS-L2");
+	L1 = (estimation == "LBFGS-L1");
+	return (estimation != "IPM-Perceptron" && estimation != "IPM-SGD");
+}
+
+/** Decoding request of the serve mode: "test_file [output_file]".
+	It runs in a worker process forked from the parent which has loaded the model.
+*/
+class DecodeHandler : public tricrf::RequestHandler {
+public:
+	tricrf::MaxEnt *model;
+	bool confidence;
+
+	std::string handle(const std::string& request) {
+		vector<string> tok = tricrf::tokenize(request, " \t");
+		if (tok.size() < 1 || tok.size() > 2)
+			return "error invalid request (test_file [output_file])";
+		tricrf::wall_timer stop_watch;
+		if (!model->test(tok[0], (tok.size() > 1 ? tok[1] : ""), confidence))
+			return "error decoding";
+		char buf[128];
+		sprintf(buf, "ok %.3f sec, private memory %.1f MB", stop_watch.elapsed(), tricrf::privateMemory() / 1048576.0);
+		return buf;
+	}
+};
+
+/// Create a model of the given type (NULL for an unknown type)
+static tricrf::MaxEnt* createModel(const string& type_str, tricrf::Logger *log) {
+	if (type_str == "MaxEnt" || type_str == "maxent") 
+		return (log != NULL ? new tricrf::MaxEnt(log) : new tricrf::MaxEnt());
+	else if (type_str == "TriCRF1" || type_str == "tricrf1") 
+		return (log != NULL ? new tricrf::TriCRF1(log) : new tricrf::TriCRF1());
+	else if (type_str == "TriCRF2" || type_str == "tricrf2") 
+		return (log != NULL ? new tricrf::TriCRF2(log) : new tricrf::TriCRF2());
+	else if (type_str == "TriCRF3" || type_str == "tricrf3") 
+		return (log != NULL ? new tricrf::TriCRF3(log) : new tricrf::TriCRF3());
+	else if (type_str == "CRF" || type_str == "crf") 
+		return (log != NULL ? new tricrf::CRF(log) : new tricrf::CRF());
+	return NULL;
+}
+
+/** Set up out-of-core training from the configuration (CRF only).
+	@param model	model to be trained
+	@param config	configuration
+	@param suffix	suffix of the packed corpus file (for concurrent entries)
+*/
+static void setOutOfCore(tricrf::MaxEnt *model, tricrf::Configurator& config, const string& suffix) {
+	if (!config.isValid("out_of_core"))
+		return;
+	string type_str = config.get("model_type");
+	if (type_str != "CRF" && type_str != "crf") {
+		cerr << "out_of_core is supported only by CRF; ignored\n";
+		return;
+	}
+	size_t window = 64;	///< MB
+	if (config.isValid("out_of_core_window"))
+		window = atoi(config.get("out_of_core_window").c_str());
+	((tricrf::CRF*)model)->setOutOfCore(config.get("out_of_core") + suffix, window * 1024 * 1024);
+}
+
+/// Whether the estimation is iterative parameter mixing, which does not use the L-BFGS options
+static bool mixingEstimation(tricrf::Configurator& config) {
+	return config.isValid("estimation") && (config.get("estimation") == "IPM-Perceptron" || config.get("estimation") == "IPM-SGD");
+}
+
+/** Skipping the well-fit sequences in the L-BFGS training of CRF.
+	@param model	model to be trained
+	@param config	configuration
+	@return false if it is not supported by the model or the training
+*/
+static bool setSkipping(tricrf::MaxEnt *model, tricrf::Configurator& config) {
+	if (!config.isValid("skip_threshold"))
+		return true;
+	string type_str = config.get("model_type");
+	if (type_str != "CRF" && type_str != "crf") {
+		cerr << "skip_threshold is supported only by CRF\n";
+		return false;
+	}
+	if (mixingEstimation(config) || config.isValid("out_of_core")) {
+		cerr << "skip_threshold is supported only by LBFGS training with the data in memory\n";
+		return false;
+	}
+	size_t exact_every = 5;
+	if (config.isValid("skip_exact_every"))
+		exact_every = atoi(config.get("skip_exact_every").c_str());
+	((tricrf::CRF*)model)->setSkipping(atof(config.get("skip_threshold").c_str()), exact_every);
+	return true;
+}
+
+/** Topic cache of the TriCRF training.
+	@param model	model to be trained
+	@param config	configuration
+	@return false if it is not supported by the model
+*/
+static bool setTopicCache(tricrf::MaxEnt *model, tricrf::Configurator& config) {
+	if (!config.isValid("topic_cache"))
+		return true;
+	string type_str = config.get("model_type");
+	if (type_str.find("TriCRF") != 0 && type_str.find("tricrf") != 0) {
+		cerr << "topic_cache is supported only by TriCRF\n";
+		return false;
+	}
+	size_t refresh = 5;
+	if (config.isValid("topic_cache_refresh"))
+		refresh = atoi(config.get("topic_cache_refresh").c_str());
+	double max_mass = 1E-06;
+	if (config.isValid("topic_cache_mass"))
+		max_mass = atof(config.get("topic_cache_mass").c_str());
+	((tricrf::TriCRF*)model)->setTopicCache(atof(config.get("topic_cache").c_str()), refresh, max_mass);
+	return true;
+}
+
+/** Feature induction (grafting) in the L-BFGS training of MaxEnt and CRF.
+	@param model	model to be trained
+	@param config	configuration
+	@return false if it is not supported by the model or the training
+*/
+static bool setGrafting(tricrf::MaxEnt *model, tricrf::Configurator& config) {
+	if (!config.isValid("graft_init"))
+		return true;
+	string type_str = config.get("model_type");
+	if (type_str != "MaxEnt" && type_str != "maxent" && type_str != "CRF" && type_str != "crf") {
+		cerr << "graft_init is supported only by MaxEnt and CRF\n";
+		return false;
+	}
+	if (mixingEstimation(config)) {
+		cerr << "graft_init is supported only by LBFGS training\n";
+		return false;
+	}
+	size_t every = 5;
+	if (config.isValid("graft_every"))
+		every = atoi(config.get("graft_every").c_str());
+	double grow = 0.25;
+	if (config.isValid("graft_grow"))
+		grow = atof(config.get("graft_grow").c_str());
+	double threshold = 1.0;
+	if (config.isValid("graft_threshold"))
+		threshold = atof(config.get("graft_threshold").c_str());
+	model->setGrafting(atof(config.get("graft_init").c_str()), every, grow, threshold);
+	return true;
+}
+
+/** Skipping the zero weights in the L1 training of MaxEnt and CRF.
+	@param model	model to be trained
+	@param config	configuration
+	@return false if it is not supported by the model or the training
+*/
+static bool setL1ActiveSet(tricrf::MaxEnt *model, tricrf::Configurator& config) {
+	if (!config.isValid("l1_active_set"))
+		return true;
+	string type_str = config.get("model_type");
+	if (type_str != "MaxEnt" && type_str != "maxent" && type_str != "CRF" && type_str != "crf") {
+		cerr << "l1_active_set is supported only by MaxEnt and CRF\n";
+		return false;
+	}
+	if (mixingEstimation(config)) {
+		cerr << "l1_active_set is supported only by LBFGS training\n";
+		return false;
+	}
+	size_t recheck = 5;
+	if (config.isValid("l1_recheck"))
+		recheck = atoi(config.get("l1_recheck").c_str());
+	model->setL1ActiveSet(atoi(config.get("l1_active_set").c_str()), recheck);
+	return true;
+}
+
+/** Training options of a model (skipping, topic cache, grafting and L1 active set), for every training mode.
+	@param model	model to be trained
+	@param config	configuration
+	@return false if an option is not supported by the model or the training
+*/
+static bool setTrainingOptions(tricrf::MaxEnt *model, tricrf::Configurator& config) {
+	return setSkipping(model, config) && setTopicCache(model, config) && setGrafting(model, config) && setL1ActiveSet(model, config);
+}
+
+/** Train a model on one entry of the train_file list.
+	@param model	model to be trained (cleared before)
+	@param config	configuration (estimation method, priors, iterations, ...)
+	@param train	training data file
+	@param dev	dev data file ("" for none)
+	@param model_file	model file to be saved ("" not to save)
+	@return success or fail
+*/
+static bool trainEntry(tricrf::MaxEnt *model, tricrf::Configurator& config, const string& train, const string& dev, const string& model_file) {
+	size_t max_iter;
+	double l1_prior, l2_prior;
+
+	model->clear();
+	model->readTrainData(train);
+	model->initializeModel();	// initialize the model
+	if (dev != "") 
+		model->readDevData(dev);
+	
+	if (config.isValid("iter"))
+		max_iter = atoi(config.get("iter").c_str());
+	else
+		max_iter = 100;
+	
+	// initializing the parameter
+	bool init_param = config.isValid("initialize");
+
+	string type_str = "LBFGS-L2";	///< default estimation method
+	if (config.isValid("estimation")) {
+		type_str = config.get("estimation");
+	}
+
+	if (type_str == "IPM-Perceptron" || type_str == "IPM-SGD") {
+		/// Iterative parameter mixing (CRF only)
+		string model_type = config.get("model_type");
+		if (model_type != "CRF" && model_type != "crf") {
+			cerr << "Iterative parameter mixing is supported only by CRF\n";
+			return false;
+		}
+		if (config.isValid("l2_prior"))
+			l2_prior = atof(config.get("l2_prior").c_str());
+		else
+			l2_prior = 0.0;
+		size_t workers = tricrf::numProcessors();
+		if (config.isValid("mixing_workers"))
+			workers = atoi(config.get("mixing_workers").c_str());
+		double rate = 0.1;
+		if (config.isValid("mixing_rate"))
+			rate = atof(config.get("mixing_rate").c_str());
+
+		tricrf::CRF *crf = (tricrf::CRF*)model;
+		crf->setMixing(workers, rate);
+		if (init_param) {
+			if (!model->pretrain(max_iter, l2_prior, false)) {
+				cerr << "PL training terminates with error. anyway, we will go.\n\n";
+			}
+		}
+		if (!crf->trainMixing(max_iter, l2_prior, type_str == "IPM-Perceptron")) {
+			cerr << "training terminates with error\n\n";
+			return false;
+		}
+	} else if (type_str == "LBFGS-L1") {
+		/// LBFGS-L1
+		if (config.isValid("l1_prior"))
+			l1_prior = atof(config.get("l1_prior").c_str());
+		else
+			l1_prior = 0.0;
+		
+		if (init_param) {
+			if (!model->pretrain(max_iter, l1_prior, true)) {
+				cerr << "PL training terminates with error. anyway, we will go.\n\n";
+			}
+		}
+		if (!model->train(max_iter, l1_prior, true)) {
+			cerr << "training terminates with error\n\n";
+			return false;
+		}		
+	} else { 
+		/// LBFGS-L2
+		if (config.isValid("l2_prior"))
+			l2_prior = atof(config.get("l2_prior").c_str());
+		else
+			l2_prior = 0.0;
+
+		if (init_param) {
+			if (!model->pretrain(max_iter, l2_prior, true)) {
+				cerr << "PL training terminates with error. anyway, we will go.\n\n";
+			}
+		}
+		if (!model->train(max_iter, l2_prior, false)) {
+			cerr << "training terminates with error\n\n";
+			return false;
+		}		
+	}
+
+	if (model_file != "") {
+		model->saveModel(model_file);
+	}
+	return true;
+}
+
+/** One entry of the train_file list, trained by its own model instance in a worker process.
+	The result is returned as "wall_time".
+*/
+class ListJob : public tricrf::Job {
+public:
+	tricrf::Configurator *config;
+	std::string type_str;
+	std::string train_file, dev_file, model_file;
+	double prune;
+	size_t threads;
+	bool deterministic;
+	std::string log_file;	///< per-entry log
+	std::string suffix;		///< per-entry suffix of the packed corpus file
+	size_t log_mode;
+
+	std::string run() {
+		tricrf::Logger *job_log = NULL;
+		if (log_file != "")
+			job_log = new tricrf::Logger(log_file, log_mode);
+		tricrf::MaxEnt *model = createModel(type_str, job_log);
+		if (model == NULL)
+			throw runtime_error("unspecified model type");
+		model->setPrune(prune);
+		model->setThreads(threads, deterministic);
+		model->setRenumber(config->isValid("feature_order") && config->get("feature_order") == "frequency");
+		if (config->isValid("corpus_order"))
+			model->setCorpusOrder(config->get("corpus_order"));
+		model->setGazetteer(&g_Gazetteer);
+		setOutOfCore(model, *config, suffix);
+		if (!setTrainingOptions(model, *config))
+			throw runtime_error("unsupported training option");
+		tricrf::wall_timer stop_watch;
+		if (!trainEntry(model, *config, train_file, dev_file, model_file))
+			throw runtime_error("training terminates with error");
+
+		char buf[64];
+		sprintf(buf, "%f", stop_watch.elapsed());
+		return buf;
+	}
+};
+
+/// Size of a file in bytes (0 if it does not exist)
+static size_t fileSize(const string& filename) {
+	struct stat st;
+	if (filename == "" || stat(filename.c_str(), &st) != 0)
+		return 0;
+	return (size_t)st.st_size;
+}
+
 int main(int argc, void** argv) {
 	////////////////////////////////////////////////////////////////
 	///	 Model
@@ -33,11 +440,7 @@ int main(int argc, void** argv) {
 	///	 Parameters
 	////////////////////////////////////////////////////////////////
 	vector<string> model_file, train_file, dev_file, test_file, output_file;
-	string initialize_method, estimation_method;
-	size_t max_iter, init_iter;
-	double l1_prior, l2_prior;
-	enum {MaxEnt = 0, CRF, TriCRF1, TriCRF2, TriCRF3} model_type;
-	bool train_mode = false, testing_mode = false;
+	bool train_mode = false, testing_mode = false, sweep_mode = false, cv_mode = false, serve_mode = false, calibrate_mode = false, check_mode = false;
 	bool confidence = false;
 
 	////////////////////////////////////////////////////////////////
@@ -67,45 +470,56 @@ int main(int argc, void** argv) {
 		log->report(" Configuration File = %s\n\n", config.getFileName().data());
 	}
 	
+	////////////////////////////////////////////////////////////////
+	///	 Huge pages for the parameters and the optimizer
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("huge_pages"))
+		tricrf::setHugePages(config.get("huge_pages") == "true");
+
+	////////////////////////////////////////////////////////////////
+	///	 Gazetteer: phrase lists given as "file" or "TYPE:file" (the type is the file name without the extension by default)
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("gazetteer")) {
+		if (config.isValid("gazetteer_token"))
+			g_Gazetteer.setTokenPrefix(config.get("gazetteer_token") + "=");
+		vector<string> lists = config.gets("gazetteer");
+		for (size_t i = 0; i < lists.size(); i++) {
+			string type, filename = lists[i];
+			size_t colon = filename.find(':');
+			if (colon != string::npos) {
+				type = filename.substr(0, colon);
+				filename = filename.substr(colon + 1);
+			} else {
+				type = filename.substr(filename.find_last_of('/') + 1);
+				type = type.substr(0, type.find('.'));
+			}
+			if (!g_Gazetteer.load(filename, type)) {
+				cerr << "Cannot open gazetteer file " << filename << "\n";
+				return -1;
+			}
+		}
+		if (log != NULL) {
+			log->report("[Gazetteer loading]\n");
+			log->report("  # of phrases = \t%d\n", g_Gazetteer.sizePhrase());
+			log->report("  # of types = \t\t%d\n", g_Gazetteer.sizeType());
+			log->report("  # of states = \t%d\n\n", g_Gazetteer.sizeState());
+		}
+	}
+
 	////////////////////////////////////////////////////////////////
 	///	 Selecting the model
 	////////////////////////////////////////////////////////////////
 	if (config.isValid("model_type")) {
-		string type_str = config.get("model_type");
-		if (type_str == "MaxEnt" || type_str == "maxent") {
-			model_type = MaxEnt;
-			if (log != NULL)
-				model = new tricrf::MaxEnt(log);
-			else
-				model = new tricrf::MaxEnt();
-		} else if (type_str == "TriCRF1" || type_str == "tricrf1") {
-			model_type = TriCRF1;
-			if (log != NULL)
-				model = new tricrf::TriCRF1(log);
-			else
-				model = new tricrf::TriCRF1();
-		} else if (type_str == "TriCRF2" || type_str == "tricrf2") {
-			model_type = TriCRF2;
-			if (log != NULL)
-				model = new tricrf::TriCRF2(log);
-			else
-				model = new tricrf::TriCRF2();
-		} else if (type_str == "TriCRF3" || type_str == "tricrf3") {
-			model_type = TriCRF3;
-			if (log != NULL)
-				model = new tricrf::TriCRF3(log);
-			else
-				model = new tricrf::TriCRF3();
-		} else if (type_str == "CRF" || type_str == "crf") {
-			model_type = CRF;
-			if (log != NULL)
-				model = new tricrf::CRF(log);
-			else
-				model = new tricrf::CRF();
-		} else {
+		model = createModel(config.get("model_type"), log);
+		if (model == NULL) {
 			cerr << "Unspecified model type\n";
 			exit(1);
 		}
+		model->setGazetteer(&g_Gazetteer);
+		if (!setTrainingOptions(model, config)) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -115,6 +529,16 @@ int main(int argc, void** argv) {
 		train_mode = (config.get("mode") == "train" || config.get("mode") == "both" ? true : false);
 	if (config.isValid("mode")) 
 		testing_mode = (config.get("mode") == "test" || config.get("mode") == "both" ? true : false);
+	if (config.isValid("mode")) 
+		sweep_mode = (config.get("mode") == "sweep");
+	if (config.isValid("mode")) 
+		cv_mode = (config.get("mode") == "cv");
+	if (config.isValid("mode")) 
+		serve_mode = (config.get("mode") == "serve");
+	if (config.isValid("mode")) 
+		calibrate_mode = (config.get("mode") == "calibrate");
+	if (config.isValid("mode")) 
+		check_mode = (config.get("mode") == "check");
 
 	////////////////////////////////////////////////////////////////
 	///	 Data Files
@@ -133,6 +557,26 @@ int main(int argc, void** argv) {
 		model_file = config.gets("model_file");
 	}
 
+	////////////////////////////////////////////////////////////////
+	///	 Diff mode: model delta of model_file from base_model
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("mode") && config.get("mode") == "diff") {
+		if (model_file.size() == 0 || !config.isValid("base_model") || !config.isValid("delta_file")) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+		double threshold = 0.0;
+		if (config.isValid("delta_threshold"))
+			threshold = atof(config.get("delta_threshold").c_str());
+		if (log == NULL)
+			log = new tricrf::Logger();
+		if (!tricrf::makeModelDelta(config.get("base_model"), model_file[0], config.get("delta_file"), threshold, log)) {
+			cerr << "Model delta error\n";
+			return -1;
+		}
+		return 0;
+	}
+
 	////////////////////////////////////////////////////////////////
 	///	 Pruning
 	////////////////////////////////////////////////////////////////
@@ -140,8 +584,72 @@ int main(int argc, void** argv) {
 		double prune = atof(config.get("prune").c_str());
 		model->setPrune(prune);
 	}
-	else
-		model->setPrune(1000);
+
+	////////////////////////////////////////////////////////////////
+	///	 Anytime decoding: time budget per sequence (ms)
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("decode_budget"))
+		model->setDecodeBudget(atof(config.get("decode_budget").c_str()));
+
+	////////////////////////////////////////////////////////////////
+	///	 Decoder: Viterbi or greedy (MEMM-style), optionally compared
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("decoder") || config.isValid("decoder_compare")) {
+		string decoder = (config.isValid("decoder") ? config.get("decoder") : "viterbi");
+		if (decoder != "viterbi" && decoder != "greedy") {
+			cerr << "Invalid decoder. Please see the configuration\n";
+			return -1;
+		}
+		bool compare = (config.isValid("decoder_compare") && config.get("decoder_compare") == "true");
+		model->setDecoder(decoder == "greedy", compare);
+	}
+
+	////////////////////////////////////////////////////////////////
+	///	 Coarse-to-fine decoding over a label hierarchy (CRF, TriCRF)
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("coarse_to_fine")) {
+		string type_str = config.get("model_type");
+		if (type_str == "MaxEnt" || type_str == "maxent")
+			cerr << "coarse_to_fine is supported only by CRF and TriCRF; ignored\n";
+		else {
+			map<string, string> mapping;
+			if (config.isValid("coarse_map") && !tricrf::CoarseToFine::readMap(config.get("coarse_map"), mapping)) {
+				cerr << "Cannot open coarse_map file " << config.get("coarse_map") << "\n";
+				return -1;
+			}
+			bool exact = !(config.isValid("coarse_exact") && config.get("coarse_exact") == "false");
+			((tricrf::CRF*)model)->setCoarseToFine(atof(config.get("coarse_to_fine").c_str()), exact, mapping);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+	///	 Threads
+	////////////////////////////////////////////////////////////////
+	size_t threads = 1;
+	if (config.isValid("threads"))
+		threads = atoi(config.get("threads").c_str());
+	bool deterministic = (config.isValid("deterministic") && config.get("deterministic") == "true");
+	model->setThreads(threads, deterministic);
+
+	////////////////////////////////////////////////////////////////
+	///	 Feature and corpus order
+	////////////////////////////////////////////////////////////////
+	if (config.isValid("feature_order")) {
+		if (config.get("feature_order") == "frequency")
+			model->setRenumber(true);
+		else if (config.get("feature_order") != "input") {
+			cerr << "Invalid feature_order. Please see the configuration\n";
+			return -1;
+		}
+	}
+	if (config.isValid("corpus_order")) {
+		string order = config.get("corpus_order");
+		if (order != "input" && order != "length" && order != "features") {
+			cerr << "Invalid corpus_order. Please see the configuration\n";
+			return -1;
+		}
+		model->setCorpusOrder(order);
+	}
 
 	////////////////////////////////////////////////////////////////
 	///	 Training mode
@@ -152,84 +660,298 @@ int main(int argc, void** argv) {
 			cerr << "Invalid setting. Please see the configuration\n";
 			return -1;
 		}
+		if (dev_file.size() != 0)
+			assert(train_file.size() == dev_file.size());
 		
-		for (size_t iter = 0; iter < train_file.size(); iter++) {
-			log->report("\n\nTraining File = %s\n\n", train_file[iter].data());
-			model->clear();
-			model->readTrainData(train_file[iter]);
-			model->initializeModel();	// initialize the model
-			if (dev_file.size() != 0) {
-				assert(train_file.size() == dev_file.size());
-				model->readDevData(dev_file[iter]);
-			}
-			if (initialize_method == "")
-				model->initializeModel();
-			
-			if (config.isValid("iter"))
-				max_iter = atoi(config.get("iter").c_str());
-			else
-				max_iter = 100;
-			
-			// initializing the parameter
-			bool init_param = false;
-			if (config.isValid("initialize")) {
-				if (config.get("initialize") == "PL") {
-					if (config.isValid("initialize_iter"))
-						init_iter = atoi(config.get("initialize_iter").c_str());
-					else
-						init_iter = 30;
-				}
-				init_param = true;
-			}
+		size_t n_jobs = 1;
+		if (config.isValid("train_jobs"))
+			n_jobs = atoi(config.get("train_jobs").c_str());
+
+		if (n_jobs > 1 && train_file.size() > 1) {
+			/// concurrently, each entry is trained by its own model instance in a worker process
+			size_t log_mode = 2;
+			if (config.isValid("log_mode"))
+				log_mode = atoi(config.get("log_mode").c_str());
+			size_t memory_limit = tricrf::availableMemory();
+			if (config.isValid("train_memory"))
+				memory_limit = (size_t)(atof(config.get("train_memory").c_str()) * 1024 * 1024);
+			double memory_ratio = 40.0;
+			if (config.isValid("train_memory_ratio"))
+				memory_ratio = atof(config.get("train_memory_ratio").c_str());
 
-			string type_str = "LBFGS-L2";	///< default estimation method
-			if (config.isValid("estimation")) {
-				type_str = config.get("estimation");
+			tricrf::wall_timer total_watch;
+			tricrf::ProcessPool pool(n_jobs);
+			pool.setMemoryLimit(memory_limit, memory_ratio);
+			vector<ListJob> jobs(train_file.size());
+			for (size_t iter = 0; iter < train_file.size(); iter++) {
+				ListJob& job = jobs[iter];
+				job.config = &config;
+				job.type_str = config.get("model_type");
+				job.prune = (config.isValid("prune") ? atof(config.get("prune").c_str()) : 1000);
+				job.threads = threads;
+				job.deterministic = deterministic;
+				job.train_file = train_file[iter];
+				job.dev_file = (dev_file.size() != 0 ? dev_file[iter] : "");
+				job.model_file = (config.isValid("model_file") ? model_file[iter] : "");
+				char suffix[32];
+				sprintf(suffix, ".%d", (int)iter);
+				job.log_file = (config.isValid("log_file") ? config.get("log_file") + suffix : "");
+				job.suffix = suffix;
+				job.log_mode = log_mode;
+				log->report("\n\nTraining File = %s (log = %s)\n", job.train_file.data(), job.log_file.data());
+				pool.submit(job, (double)(fileSize(job.train_file) + fileSize(job.dev_file)));
 			}
+			pool.wait();
 
-			if (type_str == "LBFGS-L1") {
-				/// LBFGS-L1
-				if (config.isValid("l1_prior"))
-					l1_prior = atof(config.get("l1_prior").c_str());
-				else
-					l1_prior = 0.0;
-				
-				if (init_param) {
-					if (!model->pretrain(max_iter, l1_prior, true)) {
-						cerr << "PL training terminates with error. anyway, we will go.\n\n";
-						//return -1;
-					}
-				}
-				if (!model->train(max_iter, l1_prior, true)) {
-					cerr << "training terminates with error\n\n";
+			bool success = true;
+			log->report("\n[Training summary]\n");
+			log->report("%4s  %-30s %8s %10s %10s\n", "#", "train_file", "status", "time", "memory(MB)");
+			for (size_t iter = 0; iter < train_file.size(); iter++) {
+				double elapsed = 0.0;
+				bool ok = (pool.succeeded(iter) && sscanf(pool.result(iter).c_str(), "%lf", &elapsed) == 1);
+				log->report("%4d  %-30s %8s %10.3f %10.1f\n", (int)iter, train_file[iter].c_str(), (ok ? "done" : "failed"), 
+					elapsed, pool.peakMemory(iter) / (1024.0 * 1024.0));
+				success = success && ok;
+			}
+			log->report("  total time = \t%.3f\n\n", total_watch.elapsed());
+			if (!success) {
+				cerr << "training terminates with error\n\n";
+				return -1;
+			}
+		} else {
+			setOutOfCore(model, config, "");
+			for (size_t iter = 0; iter < train_file.size(); iter++) {
+				log->report("\n\nTraining File = %s\n\n", train_file[iter].data());
+				if (!trainEntry(model, config, train_file[iter], (dev_file.size() != 0 ? dev_file[iter] : ""), 
+						(config.isValid("model_file") ? model_file[iter] : "")))
 					return -1;
-				}		
-			} else { 
-				/// LBFGS-L2
-				if (config.isValid("l2_prior"))
-					l2_prior = atof(config.get("l2_prior").c_str());
-				else
-					l2_prior = 0.0;
-
-				if (init_param) {
-					if (!model->pretrain(max_iter, l2_prior, true)) {
-						cerr << "PL training terminates with error. anyway, we will go.\n\n";
-						//return -1;
-					}
+			} // iteration
+		}
+
+	} 
+	////////////////////////////////////////////////////////////////
+	///	 Sweep mode
+	///  The corpus is loaded once, and every combination of the values of
+	///  l1_prior (or l2_prior), iter and prune is trained on it.
+	////////////////////////////////////////////////////////////////
+	if (sweep_mode) {
+		if (train_file.size() <= 0 || model_file.size() <= 0) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+
+		bool L1;
+		if (!lbfgsEstimation(config, L1)) {
+			cerr << "Invalid setting. Please see the configuration (sweep mode trains with LBFGS-L1 or LBFGS-L2)\n";
+			return -1;
+		}
+
+		tricrf::wall_timer total_watch;
+		log->report("\n\nSweep Training File = %s\n\n", train_file[0].data());
+		model->clear();
+		model->readTrainData(train_file[0]);
+		model->initializeModel();
+		if (dev_file.size() != 0)
+			model->readDevData(dev_file[0]);
+		else
+			log->report("  no dev_file is given: dev scores are not available\n");
+		double load_time = total_watch.elapsed();
+
+		vector<double> priors = getValues(config, (L1 ? "l1_prior" : "l2_prior"), 0.0);
+		vector<double> iters = getValues(config, "iter", 100);
+		vector<double> prunes = getValues(config, "prune", 1000);
+		/// along the regularization path: from the strongest (smallest prior) to the weakest
+		sort(priors.begin(), priors.end());
+
+		bool warm_start = (config.isValid("sweep_warm_start") && config.get("sweep_warm_start") == "true");
+		size_t n_jobs = tricrf::numProcessors();
+		if (config.isValid("sweep_jobs"))
+			n_jobs = atoi(config.get("sweep_jobs").c_str());
+		size_t log_mode = 2;
+		if (config.isValid("log_mode"))
+			log_mode = atoi(config.get("log_mode").c_str());
+
+		vector<TrainJob> jobs;
+		for (size_t i = 0; i < iters.size(); i++) {
+			for (size_t j = 0; j < prunes.size(); j++) {
+				for (size_t k = 0; k < priors.size(); k++) {
+					TrainJob job;
+					job.model = model;
+					job.L1 = L1;
+					job.prior = priors[k];
+					job.iter = (size_t)iters[i];
+					job.prune = prunes[j];
+					job.pretrain = (config.isValid("initialize") && (!warm_start || k == 0));
+					char suffix[32];
+					sprintf(suffix, ".%d", (int)jobs.size());
+					job.model_file = model_file[0] + suffix;
+					job.log_file = (config.isValid("log_file") ? config.get("log_file") + suffix : "");
+					job.log_mode = log_mode;
+					job.log = log;
+					jobs.push_back(job);
 				}
-				if (!model->train(max_iter, l2_prior, false)) {
-					cerr << "training terminates with error\n\n";
-					return -1;
-				}		
 			}
+		}
+		log->report("  # of configurations = \t%d\n", (int)jobs.size());
+		log->report("  loading time = \t%.3f\n\n", load_time);
 
-			if (config.isValid("model_file")) {
-				model->saveModel(model_file[iter]);
+		vector<string> results(jobs.size());
+		if (warm_start) {
+			/// in sequence, each training starts from the weights of the previous one
+			for (size_t n = 0; n < jobs.size(); n++) {
+				if (n % priors.size() == 0)
+					model->initializeModel();
+				results[n] = jobs[n].run();
 			}
+		} else {
+			/// concurrently, each job trains its own copy of the model
+			tricrf::ProcessPool pool(n_jobs);
+			for (size_t n = 0; n < jobs.size(); n++)
+				pool.submit(jobs[n]);
+			pool.wait();
+			for (size_t n = 0; n < jobs.size(); n++)
+				results[n] = (pool.succeeded(n) ? pool.result(n) : "0");
+		}
 
-		} // iteration
+		log->report("[Sweep summary]\n");
+		log->report("%4s %10s %6s %10s  |  %8s %8s %8s %8s  |  %8s  %s\n", 
+			"#", (L1 ? "l1_prior" : "l2_prior"), "iter", "prune", "Acc", "MicroF1", "MacroF1", "TopicAcc", "time", "model");
+		for (size_t n = 0; n < jobs.size(); n++) {
+			tricrf::Score score;
+			double elapsed;
+			if (!parseResult(results[n], score, elapsed)) {
+				log->report("%4d %10g %6d %10g  |  %s  |  %8.3f  %s\n", (int)n, jobs[n].prior, (int)jobs[n].iter, jobs[n].prune, 
+					"             training failed             ", elapsed, jobs[n].model_file.c_str());
+				continue;
+			}
+			char topic_s[16] = "-";
+			if (score.topic_accuracy >= 0)
+				sprintf(topic_s, "%8.3f", score.topic_accuracy);
+			log->report("%4d %10g %6d %10g  |  %8.3f %8.3f %8.3f %8s  |  %8.3f  %s\n", (int)n, jobs[n].prior, (int)jobs[n].iter, jobs[n].prune, 
+				score.accuracy, score.micro_f1, score.macro_f1, topic_s, elapsed, jobs[n].model_file.c_str());
+		}
+		log->report("  total time = \t%.3f\n\n", total_watch.elapsed());
+	}
+
+	////////////////////////////////////////////////////////////////
+	///	 Cross-validation mode
+	///  The corpus is loaded once, and the folds are built over the unique
+	///  training sequences (duplicates stay in the same fold).
+	////////////////////////////////////////////////////////////////
+	if (cv_mode) {
+		if (train_file.size() <= 0) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+
+		bool L1;
+		if (!lbfgsEstimation(config, L1)) {
+			cerr << "Invalid setting. Please see the configuration (cv mode trains with LBFGS-L1 or LBFGS-L2)\n";
+			return -1;
+		}
+
+		tricrf::wall_timer total_watch;
+		log->report("\n\nCross-validation File = %s\n\n", train_file[0].data());
+		model->clear();
+		model->readTrainData(train_file[0]);
+		model->initializeModel();
+		if (dev_file.size() != 0)
+			log->report("  dev_file is not used: each fold is evaluated on its held-out data\n");
+
+		size_t n_folds = 5;
+		if (config.isValid("cv_folds"))
+			n_folds = atoi(config.get("cv_folds").c_str());
+		const vector<double>& counts = model->getTrainSetCount();
+		if (n_folds < 2 || n_folds > counts.size()) {
+			cerr << "Invalid number of folds\n";
+			return -1;
+		}
+		size_t n_jobs = tricrf::numProcessors();
+		if (config.isValid("cv_jobs"))
+			n_jobs = atoi(config.get("cv_jobs").c_str());
+		size_t log_mode = 2;
+		if (config.isValid("log_mode"))
+			log_mode = atoi(config.get("log_mode").c_str());
+
+		/// each unique sequence goes to the lightest fold, so that the folds are balanced by counts
+		vector<size_t> fold(counts.size());
+		vector<double> fold_count(n_folds, 0.0);
+		vector<size_t> fold_size(n_folds, 0);
+		for (size_t i = 0; i < counts.size(); i++) {
+			size_t k = min_element(fold_count.begin(), fold_count.end()) - fold_count.begin();
+			fold[i] = k;
+			fold_count[k] += counts[i];
+			fold_size[k]++;
+		}
+
+		vector<TrainJob> jobs(n_folds);
+		for (size_t k = 0; k < n_folds; k++) {
+			TrainJob& job = jobs[k];
+			job.model = model;
+			job.L1 = L1;
+			job.prior = getValues(config, (L1 ? "l1_prior" : "l2_prior"), 0.0)[0];
+			job.iter = (size_t)getValues(config, "iter", 100)[0];
+			job.prune = getValues(config, "prune", 1000)[0];
+			job.pretrain = config.isValid("initialize");
+			job.held_out.resize(counts.size());
+			for (size_t i = 0; i < counts.size(); i++)
+				job.held_out[i] = (fold[i] == k);
+			char suffix[32];
+			sprintf(suffix, ".fold%d", (int)k);
+			job.log_file = (config.isValid("log_file") ? config.get("log_file") + suffix : "");
+			job.log_mode = log_mode;
+			job.log = log;
+		}
+		log->report("  # of folds = \t\t%d\n", (int)n_folds);
+		log->report("  loading time = \t%.3f\n\n", total_watch.elapsed());
+
+		tricrf::ProcessPool pool(n_jobs);
+		for (size_t k = 0; k < n_folds; k++)
+			pool.submit(jobs[k]);
+		pool.wait();
+
+		log->report("[Cross-validation summary]\n");
+		log->report("%4s %8s %8s  |  %8s %8s %8s %8s  |  %8s\n", 
+			"fold", "# seq", "# data", "Acc", "MicroF1", "MacroF1", "TopicAcc", "time");
+		vector<double> sum(4, 0.0), sum2(4, 0.0);
+		size_t n_success = 0;
+		for (size_t k = 0; k < n_folds; k++) {
+			tricrf::Score score;
+			double elapsed;
+			if (!pool.succeeded(k) || !parseResult(pool.result(k), score, elapsed)) {
+				log->report("%4d %8d %8.0f  |  %s\n", (int)k, (int)fold_size[k], fold_count[k], "             training failed");
+				continue;
+			}
+			char topic_s[16] = "-";
+			if (score.topic_accuracy >= 0)
+				sprintf(topic_s, "%8.3f", score.topic_accuracy);
+			log->report("%4d %8d %8.0f  |  %8.3f %8.3f %8.3f %8s  |  %8.3f\n", (int)k, (int)fold_size[k], fold_count[k], 
+				score.accuracy, score.micro_f1, score.macro_f1, topic_s, elapsed);
+			double values[4] = {score.accuracy, score.micro_f1, score.macro_f1, score.topic_accuracy};
+			for (size_t m = 0; m < 4; m++) {
+				sum[m] += values[m];
+				sum2[m] += values[m] * values[m];
+			}
+			n_success++;
+		}
+		if (n_success > 0) {
+			char mean_s[4][16], std_s[4][16];
+			for (size_t m = 0; m < 4; m++) {
+				double mean = sum[m] / n_success;
+				double var = sum2[m] / n_success - mean * mean;
+				sprintf(mean_s[m], "%8.3f", mean);
+				sprintf(std_s[m], "%8.3f", sqrt(var > 0 ? var : 0.0));
+				if (m == 3 && mean < 0) {	///< no topic
+					strcpy(mean_s[m], "-");
+					strcpy(std_s[m], "-");
+				}
+			}
+			log->report("%4s %8s %8s  |  %8s %8s %8s %8s\n", "mean", "", "", mean_s[0], mean_s[1], mean_s[2], mean_s[3]);
+			log->report("%4s %8s %8s  |  %8s %8s %8s %8s\n", "std", "", "", std_s[0], std_s[1], std_s[2], std_s[3]);
+		}
+		log->report("  total time = \t%.3f\n\n", total_watch.elapsed());
+	}
 
-	} 
 	////////////////////////////////////////////////////////////////
 	///	 Testing mode
 	////////////////////////////////////////////////////////////////	
@@ -239,6 +961,11 @@ int main(int argc, void** argv) {
 			cerr << "Invalid setting. Please see the configuration\n";
 			return -1;
 		}
+		vector<string> model_delta;	///< deltas applied to the (base) models
+		if (config.isValid("model_delta")) {
+			model_delta = config.gets("model_delta");
+			assert(model_delta.size() == model_file.size());
+		}
 		if (config.isValid("output_file")) {
 			output_file = config.gets("output_file");
 			assert(test_file.size() == output_file.size());
@@ -253,6 +980,10 @@ int main(int argc, void** argv) {
 				cerr << "Model loading error\n";
 				return -1;
 			}
+			if (model_delta.size() > iter && !model->applyDelta(model_delta[iter])) {
+				cerr << "Model delta loading error\n";
+				return -1;
+			}
 			if (config.isValid("output_file")) {
 				model->test(test_file[iter], output_file[iter], confidence);
 			} else
@@ -260,4 +991,136 @@ int main(int argc, void** argv) {
 		}
 	}
 
+	////////////////////////////////////////////////////////////////
+	///	 Serve mode: prefork workers decoding the requests of stdin
+	////////////////////////////////////////////////////////////////
+	if (serve_mode) {
+		if (model_file.size() == 0) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+		if (!model->loadModel(model_file[0])) {
+			cerr << "Model loading error\n";
+			return -1;
+		}
+		if (config.isValid("model_delta") && !model->applyDelta(config.get("model_delta"))) {
+			cerr << "Model delta loading error\n";
+			return -1;
+		}
+		size_t n_workers = tricrf::numProcessors();
+		if (config.isValid("serve_workers"))
+			n_workers = atoi(config.get("serve_workers").c_str());
+		DecodeHandler handler;
+		handler.model = model;
+		handler.confidence = (config.isValid("confidence") && config.get("confidence") == "true");
+
+		/// one copy of the model for all the workers: the weights in a read-only shared segment,
+		/// and the dictionaries and the parameter index shared copy-on-write (read only in decoding)
+		size_t shared = model->shareModel();
+		log->report("[Serving]\n");
+		log->report("  workers = \t\t%d\n", n_workers);
+		log->report("  shared weights = \t%.1f MB\n", shared / 1048576.0);
+		log->report("  model memory = \t%.1f MB\n\n", tricrf::privateMemory() / 1048576.0);
+		tricrf::wall_timer stop_watch;
+		tricrf::PreforkPool pool(handler, n_workers);
+		pool.serve(0, stdout);
+		pool.shutdown();
+		log->report("[Serving summary]\n");
+		log->report("  requests = \t\t%d\n", pool.requests());
+		log->report("  failed = \t\t%d\n", pool.failures());
+		log->report("  worker restarts = \t%d\n", pool.restarts());
+		log->report("  serving time = \t%.3f\n\n", stop_watch.elapsed());
+		if (pool.failures() > 0)
+			return -1;
+	}
+
+	////////////////////////////////////////////////////////////////
+	///	 Calibrate mode: the topic prune threshold of a triangular-chain model
+	///	 tuned on held-out data against a latency budget or an accuracy floor
+	////////////////////////////////////////////////////////////////
+	if (calibrate_mode) {
+		string heldout = (config.isValid("calibrate_file") ? config.get("calibrate_file") : (dev_file.size() > 0 ? dev_file[0] : ""));
+		bool has_budget = config.isValid("latency_budget"), has_floor = config.isValid("accuracy_floor");
+		string type_str = config.get("model_type");
+		if (model_file.size() == 0 || heldout == "" || (!has_budget && !has_floor) || (type_str.find("TriCRF") != 0 && type_str.find("tricrf") != 0)) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+		double latency_budget = (has_budget ? atof(config.get("latency_budget").c_str()) : 0.0);
+		double accuracy_floor = (has_floor ? atof(config.get("accuracy_floor").c_str()) : 0.0);
+		vector<double> prunes = getValues(config, "calibrate_prune", 0.0);
+		if (!config.isValid("calibrate_prune")) {
+			const double default_prunes[] = {1, 2, 5, 10, 100, 1000, 10000, 100000};
+			prunes.assign(default_prunes, default_prunes + sizeof(default_prunes) / sizeof(double));
+		}
+		sort(prunes.begin(), prunes.end());
+		if (log == NULL)
+			log = new tricrf::Logger();
+
+		if (!model->loadModel(model_file[0])) {
+			cerr << "Model loading error\n";
+			return -1;
+		}
+		model->readDevData(heldout);
+		const vector<double>& dev_count = model->getDevSetCount();	///< count of each unique sequence (decoded once)
+		size_t n_decoded = dev_count.size(), n_utterance = 0;
+		for (size_t i = 0; i < dev_count.size(); i++)
+			n_utterance += (size_t)dev_count[i];
+		if (n_utterance == 0) {
+			cerr << "Empty held-out data\n";
+			return -1;
+		}
+		model->setPrune(prunes.back());
+		model->evaluateDev();	///< warming up
+
+		/// the largest threshold (the most accurate) within the budget, or else the smallest (the fastest) above the floor
+		log->report("[Prune calibration]\n");
+		log->report("  held-out data = \t%s (%d utterances, %d decoded)\n", heldout.c_str(), n_utterance, n_decoded);
+		log->report("%10s %12s %10s %10s  %s\n", "prune", "ms/utt", "TopicAcc", "Acc", "");
+		int selected = -1;
+		for (size_t i = 0; i < prunes.size(); i++) {
+			model->setPrune(prunes[i]);
+			tricrf::wall_timer stop_watch;
+			tricrf::Score score = model->evaluateDev();
+			double latency = stop_watch.elapsed() * 1000.0 / n_decoded;
+			bool ok = (!has_budget || latency <= latency_budget) && (!has_floor || (score.topic_accuracy >= accuracy_floor && score.accuracy >= accuracy_floor));
+			if (ok && (selected < 0 || has_budget))
+				selected = i;
+			log->report("%10g %12.3f %10.3f %10.3f  %s\n", prunes[i], latency, score.topic_accuracy, score.accuracy, (ok ? "ok" : ""));
+		}
+		if (selected < 0) {
+			log->report("  no threshold meets the target; the model file is not changed\n\n");
+			return -1;
+		}
+		char buf[64];
+		sprintf(buf, "%g", prunes[selected]);
+		if (!tricrf::MaxEnt::writeMetadata(model_file[0], "prune", buf)) {
+			cerr << "Cannot write the model file\n";
+			return -1;
+		}
+		log->report("  selected prune = \t%s (written to %s)\n\n", buf, model_file[0].c_str());
+	}
+
+	////////////////////////////////////////////////////////////////
+	///	 Check mode: the log-sum-exp forward recursion of a linear-chain model
+	///	 against the scaled sum-product one on the dev data
+	////////////////////////////////////////////////////////////////
+	if (check_mode) {
+		string type_str = config.get("model_type");
+		if (model_file.size() == 0 || dev_file.size() == 0 || (type_str != "CRF" && type_str != "crf")) {
+			cerr << "Invalid setting. Please see the configuration\n";
+			return -1;
+		}
+		double tolerance = (config.isValid("check_tolerance") ? atof(config.get("check_tolerance").c_str()) : 1E-06);
+		if (!model->loadModel(model_file[0])) {
+			cerr << "Model loading error\n";
+			return -1;
+		}
+		model->readDevData(dev_file[0]);
+		if (!((tricrf::CRF*)model)->checkChain(tolerance)) {
+			cerr << "log-sum-exp and scaled sum-product differ over the tolerance\n";
+			return -1;
+		}
+	}
+
 }
@@ -16,9 +16,13 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <functional>
+#include <iterator>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 
 #define MAT3(I,X,Y)    ((n_outcome * n_outcome * (I)) + (n_outcome * (X)) + Y)
 #define MAT2(I,X)    ((n_outcome * (I)) + X)
@@ -27,15 +31,50 @@ using namespace std;
 
 namespace tricrf {
 
+/// Topic prune threshold if neither configured nor tuned
+static const long double DEFAULT_PRUNE = 1000;
+
 /// Constructor
 MaxEnt::MaxEnt() {
 	logger = new Logger();
+	m_threads = 1;
+	m_deterministic = false;
+	m_renumber = false;
+	m_corpus_order = "input";
+	m_Gazetteer = NULL;
+	m_prune_threshold = DEFAULT_PRUNE;
+	m_prune_fixed = false;
+	m_decode_budget = 0.0;
+	m_greedy = false;
+	m_compare_decoders = false;
+	m_graft_init = 0.0;
+	m_graft_every = 0;
+	m_graft_grow = 0.0;
+	m_graft_threshold = 0.0;
+	m_l1_patience = 0;
+	m_l1_recheck = 0;
 }
 
 MaxEnt::MaxEnt(Logger *logger_ptr) {
 	setLogger(logger_ptr);
 	logger->report(2, MAX_HEADER);
 	logger->report(2, ">> Maximum Entropy << \n\n");
+	m_threads = 1;
+	m_deterministic = false;
+	m_renumber = false;
+	m_corpus_order = "input";
+	m_Gazetteer = NULL;
+	m_prune_threshold = DEFAULT_PRUNE;
+	m_prune_fixed = false;
+	m_decode_budget = 0.0;
+	m_greedy = false;
+	m_compare_decoders = false;
+	m_graft_init = 0.0;
+	m_graft_every = 0;
+	m_graft_grow = 0.0;
+	m_graft_threshold = 0.0;
+	m_l1_patience = 0;
+	m_l1_recheck = 0;
 }
 
 void MaxEnt::setLogger(Logger *logger_ptr) { 
@@ -44,6 +83,129 @@ void MaxEnt::setLogger(Logger *logger_ptr) {
 
 void MaxEnt::setPrune(double prune) {
 	m_prune_threshold = prune;
+	m_prune_fixed = true;
+}
+
+/** Set the feature induction of L-BFGS training (see Grafting).
+	@param init	fraction of the observation parameters active at the start, the most frequent first (0 for none)
+	@param every	candidates are scored every this number of iterations
+	@param grow	parameters added at a time, as a fraction of the active set
+	@param threshold	minimum gradient of a candidate
+*/
+void MaxEnt::setGrafting(double init, size_t every, double grow, double threshold) {
+	m_graft_init = init;
+	m_graft_every = every;
+	m_graft_grow = grow;
+	m_graft_threshold = threshold;
+}
+
+/** Set the skipping of the zero weights of L1 training (see L1ActiveSet).
+	@param patience	iterations at zero before a weight is skipped (0 for none)
+	@param recheck	the skipped weights are rechecked every this number of iterations
+*/
+void MaxEnt::setL1ActiveSet(size_t patience, size_t recheck) {
+	m_l1_patience = patience;
+	m_l1_recheck = recheck;
+}
+
+/** Read the model metadata ("# key = value") in a header line of a model file.
+	The prune threshold tuned for the model (see writeMetadata) is used unless it is set by setPrune.
+	@param index	index of the line in the header (0 for the first)
+	@param line	header line
+*/
+void MaxEnt::readMetadata(size_t index, const string& line) {
+	if (m_prune_fixed)
+		return;
+	if (index == 0)
+		m_prune_threshold = DEFAULT_PRUNE;	///< not to keep the threshold of the previous model
+	vector<string> tok = tokenize(line, " =\t");
+	if (tok.size() == 3 && tok[0] == "#" && tok[1] == "prune") {
+		m_prune_threshold = atof(tok[2].c_str());
+		logger->report("  tuned prune = \t%g\n", (double)m_prune_threshold);
+	}
+}
+
+/** Set a metadata ("# key = value") in the header of a model file, replacing the previous value.
+	@param filename	model file (rewritten)
+	@param key	key (e.g. prune)
+	@param value	value
+	@return success or fail
+*/
+bool MaxEnt::writeMetadata(const string& filename, const string& key, const string& value) {
+	ifstream f(filename.c_str());
+	if (!f)
+		return false;
+
+	/// header
+	vector<string> header;
+	string line;
+	while (f.peek() == '#' || f.peek() == '\n') {
+		getline(f, line);
+		header.push_back(line);
+	}
+	string meta = "# " + key + " = " + value;
+	size_t i = 0;
+	for (; i < header.size(); i++) {
+		vector<string> tok = tokenize(header[i], " =\t");
+		if (tok.size() == 3 && tok[0] == "#" && tok[1] == key)
+			break;
+	}
+	if (i < header.size())
+		header[i] = meta;
+	else	///< after the title lines
+		header.insert(header.begin() + (header.size() < 3 ? header.size() : 3), meta);
+
+	string temp = filename + ".tmp";
+	ofstream out(temp.c_str());
+	if (!out)
+		return false;
+	for (i = 0; i < header.size(); i++)
+		out << header[i] << endl;
+	if (f.peek() != EOF)
+		out << f.rdbuf();
+	out.close();
+	f.close();
+	if (!out || rename(temp.c_str(), filename.c_str()) != 0) {
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Set the number of training threads (used by the models which support the parallel training).
+	@param threads	number of threads
+	@param deterministic	whether the trained model should be the same for any number of threads
+*/
+void MaxEnt::setThreads(size_t threads, bool deterministic) {
+	m_threads = (threads > 0 ? threads : 1);
+	m_deterministic = deterministic;
+}
+
+/** Renumber the features by frequency after loading the training data, 
+	so that the weights of the frequent features are packed together.
+	@param renumber	whether the features are renumbered
+*/
+void MaxEnt::setRenumber(bool renumber) {
+	m_renumber = renumber;
+}
+
+/** Order the training sequences after loading, so that the consecutive sequences share 
+	the weights in the cache. The objective and the gradient are sums over the sequences,
+	so the order does not change the estimation (except for the rounding of the sums).
+	@param order	"input" (file order), "length" (by length) or "features" (clustered by shared features)
+*/
+void MaxEnt::setCorpusOrder(const string& order) {
+	if (order != "input" && order != "length" && order != "features")
+		throw runtime_error("unknown corpus order");
+	m_corpus_order = order;
+}
+
+/** Add the gazetteer features to the tokens of the data files (train, dev and test).
+	The same gazetteer should be given to test the model.
+	@param gazetteer	gazetteer shared with the other models (NULL for none)
+*/
+void MaxEnt::setGazetteer(const Gazetteer* gazetteer) {
+	m_Gazetteer = gazetteer;
 }
 
 /// Deconstructor
@@ -108,6 +270,7 @@ bool MaxEnt::loadModel(const std::string& filename) {
     string line;
     getline(f, line);
     while (line.empty() || line[0] == '#') {
+		readMetadata(count, line);
 		if (count == 1) {
 			vector<string> tok = tokenize(line);
 			if (tok.size() < 2 || tok[1] != "MaxEnt") {
@@ -127,6 +290,67 @@ bool MaxEnt::loadModel(const std::string& filename) {
 	return ret;
 }
 
+vector<Parameter*> MaxEnt::paramSections() {
+	return vector<Parameter*>(1, &m_Param);
+}
+
+/** Move the weights of the loaded model into read-only shared memory (see Parameter::shareWeights),
+	to be shared by the decoding processes forked afterwards. The model can no longer be trained or updated.
+	@return bytes of the shared weights
+*/
+size_t MaxEnt::shareModel() {
+	size_t bytes = 0;
+	vector<Parameter*> param = paramSections();
+	for (size_t i = 0; i < param.size(); i++)
+		bytes += param[i]->shareWeights();
+	return bytes;
+}
+
+/** Apply a model delta (see makeModelDelta) to the loaded base model.
+	The new states, features and parameters are appended, and the changed weights are replaced, 
+	so that the model can be updated without loading the complete new model.
+	@param filename	model delta file
+	@return false if the delta is not made from the loaded model
+*/
+bool MaxEnt::applyDelta(const std::string& filename) {
+	if (filename == "")
+		return false;
+
+	timer stop_watch;
+	logger->report("[Model delta loading]\n");
+
+	/// file stream
+	ifstream f(filename.c_str());
+	if (!f)
+		throw runtime_error("fail to open model delta file");
+
+	/// header
+	string line;
+	getline(f, line);
+	while (f && (line.empty() || line[0] == '#' || line[0] == ':'))
+		getline(f, line);
+
+	/// sections
+	vector<Parameter*> param = paramSections();
+	vector<string> tok = tokenize(line);
+	if (tok.size() < 4 || tok[1] != "Sections" || (size_t)atoi(tok[3].c_str()) != param.size()) {
+		logger->report("|Error| Invalid model delta file ... \n");
+		return false;
+	}
+	for (size_t i = 0; i < param.size(); i++) {
+		if (!param[i]->loadDelta(f)) {
+			logger->report("|Error| Model delta does not match the model ... \n");
+			return false;
+		}
+		param[i]->print(logger);
+	}
+	f.close();
+	prepareInference();
+	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
+
+	return true;
+}
+
 /**	Add an event to memory.
 	@param tokens	string tokens to be packed
 	@param p_Param	parameter pointer
@@ -328,9 +552,60 @@ StringEvent MaxEnt::packStringEvent(vector<string>& tokens, Parameter* p_Param,
 	return ev;
 }
 
-/** Read training data from file.
+/// Data file text of tokenized sequences (a line of tokens for each event, a blank line after each sequence)
+static void writeTokenSequences(const vector<TokenSequence>& data, ostream& out) {
+	for (size_t n = 0; n < data.size(); n++) {
+		for (size_t i = 0; i < data[n].size(); i++) {
+			for (size_t j = 0; j < data[n][i].size(); j++)
+				out << (j > 0 ? " " : "") << data[n][i][j];
+			out << "\n";
+		}
+		out << "\n";
+	}
+}
+
+/** Read training data from a file.
+	@param filename	data file
 */
 void MaxEnt::readTrainData(const string& filename) {
+	ifstream f(filename.c_str());
+	if (!f)
+		throw runtime_error("cannot open data file");
+	readTrainData(f);
+}
+
+/** Read training data from tokenized sequences (e.g. of a feature extraction in memory).
+	@param data	sequences, in the format of the data files
+*/
+void MaxEnt::readTrainData(const vector<TokenSequence>& data) {
+	stringstream s;
+	writeTokenSequences(data, s);
+	readTrainData(s);
+}
+
+/** Read dev data from a file.
+	@param filename	data file
+*/
+void MaxEnt::readDevData(const string& filename) {
+	ifstream f(filename.c_str());
+	if (!f)
+		throw runtime_error("cannot open data file");
+	readDevData(f);
+}
+
+/** Read dev data from tokenized sequences.
+	@param data	sequences, in the format of the data files
+*/
+void MaxEnt::readDevData(const vector<TokenSequence>& data) {
+	stringstream s;
+	writeTokenSequences(data, s);
+	readDevData(s);
+}
+
+/** Read training data from a stream.
+	A stream that cannot be rewound (e.g. a pipe) is read into memory first (see DataStream).
+*/
+void MaxEnt::readTrainData(istream& in) {
 
 	// initializing
 	m_TrainSet.clear();
@@ -339,9 +614,9 @@ void MaxEnt::readTrainData(const string& filename) {
 	vector<vector<string> > token_list;
 
 	/// file stream
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	string line;
 	size_t count = 0;
 	Sequence seq;
@@ -374,17 +649,146 @@ void MaxEnt::readTrainData(const string& filename) {
 
 	logger->report("  # of data = \t\t%d\n", count);
 	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
+
+	if (m_renumber)
+		renumberFeatures();
+	reorderTrainSet();
+}
+
+/// Number of cache lines of the weights covering 90% of the weight accesses of the data set
+static size_t hotCacheLines(Data<Sequence>& data, Parameter& param) {
+	const size_t LINE = 64 / sizeof(double);	///< weights per cache line
+	vector<size_t> access(param.size() / LINE + 1, 0);
+	size_t total = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		for (size_t t = 0; t < data[i].size(); t++) {
+			Event& ev = data[i][t];
+			for (size_t j = 0; j < ev.obs.size(); j++) {
+				vector<pair<size_t, size_t> >& p = param.m_ParamIndex[ev.obs[j].first];
+				for (size_t k = 0; k < p.size(); k++)
+					++access[p[k].second / LINE];
+				total += p.size();
+			}
+		}
+	}
+	sort(access.begin(), access.end(), greater<size_t>());
+	size_t n_line = 0, covered = 0;
+	while (n_line < access.size() && covered < 0.9 * total)
+		covered += access[n_line++];
+	return n_line;
+}
+
+/// Average number of cache lines of the weights touched by a sequence but not by the previous one
+static double newCacheLines(Data<Sequence>& data, Parameter& param) {
+	const size_t LINE = 64 / sizeof(double);	///< weights per cache line
+	vector<size_t> lines, prev_lines, diff;
+	size_t n_line = 0;
+	for (size_t i = 0; i < data.size(); i++) {
+		lines.clear();
+		for (size_t t = 0; t < data[i].size(); t++) {
+			Event& ev = data[i][t];
+			for (size_t j = 0; j < ev.obs.size(); j++) {
+				vector<pair<size_t, size_t> >& p = param.m_ParamIndex[ev.obs[j].first];
+				for (size_t k = 0; k < p.size(); k++)
+					lines.push_back(p[k].second / LINE);
+			}
+		}
+		sort(lines.begin(), lines.end());
+		lines.erase(unique(lines.begin(), lines.end()), lines.end());
+		diff.clear();
+		set_difference(lines.begin(), lines.end(), prev_lines.begin(), prev_lines.end(), back_inserter(diff));
+		n_line += diff.size();
+		prev_lines.swap(lines);
+	}
+	return (data.size() > 0 ? (double)n_line / data.size() : 0.0);
 }
 
-/**	Read the data from file
+/// Sort key of a training sequence
+struct SequenceKey {
+	vector<size_t> key;
+	size_t index;
+	bool operator<(const SequenceKey& other) const {
+		return (key < other.key || (key == other.key && index < other.index));
+	}
+};
+
+/** Reorder the training sequences (see setCorpusOrder).
+	By "length", the sequences are sorted by length. By "features", the sequences are clustered 
+	by MinHash signatures of their feature sets: two sequences share a hash value with the probability 
+	of the Jaccard similarity of their features, so the sequences sorted by the signature 
+	are next to the similar ones.
 */
-void MaxEnt::readDevData(const string& filename) {
+void MaxEnt::reorderTrainSet() {
+	if (m_corpus_order == "input" || m_TrainSet.size() == 0)
+		return;
+
+	timer stop_watch;
+	const size_t N_HASH = 4;
+	const size_t HASH_A[N_HASH] = { 0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL };
+	const size_t HASH_B[N_HASH] = { 0x27D4EB2F165667C5ULL, 0x85EBCA77C2B2AE63ULL, 0xFF51AFD7ED558CCDULL, 0xC4CEB9FE1A85EC53ULL };
+	vector<SequenceKey> keys(m_TrainSet.size());
+	for (size_t i = 0; i < m_TrainSet.size(); i++) {
+		Sequence& seq = m_TrainSet[i];
+		keys[i].index = i;
+		if (m_corpus_order == "length") {
+			keys[i].key.push_back(seq.size());
+			continue;
+		}
+		keys[i].key.assign(N_HASH, (size_t)-1);
+		for (size_t t = 0; t < seq.size(); t++) {
+			for (size_t j = 0; j < seq[t].obs.size(); j++) {
+				for (size_t h = 0; h < N_HASH; h++) {
+					size_t x = seq[t].obs[j].first * HASH_A[h] + HASH_B[h];
+					x ^= (x >> 29);
+					keys[i].key[h] = min(keys[i].key[h], x);
+				}
+			}
+		}
+	}
+	sort(keys.begin(), keys.end());
+
+	double before = newCacheLines(m_TrainSet, m_Param);
+	vector<size_t> order(keys.size());
+	for (size_t i = 0; i < keys.size(); i++)
+		order[i] = keys[i].index;
+	reorderData(m_TrainSet, m_TrainSetCount, order);
+
+	logger->report("[Training data ordering by %s]\n", m_corpus_order.c_str());
+	logger->report("  new cache lines/seq = \t%.2f -> %.2f\n", before, newCacheLines(m_TrainSet, m_Param));
+	logger->report("  ordering time = \t%.3f\n\n", stop_watch.elapsed());
+}
+
+/** Renumber the features by frequency (see Parameter::renumberByFrequency), 
+	and the observations of the training events accordingly.
+	@return new id of each old feature id
+*/
+vector<size_t> MaxEnt::renumberFeatures() {
+	timer stop_watch;
+	size_t before = hotCacheLines(m_TrainSet, m_Param);
+	vector<size_t> pid_map = m_Param.renumberByFrequency();
+	for (size_t i = 0; i < m_TrainSet.size(); i++) {
+		for (size_t t = 0; t < m_TrainSet[i].size(); t++) {
+			vector<pair<size_t, double> >& obs = m_TrainSet[i][t].obs;
+			for (size_t j = 0; j < obs.size(); j++)
+				obs[j].first = pid_map[obs[j].first];
+		}
+	}
+	logger->report("[Feature renumbering by frequency]\n");
+	if (m_TrainSet.size() > 0)
+		logger->report("  hot cache lines = \t%d -> %d (90%% of the accesses)\n", before, hotCacheLines(m_TrainSet, m_Param));
+	logger->report("  renumbering time = \t%.3f\n\n", stop_watch.elapsed());
+	return pid_map;
+}
+
+/**	Read the data from a stream
+*/
+void MaxEnt::readDevData(istream& in) {
 
-	/// File stream
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	
 	/// initializing
 	size_t count = 0;
@@ -481,6 +885,18 @@ bool MaxEnt::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double et
 	logger->report("  Regularization = \t%s\n", (sigma ? (L1 ? "L1":"L2") : "none"));
 	logger->report("  Penalty value = \t%.2f\n", sigma);
 	m_Param.print(logger);
+	Grafting graft(m_graft_init, m_graft_every, m_graft_grow, m_graft_threshold);
+	if (graft.enabled()) {
+		graft.start(m_Param);
+		theta = m_Param.getWeight();
+		gradient = m_Param.getGradient();
+		logger->report("  Feature induction = \t%d active parameters at the start\n", m_Param.size());
+	}
+	L1ActiveSet zero_set((L1 && sigma && !graft.enabled()) ? m_l1_patience : 0, m_l1_recheck);	///< not with the feature induction
+	if (zero_set.enabled()) {
+		zero_set.start(m_Param);
+		logger->report("  L1 active set = \tskip after %d iterations at zero (recheck every %d)\n", m_l1_patience, m_l1_recheck);
+	}
 
 	logger->report("[Iterations]\n");
 	logger->report("%4s %15s %8s %8s %8s %8s\n", "iter", "loglikelihood", "acc", "micro-f1", "macro-f1", "sec");
@@ -492,6 +908,16 @@ bool MaxEnt::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double et
     for (size_t niter = 0 ;niter < (int)max_iter; ++niter) {
 		/// Initializing local variables
         timer t2;	///< elapsed time for one iteration
+		bool grow = graft.due(niter);
+		bool recheck = zero_set.due(niter);
+		if (grow || recheck) {	///< the gradient of all the parameters
+			if (grow)
+				graft.expand(m_Param);
+			else
+				zero_set.expand(m_Param);
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+		}
 		m_Param.initializeGradient();	///< gradient vector initialization
 		eval.initialize();	///< evaluator intialization
 		
@@ -501,6 +927,8 @@ bool MaxEnt::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double et
         for (; sit != m_TrainSet.end(); ++sit, ++count_it) {
 			Sequence::iterator it = sit->begin();
 			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 			vector<size_t> reference, hypothesis;
 
 			for (; it != sit->end(); ++it) {	 /// for each node
@@ -581,21 +1009,43 @@ bool MaxEnt::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double et
 			}
         }
 		
+		if (grow) {	///< add the candidates, and restart LBFGS on the new active set
+			graft.grow(m_Param, sigma, L1);
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+			lbfgs.clear();
+		}
+		if (recheck) {	///< add back and drop the weights, and restart LBFGS if the active set changed
+			if (zero_set.recheck(m_Param, sigma))
+				lbfgs.clear();
+			theta = m_Param.getWeight();
+			gradient = m_Param.getGradient();
+		} else
+			zero_set.track(m_Param, sigma);
+
 		double diff = (niter == 0 ? 1.0 : abs(old_obj - eval.getObjFunc()) / old_obj);
 		if (diff < eta) 
 			converge++;
 		else
 			converge = 0;
 		old_obj = eval.getObjFunc();
-		if (converge == 3)
+		if (converge == 3 && graft.pending()) {	///< converged on the active set
+			graft.force();
+			converge = 0;
+		} else if (converge == 3)
 			break;
 
 		/// LBFGS optimizer
 		int ret = lbfgs.optimize(m_Param.size(), theta, eval.getObjFunc(), gradient, L1, sigma);
 		if (ret < 0)
 			return false;
-		else if (ret == 0)
+		else if (ret == 0 && graft.pending())
+			graft.force();
+		else if (ret == 0) {
+			graft.report(logger);
+			zero_set.report(logger);
 			return true;
+		}
 		
 		eval.calculateF1();
 		if (m_DevSet.size() > 0) {
@@ -610,6 +1060,8 @@ bool MaxEnt::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double et
 		}
 
 	} ///< for iter
+	graft.report(logger);
+	zero_set.report(logger);
 
 	return true;
 }
@@ -626,18 +1078,52 @@ bool MaxEnt::train(size_t max_iter, double sigma, bool L1) {
 	return estimateWithLBFGS(max_iter, sigma, L1); 
 }
 
-bool MaxEnt::test(const std::string& filename, const std::string& outputfile, bool confidence) {
-	/// File stream
-	string line;
+/** Testing a data file.
+	@param filename	test data file
+	@param outputfile	output file ("" not to write)
+	@param confidence	whether to output the confidence of each label
+	@return success or fail
+*/
+bool MaxEnt::test(const string& filename, const string& outputfile, bool confidence) {
 	ifstream f(filename.c_str());
 	if (!f)
 		throw runtime_error("cannot open data file");
+	if (outputfile == "")
+		return test(f, NULL, confidence);
+	ofstream out(outputfile.c_str());
+	return test(f, &out, confidence);
+}
+
+/** Testing tokenized sequences.
+	@param data	sequences, in the format of the data files
+	@param output	output stream (NULL not to write)
+	@param confidence	whether to output the confidence of each label
+	@return success or fail
+*/
+bool MaxEnt::test(const vector<TokenSequence>& data, ostream* output, bool confidence) {
+	stringstream s;
+	writeTokenSequences(data, s);
+	return test(s, output, confidence);
+}
+
+/** Testing the data of a stream.
+	@param in	test data
+	@param output	output stream (NULL not to write)
+	@param confidence	whether to output the confidence of each label
+	@return success or fail
+*/
+bool MaxEnt::test(istream& in, ostream* output, bool confidence) {
+	/// Data stream
+	string line;
+	DataStream f(in, m_Gazetteer);
+	if (!f)
+		throw runtime_error("cannot read data stream");
 	
 	/// output
-	ofstream out;
+	ostream null_out(NULL);
+	ostream& out = (output != NULL ? *output : null_out);
 	vector<string> state_vec;
-	if (outputfile != "") {
-		out.open(outputfile.c_str());
+	if (output != NULL) {
 		out.precision(20);
 		state_vec = m_Param.getState().second;
 	}
@@ -663,14 +1149,14 @@ bool MaxEnt::test(const std::string& filename, const std::string& outputfile, bo
 
 				reference.push_back(it->label);
 				hypothesis.push_back(max_outcome);
-				if (outputfile != "") {
+				if (output != NULL) {
 					out << state_vec[max_outcome];
 					if (confidence)
 						out << " " << q[max_outcome];
 					out << endl; 
 				}
 			}
-			if (outputfile != "")
+			if (output != NULL)
 				out << endl;
 			test_eval.append(reference, hypothesis);	
 			seq.clear();
@@ -687,8 +1173,67 @@ bool MaxEnt::test(const std::string& filename, const std::string& outputfile, bo
 	logger->report("  Acc = \t\t%8.3f\n", test_eval.getAccuracy());
 	logger->report("  MicroF1 = \t\t%8.3f\n", test_eval.getMicroF1()[2]);
 	logger->report("  MacroF1 = \t\t%8.3f\n", test_eval.getMacroF1()[2]);
+
+	return true;
+}
+
+/** Evaluate the current weights on the dev set.
+	@return accuracy and F1 scores (zero if there is no dev data)
+*/
+Score MaxEnt::evaluateDev() {
+	Score score;
+	if (m_DevSet.size() == 0)
+		return score;
+
+	Evaluator dev_eval(m_Param);
+	dev_eval.initialize();
+	Data<Sequence>::iterator sit = m_DevSet.begin();
+	vector<double>::iterator count_it = m_DevSetCount.begin();
+	for (; sit != m_DevSet.end(); ++sit, ++count_it) {
+		vector<size_t> reference, hypothesis;
+		for (Sequence::iterator it = sit->begin(); it != sit->end(); ++it) {
+			size_t max_outcome = 0;
+			evaluate(*it, max_outcome);
+			reference.push_back(it->label);
+			hypothesis.push_back(max_outcome);
+		}
+		for (size_t c = 0; c < *count_it; c++)
+			dev_eval.append(reference, hypothesis);
+	}
+	dev_eval.calculateF1();
+
+	score.accuracy = dev_eval.getAccuracy();
+	score.micro_f1 = dev_eval.getMicroF1()[2];
+	score.macro_f1 = dev_eval.getMacroF1()[2];
+	return score;
+}
+
+/** Hold out a part of the training data as the dev set (e.g. a cross-validation fold).
+	The empirical feature counts are recounted over the remaining training data, while
+	the dictionaries (hence the parameter space) are kept.
+	@param held_out	unique training sequences to be held out
+*/
+void MaxEnt::holdOut(const vector<bool>& held_out) {
+	holdOutData(m_TrainSet, m_TrainSetCount, held_out, m_DevSet, m_DevSetCount);
+	recount();
 }
 
+/** Recount the empirical feature counts of the training set.
+	@warning	Events do not keep the values of "feature:value" observations, so the label value is used.
+*/
+void MaxEnt::recount() {
+	m_Param.clearCount();
+	for (size_t n = 0; n < m_TrainSet.size(); ++n) {
+		double count = m_TrainSetCount[n];
+		if (count == 0.0)
+			continue;
+		for (Sequence::iterator it = m_TrainSet[n].begin(); it != m_TrainSet[n].end(); ++it) {
+			vector<pair<size_t, double> >::iterator obs = it->obs.begin();
+			for (; obs != it->obs.end(); ++obs)
+				m_Param.addCount(it->label, obs->first, it->fval * count);
+		}
+	}
+}
 
 }	///< namespace tricrf
 
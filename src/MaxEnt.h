@@ -11,10 +11,14 @@
 /// max headers
 #include "Param.h"
 #include "Data.h"
+#include "Evaluator.h"
+#include "Gazetteer.h"
+#include "Grafting.h"
 /// standard headers
 #include <vector>
 #include <string>
 #include <map>
+#include <iostream>
 
 namespace tricrf {
 
@@ -40,11 +44,44 @@ protected:
 
 	/// Parameter Estimation
 	virtual bool estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double eta = 1E-05);
+	virtual void recount();	///< Recounting the empirical feature counts of the training set
 
 	/// Prune
 	/// for pruning
 	std::vector<std::pair<long double, size_t> > m_prune;
 	long double m_prune_threshold;
+	bool m_prune_fixed;		///< set by setPrune, otherwise the threshold tuned in the model file (or the default)
+	double m_decode_budget;		///< decoding time per sequence in ms (0 for no budget, see DecodeBudget)
+	bool m_greedy;			///< greedy (MEMM-style) decoding instead of Viterbi
+	bool m_compare_decoders;	///< decode with both and report the comparison (see DecoderComparison)
+
+	/// Feature induction in L-BFGS training (see Grafting)
+	double m_graft_init;		///< fraction of the observation parameters active at the start (0 for none)
+	size_t m_graft_every;		///< candidates scored every N iterations
+	double m_graft_grow;		///< parameters added at a time, as a fraction of the active set
+	double m_graft_threshold;	///< minimum gradient of a candidate
+	size_t m_l1_patience;		///< (L1) iterations at zero before a weight is skipped (0 for none, see L1ActiveSet)
+	size_t m_l1_recheck;		///< (L1) the skipped weights are rechecked every N iterations
+
+	/// Number of training threads
+	size_t m_threads;
+	bool m_deterministic;	///< results independent of the number of threads
+
+	/// Renumbering the features by frequency after loading the training data
+	bool m_renumber;
+	std::vector<size_t> renumberFeatures();
+
+	/// Ordering the training sequences after loading ("input", "length" or "features")
+	std::string m_corpus_order;
+	void reorderTrainSet();
+
+	/// Gazetteer features added to the data files (NULL for none)
+	const Gazetteer* m_Gazetteer;
+
+	/// Parameter sections of the model file (in order), and the indexes made after loading them
+	virtual std::vector<Parameter*> paramSections();
+	virtual void prepareInference() {};
+	void readMetadata(size_t index, const std::string& line);	///< Model metadata in the header line of a model file
 
 
 public:
@@ -56,16 +93,28 @@ public:
 	Event packEvent(std::vector<std::string>& tokens, Parameter* p_Param = NULL, bool test = false);
 	Event packEvent2(std::vector<std::string>& tokens, Parameter* p_Param = NULL, bool test = false);
 	StringEvent packStringEvent(std::vector<std::string>& tokens, Parameter* p_Param = NULL, bool test = false);
-	virtual void readTrainData(const std::string& filename);
-	virtual void readDevData(const std::string& filename);
+	void readTrainData(const std::string& filename);
+	void readDevData(const std::string& filename);
+	virtual void readTrainData(std::istream& in);	///< Read the training data from a stream (e.g. in memory)
+	virtual void readDevData(std::istream& in);
+	void readTrainData(const std::vector<TokenSequence>& data);	///< Read tokenized sequences
+	void readDevData(const std::vector<TokenSequence>& data);
+	virtual void holdOut(const std::vector<bool>& held_out);	///< Holding out training data as the dev set
+	const std::vector<double>& getTrainSetCount() { return m_TrainSetCount; };
+	const std::vector<double>& getDevSetCount() { return m_DevSetCount; };
 	
 	/// Model 
 	virtual bool loadModel(const std::string& filename);
 	virtual bool saveModel(const std::string& filename);
-	virtual bool averageParam() {};
+	virtual bool applyDelta(const std::string& filename);	///< Apply a model delta to the loaded model
+	size_t shareModel();	///< Move the weights of the loaded model into read-only shared memory
+	virtual bool averageParam() { return true; };
 
 	/// Testing
-	virtual bool test(const std::string& filename, const std::string& outputfile = "", bool confidence = false);
+	bool test(const std::string& filename, const std::string& outputfile = "", bool confidence = false);
+	virtual bool test(std::istream& in, std::ostream* output = NULL, bool confidence = false);	///< Test the data of a stream (the output to a stream)
+	bool test(const std::vector<TokenSequence>& data, std::ostream* output = NULL, bool confidence = false);	///< Test tokenized sequences
+	virtual Score evaluateDev();	///< Evaluating the current weights on the dev set
 
 	/// Training 
 	virtual void clear();
@@ -76,6 +125,16 @@ public:
 	/// Logger 
 	void setLogger(Logger *logger);
 	void setPrune(double prune);
+	double getPrune() { return m_prune_threshold; };
+	void setDecodeBudget(double budget_ms) { m_decode_budget = budget_ms; };
+	void setDecoder(bool greedy, bool compare = false) { m_greedy = greedy; m_compare_decoders = compare; };	///< Greedy or Viterbi decoding (CRF, TriCRF)
+	void setGrafting(double init, size_t every, double grow, double threshold);	///< Grow the active parameters by the gradient in training (MaxEnt, CRF)
+	void setL1ActiveSet(size_t patience, size_t recheck);	///< Skip the zero weights in L1 training (MaxEnt, CRF)
+	static bool writeMetadata(const std::string& filename, const std::string& key, const std::string& value);	///< Set a metadata of a model file
+	void setThreads(size_t threads, bool deterministic = false);
+	void setRenumber(bool renumber);
+	void setCorpusOrder(const std::string& order);
+	void setGazetteer(const Gazetteer* gazetteer);
 	
 	Parameter& getParam() { return m_Param; };
 };
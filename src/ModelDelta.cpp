@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "ModelDelta.h"
+#include "Param.h"
+/// standard headers
+#include <deque>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace tricrf {
+
+/** Read a model file: the header, the parameter sections, and the remaining (model specific) lines.
+	@return false if the file has no parameter section
+*/
+static bool readModelFile(const string& filename, vector<string>& header, deque<Parameter>& param, vector<string>& rest) {
+	ifstream f(filename.c_str());
+	if (!f)
+		throw runtime_error("fail to open model file");
+
+	/// header
+	string line;
+	getline(f, line);
+	while (f && (line.empty() || line[0] == '#')) {
+		header.push_back(line);
+		getline(f, line);
+	}
+
+	/// parameter sections
+	streampos pos = f.tellg();
+	while (getline(f, line)) {
+		if (line.compare(0, 8, "// State") != 0) {
+			rest.push_back(line);
+			break;
+		}
+		f.seekg(pos);
+		param.push_back(Parameter());
+		if (!param.back().load(f))
+			return false;
+		pos = f.tellg();
+	}
+	while (getline(f, line))
+		rest.push_back(line);
+
+	return (param.size() > 0);
+}
+
+static size_t fileBytes(const string& filename) {
+	struct stat st;
+	return (stat(filename.c_str(), &st) == 0 ? (size_t)st.st_size : 0);
+}
+
+bool makeModelDelta(const string& base_file, const string& new_file, const string& delta_file, double threshold, Logger *logger) {
+	timer stop_watch;
+	logger->report("[Model delta]\n");
+	logger->report("  base model = \t\t%s\n", base_file.c_str());
+	logger->report("  new model = \t\t%s\n", new_file.c_str());
+
+	vector<string> base_header, new_header, base_rest, new_rest;
+	deque<Parameter> base_param, new_param;
+	if (!readModelFile(base_file, base_header, base_param, base_rest) || !readModelFile(new_file, new_header, new_param, new_rest)) {
+		logger->report("|Error| Invalid model files ... \n");
+		return false;
+	}
+	if (base_header.size() < 2 || new_header.size() < 2 || base_header[1] != new_header[1]) {
+		logger->report("|Error| The models are not of the same type ... \n");
+		return false;
+	}
+	if (base_param.size() != new_param.size() || base_rest != new_rest) {
+		logger->report("|Error| The models have different structures (make the full model) ... \n");
+		return false;
+	}
+
+	/// file stream
+	ofstream f(delta_file.c_str());
+	f.precision(20);
+	if (!f)
+		throw runtime_error("unable to open file to write");
+
+	/// header
+	vector<string> tok = tokenize(new_header[1]);
+	f << "# MAX: A C++ Library for Structured Prediction" << endl;
+	f << "# " << (tok.size() > 1 ? tok[1] : "") << " Model delta file (text format)" << endl;
+	f << "# Do not edit this file" << endl;
+	f << "# " << endl << ":" << endl;
+
+	f << "// Sections ; " << new_param.size() << endl;
+	size_t n_changed = 0, n_weight = 0;
+	for (size_t i = 0; i < new_param.size(); i++) {
+		size_t n = 0;
+		if (!new_param[i].saveDelta(f, base_param[i], threshold, n)) {
+			logger->report("|Error| The states of the base model are changed (make the full model) ... \n");
+			return false;
+		}
+		n_changed += n;
+		n_weight += new_param[i].size();
+	}
+	f.close();
+
+	size_t full = fileBytes(new_file), delta = fileBytes(delta_file);
+	logger->report("  threshold = \t\t%g\n", threshold);
+	logger->report("  changed weights = \t%d of %d\n", n_changed, n_weight);
+	logger->report("  delta file = \t\t%s (%.1f%% of the model)\n", delta_file.c_str(), (full > 0 ? 100.0 * delta / full : 0.0));
+	logger->report("  delta time = \t\t%.3f\n\n", stop_watch.elapsed());
+
+	return true;
+}
+
+} // namespace tricrf
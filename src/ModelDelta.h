@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __MODELDELTA_H__
+#define __MODELDELTA_H__
+
+/// max headers
+#include "Utility.h"
+/// standard headers
+#include <string>
+
+namespace tricrf {
+
+/** Make a model delta: the difference of a new model from a base model of the same type.
+	For each parameter section of the model file, the delta lists the new states, features and 
+	parameter index entries, and the weights changed by more than the threshold (see Parameter::saveDelta).
+	It is applied to the loaded base model by MaxEnt::applyDelta.
+	@param base_file	base model file
+	@param new_file	new model file
+	@param delta_file	model delta file to write
+	@param threshold	minimum change of a weight to be listed (0 for the exact new model)
+	@param logger	logger
+	@return false if the new model cannot be made from the base (e.g. the states are reordered)
+*/
+bool makeModelDelta(const std::string& base_file, const std::string& new_file, const std::string& delta_file, 
+	double threshold, Logger *logger);
+
+} // namespace tricrf
+
+#endif
@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "Parallel.h"
+/// standard headers
+#include <iostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <signal.h>
+
+using namespace std;
+
+namespace tricrf {
+
+size_t numProcessors() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0 ? (size_t)n : 1);
+}
+
+size_t availableMemory() {
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+	return (pages > 0 && page_size > 0 ? (size_t)pages * (size_t)page_size : 0);
+}
+
+/// Arguments of a thread of runThreads
+struct ThreadArg {
+	ThreadTask *task;
+	size_t thread;
+	std::string error;
+};
+
+static void* runThread(void* p) {
+	ThreadArg *arg = (ThreadArg*)p;
+	try {
+		arg->task->run(arg->thread);
+	} catch (exception& e) {
+		arg->error = e.what();
+	}
+	return NULL;
+}
+
+/** Run a task on the given number of threads.
+	An exception of any thread is thrown again after all the threads finish.
+	@param task	task to be run
+	@param n_threads	number of threads
+*/
+void runThreads(ThreadTask& task, size_t n_threads) {
+	if (n_threads < 1)
+		n_threads = 1;
+	vector<ThreadArg> args(n_threads);
+	vector<pthread_t> threads(n_threads);
+	vector<bool> created(n_threads, false);
+	for (size_t t = 0; t < n_threads; t++) {
+		args[t].task = &task;
+		args[t].thread = t;
+	}
+	for (size_t t = 1; t < n_threads; t++) 
+		created[t] = (pthread_create(&threads[t], NULL, runThread, &args[t]) == 0);
+	runThread(&args[0]);
+	for (size_t t = 1; t < n_threads; t++) {
+		if (created[t])
+			pthread_join(threads[t], NULL);
+		else 
+			runThread(&args[t]);	///< no more threads; run it here
+	}
+	for (size_t t = 0; t < n_threads; t++) {
+		if (args[t].error != "")
+			throw runtime_error(args[t].error);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+/// WorkStealing
+////////////////////////////////////////////////////////////////////////
+
+WorkStealing::WorkStealing() {
+	m_threads = 0;
+	m_Lock = NULL;
+	m_Task = NULL;
+}
+
+WorkStealing::~WorkStealing() {
+	for (size_t t = 0; m_Lock != NULL && t < m_threads; t++)
+		pthread_mutex_destroy(&m_Lock[t]);
+	delete [] m_Lock;
+}
+
+/// Comparing the items by cost (longest first, then by index)
+struct CostOrder {
+	const vector<double>* cost;
+	bool operator()(size_t a, size_t b) const {
+		if ((*cost)[a] != (*cost)[b])
+			return (*cost)[a] > (*cost)[b];
+		return a < b;
+	}
+};
+
+/** Make the chunks of the items and deal them to the threads.
+	@param cost	estimated cost of each item (0 to skip the item)
+	@param n_threads	number of threads
+	@param chunks_per_thread	number of chunks per thread on average
+	@param n_chunks	number of chunks regardless of the threads (0 to use chunks_per_thread)
+*/
+void WorkStealing::schedule(const vector<double>& cost, size_t n_threads, size_t chunks_per_thread, size_t n_chunks) {
+	if (m_Lock != NULL) {
+		for (size_t t = 0; t < m_threads; t++)
+			pthread_mutex_destroy(&m_Lock[t]);
+		delete [] m_Lock;
+	}
+	m_threads = (n_threads > 0 ? n_threads : 1);
+	m_Lock = new pthread_mutex_t[m_threads];
+	for (size_t t = 0; t < m_threads; t++)
+		pthread_mutex_init(&m_Lock[t], NULL);
+
+	/// longest first
+	double total = 0.0;
+	m_Order.clear();
+	for (size_t i = 0; i < cost.size(); i++) {
+		if (cost[i] > 0.0) {
+			m_Order.push_back(i);
+			total += cost[i];
+		}
+	}
+	CostOrder order;
+	order.cost = &cost;
+	sort(m_Order.begin(), m_Order.end(), order);
+
+	/// chunks of about the same cost
+	if (n_chunks == 0)
+		n_chunks = m_threads * max((size_t)1, chunks_per_thread);
+	double target = total / n_chunks;
+	vector<double> chunk_cost;
+	m_Chunk.clear();
+	for (size_t k = 0; k < m_Order.size(); ) {
+		Chunk chunk;
+		chunk.begin = k;
+		double sum = 0.0;
+		while (k < m_Order.size() && (k == chunk.begin || sum + cost[m_Order[k]] <= target)) 
+			sum += cost[m_Order[k++]];
+		chunk.end = k;
+		chunk.thread = 0;
+		m_Chunk.push_back(chunk);
+		chunk_cost.push_back(sum);
+	}
+
+	/// dealing the chunks (longest first) to the least loaded thread
+	vector<double> load(m_threads, 0.0);
+	for (size_t c = 0; c < m_Chunk.size(); c++) {
+		size_t t = min_element(load.begin(), load.end()) - load.begin();
+		m_Chunk[c].thread = t;
+		load[t] += chunk_cost[c];
+	}
+}
+
+/// Take a chunk from the front of its own deque, or steal one from the back of another
+bool WorkStealing::pop(size_t thread, size_t& chunk) {
+	pthread_mutex_lock(&m_Lock[thread]);
+	bool found = !m_Queue[thread].empty();
+	if (found) {
+		chunk = m_Queue[thread].front();
+		m_Queue[thread].pop_front();
+	}
+	pthread_mutex_unlock(&m_Lock[thread]);
+
+	for (size_t k = 1; !found && k < m_threads; k++) {
+		size_t victim = (thread + k) % m_threads;
+		pthread_mutex_lock(&m_Lock[victim]);
+		if (!m_Queue[victim].empty()) {
+			chunk = m_Queue[victim].back();
+			m_Queue[victim].pop_back();
+			found = true;
+			++m_Steals[thread];
+		}
+		pthread_mutex_unlock(&m_Lock[victim]);
+	}
+	return found;
+}
+
+void WorkStealing::work(size_t thread) {
+	size_t chunk;
+	while (pop(thread, chunk)) {
+		for (size_t k = m_Chunk[chunk].begin; k < m_Chunk[chunk].end; k++)
+			m_Task->run(thread, chunk, m_Order[k]);
+	}
+}
+
+/// Thread of WorkStealing
+class StealingThread : public ThreadTask {
+public:
+	WorkStealing *ws;
+	void run(size_t thread) { ws->work(thread); }
+};
+
+/** Run the task on the scheduled items.
+	@param task	task to be run for each item
+*/
+void WorkStealing::run(ItemTask& task) {
+	m_Task = &task;
+	m_Queue.assign(m_threads, deque<size_t>());
+	m_Steals.assign(m_threads, 0);
+	for (size_t c = 0; c < m_Chunk.size(); c++) 
+		m_Queue[m_Chunk[c].thread].push_back(c);
+	StealingThread thread;
+	thread.ws = this;
+	runThreads(thread, m_threads);
+}
+
+size_t WorkStealing::steals() {
+	size_t n = 0;
+	for (size_t t = 0; t < m_Steals.size(); t++)
+		n += m_Steals[t];
+	return n;
+}
+
+ProcessPool::ProcessPool(size_t max_jobs) {
+	m_max_jobs = (max_jobs > 0 ? max_jobs : 1);
+	m_memory_limit = 0.0;
+	m_memory_ratio = 0.0;
+	m_running_memory = 0.0;
+}
+
+/** Limit the total estimated memory of the running jobs.
+	A job is always run if no other job is running.
+	@param limit	memory limit in bytes (0 for no limit)
+	@param ratio	initial estimate of bytes per job size
+*/
+void ProcessPool::setMemoryLimit(size_t limit, double ratio) {
+	m_memory_limit = (double)limit;
+	m_memory_ratio = ratio;
+}
+
+ProcessPool::~ProcessPool() {
+	wait();
+}
+
+/** Run a job in a new worker process.
+	@param job	job to be run (its state is copied to the child at this point)
+	@param size	size of the job for the memory estimation
+	@return job index
+*/
+size_t ProcessPool::submit(Job& job, double size) {
+	while (m_running.size() >= m_max_jobs 
+		|| (m_memory_limit > 0 && !m_running.empty() && m_running_memory + size * m_memory_ratio > m_memory_limit))
+		reap();
+
+	int fd[2];
+	if (pipe(fd) < 0)
+		throw runtime_error("cannot create a pipe");
+
+	/// not to duplicate the buffered outputs
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0)
+		throw runtime_error("cannot fork a worker process");
+
+	if (pid == 0) {	///< child
+		close(fd[0]);
+		int status = 0;
+		try {
+			string result = job.run();
+			const char *p = result.data();
+			size_t left = result.size();
+			while (left > 0) {
+				ssize_t n = write(fd[1], p, left);
+				if (n < 0) {
+					if (errno == EINTR)
+						continue;
+					status = 1;
+					break;
+				}
+				p += n;
+				left -= n;
+			}
+		} catch (exception& e) {
+			cerr << "worker error: " << e.what() << endl;
+			status = 1;
+		}
+		close(fd[1]);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(status);		///< no destructors in the child
+	}
+
+	close(fd[1]);
+	Worker worker;
+	worker.index = m_result.size();
+	worker.fd = fd[0];
+	worker.memory = size * m_memory_ratio;
+	m_running[pid] = worker;
+	m_running_memory += worker.memory;
+	m_result.push_back("");
+	m_status.push_back(-1);
+	m_size.push_back(size);
+	m_peak.push_back(0);
+	return worker.index;
+}
+
+/** Collect the results until one of the running jobs finishes.
+	@return false if no job is running
+*/
+bool ProcessPool::reap() {
+	if (m_running.empty())
+		return false;
+
+	for (;;) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		int max_fd = -1;
+		map<pid_t, Worker>::iterator it = m_running.begin();
+		for (; it != m_running.end(); ++it) {
+			FD_SET(it->second.fd, &fds);
+			if (it->second.fd > max_fd)
+				max_fd = it->second.fd;
+		}
+		if (select(max_fd + 1, &fds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			throw runtime_error("cannot wait for worker processes");
+		}
+
+		for (it = m_running.begin(); it != m_running.end(); ++it) {
+			if (!FD_ISSET(it->second.fd, &fds))
+				continue;
+			char buf[4096];
+			ssize_t n = read(it->second.fd, buf, sizeof(buf));
+			if (n > 0) {
+				m_result[it->second.index].append(buf, n);
+			} else if (n == 0 || errno != EINTR) {	///< the worker closed the pipe
+				int status = 0;
+				struct rusage usage;
+				close(it->second.fd);
+				while (wait4(it->first, &status, 0, &usage) < 0 && errno == EINTR)
+					;
+				size_t index = it->second.index;
+				m_status[index] = (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+				m_peak[index] = (size_t)usage.ru_maxrss * 1024;	///< kilobytes in Linux
+				/// learning the memory estimation from the finished job
+				if (m_size[index] > 0 && m_peak[index] / m_size[index] > m_memory_ratio)
+					m_memory_ratio = m_peak[index] / m_size[index];
+				m_running_memory -= it->second.memory;
+				m_running.erase(it);
+				return true;
+			}
+		}
+	}
+}
+
+/** Wait for all the running jobs.
+*/
+void ProcessPool::wait() {
+	while (reap())
+		;
+}
+
+////////////////////////////////////////////////////////////////////////
+/// PreforkPool
+////////////////////////////////////////////////////////////////////////
+
+/// Write all the bytes (false on error)
+static bool writeAll(int fd, const void* data, size_t size) {
+	const char *p = (const char*)data;
+	size_t left = size;
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += n;
+		left -= n;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const string& data) {
+	return writeAll(fd, data.data(), data.size());
+}
+
+/// Read all the bytes (false on error or at the end)
+static bool readAll(int fd, void* data, size_t size) {
+	char *p = (char*)data;
+	size_t left = size;
+	while (left > 0) {
+		ssize_t n = read(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		left -= n;
+	}
+	return true;
+}
+
+size_t privateMemory() {
+	ifstream f("/proc/self/smaps_rollup");
+	string line;
+	size_t bytes = 0;
+	while (getline(f, line)) {
+		if (line.compare(0, 14, "Private_Clean:") == 0 || line.compare(0, 14, "Private_Dirty:") == 0)
+			bytes += (size_t)atol(line.c_str() + 14) * 1024;
+	}
+	return bytes;
+}
+
+/** Fork the workers.
+	@param handler	handler of the requests (run in the workers)
+	@param n_workers	number of workers
+*/
+PreforkPool::PreforkPool(RequestHandler& handler, size_t n_workers) {
+	m_Handler = &handler;
+	m_restarts = 0;
+	m_failures = 0;
+	signal(SIGPIPE, SIG_IGN);	///< a dead worker is found by its result pipe
+	m_Worker.resize(n_workers > 0 ? n_workers : 1);
+	for (size_t w = 0; w < m_Worker.size(); w++) {
+		m_Worker[w].pid = -1;
+		m_Worker[w].request_fd = -1;
+		m_Worker[w].result_fd = -1;
+		start(w);
+	}
+}
+
+PreforkPool::~PreforkPool() {
+	shutdown();
+}
+
+void PreforkPool::start(size_t w) {
+	int request[2], result[2];
+	if (pipe(request) < 0 || pipe(result) < 0)
+		throw runtime_error("cannot create a pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0)
+		throw runtime_error("cannot fork a worker process");
+
+	if (pid == 0) {	///< child
+		/// the pipes of the other workers (so that they see the end of their requests)
+		for (size_t i = 0; i < m_Worker.size(); i++) {
+			if (m_Worker[i].request_fd >= 0)
+				close(m_Worker[i].request_fd);
+			if (m_Worker[i].result_fd >= 0)
+				close(m_Worker[i].result_fd);
+		}
+		close(request[1]);
+		close(result[0]);
+		work(request[0], result[1]);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(0);		///< no destructors in the child
+	}
+
+	close(request[0]);
+	close(result[1]);
+	Worker& worker = m_Worker[w];
+	worker.pid = pid;
+	worker.request_fd = request[1];
+	worker.result_fd = result[0];
+	worker.buffer = "";
+	worker.request = -1;
+}
+
+void PreforkPool::work(int request_fd, int result_fd) {
+	string buffer;
+	char buf[4096];
+	for (;;) {
+		size_t end = buffer.find('\n');
+		if (end == string::npos) {
+			ssize_t n = read(request_fd, buf, sizeof(buf));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;		///< no more requests
+			buffer.append(buf, n);
+			continue;
+		}
+		string request = buffer.substr(0, end);
+		buffer.erase(0, end + 1);
+
+		string result;
+		try {
+			result = m_Handler->handle(request);
+		} catch (exception& e) {
+			result = string("error ") + e.what();
+		}
+		replace(result.begin(), result.end(), '\n', ' ');
+		if (!writeAll(result_fd, result + "\n"))
+			break;
+	}
+	close(request_fd);
+	close(result_fd);
+}
+
+/** Serve the requests.
+	Each line of the input is a request, and each result is written as "index<TAB>request<TAB>result" 
+	(index: line number of the request from 0) in the order of completion.
+	@param in_fd	input of the requests
+	@param out	output of the results
+*/
+void PreforkPool::serve(int in_fd, FILE* out) {
+	string input;
+	bool eof = false;
+	char buf[4096];
+
+	for (;;) {
+		/// dispatching the pending requests to the idle workers
+		for (size_t w = 0; w < m_Worker.size() && !m_Pending.empty(); w++) {
+			Worker& worker = m_Worker[w];
+			if (worker.request >= 0)
+				continue;
+			size_t r = m_Pending.front();
+			m_Pending.pop_front();
+			worker.request = r;
+			m_Tries[r]++;
+			writeAll(worker.request_fd, m_Request[r] + "\n");	///< a dead worker is found below
+		}
+
+		bool busy = false, idle = false;
+		for (size_t w = 0; w < m_Worker.size(); w++) {
+			busy = busy || (m_Worker[w].request >= 0);
+			idle = idle || (m_Worker[w].request < 0);
+		}
+		if (eof && !busy && m_Pending.empty())
+			break;
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		int max_fd = -1;
+		if (!eof && idle && m_Pending.empty()) {	///< reading the requests only when they can be served
+			FD_SET(in_fd, &fds);
+			max_fd = in_fd;
+		}
+		for (size_t w = 0; w < m_Worker.size(); w++) {
+			FD_SET(m_Worker[w].result_fd, &fds);
+			max_fd = max(max_fd, m_Worker[w].result_fd);
+		}
+		if (select(max_fd + 1, &fds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			throw runtime_error("cannot wait for worker processes");
+		}
+
+		/// new requests
+		if (FD_ISSET(in_fd, &fds)) {
+			ssize_t n = read(in_fd, buf, sizeof(buf));
+			if (n > 0)
+				input.append(buf, n);
+			else if (n == 0 || errno != EINTR) {
+				eof = true;
+				if (input.size() > 0)
+					input += "\n";
+			}
+			size_t end;
+			while ((end = input.find('\n')) != string::npos) {
+				string request = input.substr(0, end);
+				input.erase(0, end + 1);
+				if (request.empty())
+					continue;
+				m_Pending.push_back(m_Request.size());
+				m_Request.push_back(request);
+				m_Tries.push_back(0);
+			}
+		}
+
+		/// results
+		for (size_t w = 0; w < m_Worker.size(); w++) {
+			Worker& worker = m_Worker[w];
+			if (!FD_ISSET(worker.result_fd, &fds))
+				continue;
+			ssize_t n = read(worker.result_fd, buf, sizeof(buf));
+			if (n > 0) {
+				worker.buffer.append(buf, n);
+				size_t end = worker.buffer.find('\n');
+				if (end != string::npos && worker.request >= 0) {
+					fprintf(out, "%ld\t%s\t%s\n", worker.request, m_Request[worker.request].c_str(), worker.buffer.substr(0, end).c_str());
+					fflush(out);
+					worker.buffer.erase(0, end + 1);
+					worker.request = -1;
+				}
+			} else if (n == 0 || errno != EINTR) {	///< the worker died
+				int status = 0;
+				close(worker.request_fd);
+				close(worker.result_fd);
+				worker.request_fd = worker.result_fd = -1;
+				while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+					;
+				cerr << "worker " << worker.pid << " died" << (WIFSIGNALED(status) ? " by a signal" : "") << ", restarting\n";
+				long r = worker.request;
+				if (r >= 0 && m_Tries[r] < 2) {
+					m_Pending.push_front(r);	///< retried once
+				} else if (r >= 0) {
+					fprintf(out, "%ld\t%s\tfailed (worker crashed)\n", r, m_Request[r].c_str());
+					fflush(out);
+					++m_failures;
+				}
+				++m_restarts;
+				start(w);
+			}
+		}
+	}
+}
+
+/** Stop the workers: they exit at the end of their request pipes.
+*/
+void PreforkPool::shutdown() {
+	for (size_t w = 0; w < m_Worker.size(); w++) {
+		if (m_Worker[w].request_fd >= 0)
+			close(m_Worker[w].request_fd);
+		m_Worker[w].request_fd = -1;
+	}
+	for (size_t w = 0; w < m_Worker.size(); w++) {
+		if (m_Worker[w].pid > 0) {
+			while (waitpid(m_Worker[w].pid, NULL, 0) < 0 && errno == EINTR)
+				;
+			close(m_Worker[w].result_fd);
+		}
+		m_Worker[w].pid = -1;
+		m_Worker[w].result_fd = -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+/// MixingPool
+////////////////////////////////////////////////////////////////////////
+
+/** Fork the workers.
+	@param task	epoch of a worker (run in the workers)
+	@param n_workers	number of workers (shards)
+	@param size	number of weights
+*/
+MixingPool::MixingPool(MixingTask& task, size_t n_workers, size_t size) {
+	m_Task = &task;
+	m_size = size;
+	m_bytes = 0.0;
+	signal(SIGPIPE, SIG_IGN);	///< a dead worker is found by its socket
+	m_workers = (n_workers > 0 ? n_workers : 1);
+	for (size_t w = 0; w < m_workers; w++) {
+		int fd[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+			throw runtime_error("cannot create a socket pair");
+
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid < 0)
+			throw runtime_error("cannot fork a worker process");
+
+		if (pid == 0) {	///< child
+			for (size_t i = 0; i < m_Socket.size(); i++)
+				close(m_Socket[i]);
+			close(fd[0]);
+			work(w, fd[1]);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(0);		///< no destructors in the child
+		}
+		close(fd[1]);
+		m_Pid.push_back(pid);
+		m_Socket.push_back(fd[0]);
+	}
+}
+
+MixingPool::~MixingPool() {
+	shutdown();
+}
+
+/** Loop of a worker: an epoch for each weight vector received, until the end of the socket.
+	Message to a worker: iteration (unsigned long) and the weights.
+	Message from a worker: number of statistics (unsigned long), the statistics and the weights.
+*/
+void MixingPool::work(size_t worker, int fd) {
+	vector<double> weight(m_size);
+	unsigned long iter;
+	while (readAll(fd, &iter, sizeof(iter)) && readAll(fd, &weight[0], m_size * sizeof(double))) {
+		vector<double> stats = m_Task->epoch(worker, m_workers, iter, &weight[0]);
+		unsigned long n_stats = stats.size();
+		if (!writeAll(fd, &n_stats, sizeof(n_stats)) 
+			|| (n_stats > 0 && !writeAll(fd, &stats[0], n_stats * sizeof(double)))
+			|| !writeAll(fd, &weight[0], m_size * sizeof(double)))
+			break;
+	}
+	close(fd);
+}
+
+/** One epoch of the iterative parameter mixing.
+	@param iter	iteration
+	@param weight	weights sent to the workers, replaced by the (uniform) average of their results
+	@param stats	statistics summed over the workers
+	@return false if a worker failed
+*/
+bool MixingPool::mix(size_t iter, double* weight, vector<double>& stats) {
+	unsigned long it = iter;
+	for (size_t w = 0; w < m_Socket.size(); w++) {
+		if (!writeAll(m_Socket[w], &it, sizeof(it)) || !writeAll(m_Socket[w], weight, m_size * sizeof(double)))
+			return false;
+		m_bytes += sizeof(it) + m_size * sizeof(double);
+	}
+
+	vector<double> sum(m_size, 0.0), result(m_size);
+	stats.clear();
+	for (size_t w = 0; w < m_Socket.size(); w++) {
+		unsigned long n_stats;
+		if (!readAll(m_Socket[w], &n_stats, sizeof(n_stats)))
+			return false;
+		vector<double> worker_stats(n_stats);
+		if ((n_stats > 0 && !readAll(m_Socket[w], &worker_stats[0], n_stats * sizeof(double)))
+			|| !readAll(m_Socket[w], &result[0], m_size * sizeof(double)))
+			return false;
+		m_bytes += sizeof(n_stats) + (n_stats + m_size) * sizeof(double);
+		if (stats.size() < n_stats)
+			stats.resize(n_stats, 0.0);
+		for (size_t i = 0; i < n_stats; i++)
+			stats[i] += worker_stats[i];
+		for (size_t i = 0; i < m_size; i++)
+			sum[i] += result[i];
+	}
+	for (size_t i = 0; i < m_size; i++)
+		weight[i] = sum[i] / m_Socket.size();
+	return true;
+}
+
+/** Stop the workers: they exit at the end of their sockets.
+*/
+void MixingPool::shutdown() {
+	for (size_t w = 0; w < m_Socket.size(); w++)
+		close(m_Socket[w]);
+	m_Socket.clear();
+	for (size_t w = 0; w < m_Pid.size(); w++) {
+		while (waitpid(m_Pid[w], NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+	m_Pid.clear();
+}
+
+} // namespace tricrf
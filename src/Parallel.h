@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+/// standard headers
+#include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <cstdio>
+#include <sys/types.h>
+#include <pthread.h>
+
+namespace tricrf {
+
+/// Number of online processors
+size_t numProcessors();
+/// Available physical memory in bytes
+size_t availableMemory();
+
+/** A task run by a group of threads.
+	@class ThreadTask
+*/
+class ThreadTask {
+public:
+	virtual ~ThreadTask() {}
+	/// Runs in each thread; thread is from 0 to the number of threads - 1.
+	virtual void run(size_t thread) = 0;
+};
+
+/// Run a task on the given number of threads (the calling thread is the thread 0) and wait for all of them
+void runThreads(ThreadTask& task, size_t n_threads);
+
+/** A task over the items scheduled by WorkStealing.
+	@class ItemTask
+*/
+class ItemTask {
+public:
+	virtual ~ItemTask() {}
+	virtual void run(size_t thread, size_t chunk, size_t item) = 0;
+};
+
+/** Work-stealing scheduler for items of varying cost (e.g. sequences of different lengths).
+	The items are sorted by their estimated cost (longest first) and grouped into chunks of about
+	the same cost, so the long items make chunks of their own and the short ones are batched.
+	The chunks are dealt to per-thread deques (each to the least loaded thread), a thread takes
+	the chunks from the front of its own deque, and an idle thread steals from the back of the others,
+	so that no thread waits at the end while another still has a tail of work.
+	The chunks (and the order of the items in a chunk) do not depend on the number of threads
+	if the number of chunks is given, so per-chunk results can be reduced deterministically.
+	@class WorkStealing
+*/
+class WorkStealing {
+private:
+	struct Chunk {
+		size_t begin, end;	///< range of m_Order
+		size_t thread;		///< initial owner
+	};
+	std::vector<size_t> m_Order;	///< items, longest first
+	std::vector<Chunk> m_Chunk;
+	size_t m_threads;
+
+	/// per-thread deques of the chunks
+	std::vector<std::deque<size_t> > m_Queue;
+	pthread_mutex_t *m_Lock;
+	std::vector<size_t> m_Steals;
+	ItemTask *m_Task;
+
+	bool pop(size_t thread, size_t& chunk);
+	void work(size_t thread);
+	friend class StealingThread;
+	WorkStealing(const WorkStealing&);
+	WorkStealing& operator=(const WorkStealing&);
+
+public:
+	WorkStealing();
+	~WorkStealing();
+	void schedule(const std::vector<double>& cost, size_t n_threads, size_t chunks_per_thread = 8, size_t n_chunks = 0);	///< Make the chunks
+	void run(ItemTask& task);	///< Run the task on every item (with zero cost items skipped)
+	size_t threads() { return m_threads; };
+	size_t chunks() { return m_Chunk.size(); };
+	size_t steals();	///< number of chunks stolen in the last run
+};
+
+/** A unit of work for ProcessPool.
+	@class Job
+*/
+class Job {
+public:
+	virtual ~Job() {}
+	/// Runs in the worker process; the returned text is sent back to the parent.
+	virtual std::string run() = 0;
+};
+
+/** Fork-based worker pool.
+	Each job runs in a child process which shares the memory of the parent (e.g. the loaded corpus
+	and dictionaries) copy-on-write, so a job may freely modify the model it inherits.
+	Optionally, the number of running jobs is also limited by their estimated memory: a job of a
+	given size (e.g. bytes of its input file) is assumed to need size * ratio bytes, where the ratio
+	is updated from the peak memory of the finished jobs.
+	@class ProcessPool
+*/
+class ProcessPool {
+private:
+	struct Worker {
+		size_t index;		///< job index
+		int fd;				///< read end of the result pipe
+		double memory;	///< estimated memory
+	};
+	size_t m_max_jobs;
+	std::map<pid_t, Worker> m_running;
+	std::vector<std::string> m_result;
+	std::vector<int> m_status;
+	std::vector<double> m_size;
+	std::vector<size_t> m_peak;
+
+	/// Memory limit
+	double m_memory_limit;		///< bytes (0 for no limit)
+	double m_memory_ratio;		///< estimated bytes per job size
+	double m_running_memory;
+
+	bool reap();	///< Wait for one of the running jobs
+
+public:
+	ProcessPool(size_t max_jobs = 1);
+	~ProcessPool();
+
+	void setMemoryLimit(size_t limit, double ratio);
+	size_t submit(Job& job, double size = 0.0);	///< Run a job (blocks while the pool is full) and return its index
+	void wait();					///< Wait for all the jobs
+	size_t size() { return m_result.size(); };
+	bool succeeded(size_t i) { return m_status[i] == 0; };
+	const std::string& result(size_t i) { return m_result[i]; };
+	size_t peakMemory(size_t i) { return m_peak[i]; };	///< peak resident memory of a finished job (bytes)
+};
+
+/** A request handler for PreforkPool.
+	@class RequestHandler
+*/
+class RequestHandler {
+public:
+	virtual ~RequestHandler() {}
+	/// Runs in a worker process; the result is sent back to the parent as a line.
+	virtual std::string handle(const std::string& request) = 0;
+};
+
+/** Prefork worker pool.
+	The workers are forked once (e.g. after the model is loaded, so that they share the memory of 
+	the parent rather than loading their own copies) and serve the requests one at a time.
+	A worker which dies (e.g. crashes) is restarted from the parent, and its request is retried once.
+	@class PreforkPool
+*/
+class PreforkPool {
+private:
+	struct Worker {
+		pid_t pid;
+		int request_fd;		///< write end of the request pipe
+		int result_fd;		///< read end of the result pipe
+		std::string buffer;	///< result being read
+		long request;		///< request in progress (-1 if idle)
+	};
+	RequestHandler *m_Handler;
+	std::vector<Worker> m_Worker;
+	std::vector<std::string> m_Request;
+	std::vector<size_t> m_Tries;
+	std::deque<size_t> m_Pending;
+	size_t m_restarts;
+	size_t m_failures;
+
+	void start(size_t w);	///< Fork (or restart) a worker
+	void work(int request_fd, int result_fd);	///< Loop of a worker process
+	PreforkPool(const PreforkPool&);
+	PreforkPool& operator=(const PreforkPool&);
+
+public:
+	PreforkPool(RequestHandler& handler, size_t n_workers);
+	~PreforkPool();
+	void serve(int in_fd, FILE* out);	///< Serve the requests (lines of in_fd) until its end
+	void shutdown();	///< Stop the workers
+	size_t restarts() { return m_restarts; };
+	size_t failures() { return m_failures; };
+	size_t requests() { return m_Request.size(); };
+};
+
+/** An epoch of a worker of MixingPool.
+	@class MixingTask
+*/
+class MixingTask {
+public:
+	virtual ~MixingTask() {}
+	/// Runs in a worker process: an online epoch over the shard of the worker, updating the weights in place.
+	/// The returned statistics (e.g. training errors) are summed over the workers.
+	virtual std::vector<double> epoch(size_t worker, size_t n_workers, size_t iter, double* weight) = 0;
+};
+
+/** Iterative parameter mixing (McDonald et al., 2010) over local sockets.
+	The workers are forked once (sharing the training data of the parent copy-on-write), each connected
+	to the parent by a Unix domain socket pair. In each epoch the parent sends the weights to every worker,
+	each worker runs an online epoch over its shard, and the parent averages the weights sent back.
+	So the weights make one round trip per epoch, instead of one per evaluation of the gradient.
+	@class MixingPool
+*/
+class MixingPool {
+private:
+	MixingTask *m_Task;
+	size_t m_size;		///< number of weights
+	size_t m_workers;
+	std::vector<pid_t> m_Pid;
+	std::vector<int> m_Socket;
+	double m_bytes;
+	void work(size_t worker, int fd);	///< Loop of a worker process
+	MixingPool(const MixingPool&);
+	MixingPool& operator=(const MixingPool&);
+
+public:
+	MixingPool(MixingTask& task, size_t n_workers, size_t size);
+	~MixingPool();
+	bool mix(size_t iter, double* weight, std::vector<double>& stats);	///< One epoch: the weights are replaced by the average of the workers
+	void shutdown();	///< Stop the workers
+	size_t workers() { return m_workers; };
+	double bytes() { return m_bytes; };	///< bytes sent and received by the parent
+};
+
+/// Private (not shared) memory of this process in bytes
+size_t privateMemory();
+
+} // namespace tricrf
+
+#endif
@@ -8,6 +8,7 @@
 /// max header
 #include "Param.h"
 #include "Utility.h"
+#include "Parallel.h"
 /// standard headers
 #include <cassert>
 #include <cfloat>
@@ -17,6 +18,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <sys/mman.h>
 
 using namespace std;
 
@@ -26,6 +28,8 @@ namespace tricrf {
 */
 Parameter::Parameter() {
 	mEDGE = "@";
+	m_SharedWeight = NULL;
+	m_SharedBytes = 0;
 	clear();
 }
 
@@ -56,6 +60,11 @@ void Parameter::clear(bool state) {
 	m_FeatureMap.clear();
 	m_FeatureVec.clear();
 	//m_StateID.clear();
+	if (m_SharedWeight != NULL) {
+		munmap(m_SharedWeight, m_SharedBytes);
+		m_SharedWeight = NULL;
+		m_SharedBytes = 0;
+	}
 	m_Count.clear();
 	m_Weight.clear();
 	m_Gradient.clear();
@@ -92,7 +101,29 @@ void Parameter::initializeGradient2() {
 	@warning	The size of weight vector should be larger than 1.
 */
 double* Parameter::getWeight() { 
-	return &m_Weight[0]; 
+	return (m_SharedWeight != NULL ? m_SharedWeight : &m_Weight[0]); 
+}
+
+/** Move the weight vector into a read-only shared memory segment.
+	The processes forked afterwards (e.g. decoding workers) map the same physical pages,
+	and a write to the weights faults instead of copying them.
+	The segment is unmapped by clear() (not by the destructor, since the parameters may be copied).
+	@return size of the segment in bytes
+*/
+size_t Parameter::shareWeights() {
+	if (m_SharedWeight != NULL)
+		return m_SharedBytes;
+	size_t bytes = (n_weight > 0 ? n_weight : 1) * sizeof(double);
+	void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		throw runtime_error("cannot map the shared weights");
+	if (n_weight > 0)
+		copy(m_Weight.begin(), m_Weight.begin() + n_weight, (double*)p);
+	mprotect(p, bytes, PROT_READ);
+	m_SharedWeight = (double*)p;
+	m_SharedBytes = bytes;
+	HugeVector().swap(m_Weight);	///< the private copy is freed
+	return bytes;
 }
 
 void Parameter::setWeight(double* theta) {
@@ -286,8 +317,29 @@ size_t Parameter::updateParam(size_t oid, size_t pid, double fval) {
 	return n_weight;
 }
 
+/** Reset the empirical feature counts (to be recounted by addCount).
+*/
+void Parameter::clearCount() {
+	fill(m_Count.begin(), m_Count.end(), 0.0);
+}
+
+/** Add to the empirical count of an existing parameter.
+	Unlike updateParam, it does not create new parameters.
+*/
+void Parameter::addCount(size_t oid, size_t pid, double fval) {
+	if (pid >= m_ParamIndex.size())
+		return;
+	vector<pair<size_t, size_t> >& param = m_ParamIndex[pid];
+	for (size_t i = 0; i < param.size(); i++) {
+		if (param[i].first == oid) {
+			m_Count[param[i].second] += fval;
+			break;
+		}
+	}
+}
+
 void Parameter::endUpdate() {
-	vector<double> tmp_Count = m_Count;
+	HugeVector tmp_Count = m_Count;
 	fill(m_Count.begin(), m_Count.end(), 0.0);
 
     size_t fid = 0;
@@ -302,6 +354,66 @@ void Parameter::endUpdate() {
 	assert(fid == n_weight);
 }
 
+/// Order of the features by decreasing frequency
+struct ByFrequency {
+	const vector<double>& freq;
+	ByFrequency(const vector<double>& f) : freq(f) {}
+	bool operator()(size_t a, size_t b) const { return freq[a] > freq[b]; }
+};
+
+/** Renumber the features by frequency.
+	The most frequent features (by the empirical count of their parameters) get the smallest ids,
+	and their parameters the first weights, so that the hot weights are packed in a few cache lines.
+	The ids of equally frequent features keep their order. Since the model is saved in the id order,
+	a saved model keeps the layout.
+	@return new id of each old feature id (to renumber the observations of the events)
+*/
+vector<size_t> Parameter::renumberByFrequency() {
+	size_t n_feature = m_ParamIndex.size();
+	if (m_FeatureVec.size() != n_feature)
+		throw runtime_error("inconsistent feature dictionary");
+	vector<double> freq(n_feature, 0.0);
+	for (size_t pid = 0; pid < n_feature; ++pid) {
+		vector<pair<size_t, size_t> >& param = m_ParamIndex[pid];
+		for (size_t j = 0; j < param.size(); ++j)
+			freq[pid] += m_Count[param[j].second];
+	}
+	vector<size_t> order(n_feature);
+	for (size_t pid = 0; pid < n_feature; ++pid)
+		order[pid] = pid;
+	stable_sort(order.begin(), order.end(), ByFrequency(freq));
+
+	/// features and parameters in the new order
+	vector<size_t> pid_map(n_feature);
+	Vec feature_vec(n_feature);
+	vector<vector<pair<size_t, size_t> >, HugePageAllocator<vector<pair<size_t, size_t> > > > param_index(n_feature);
+	HugeVector weight(m_Weight.size()), count(m_Count.size());
+	size_t fid = 0;
+	for (size_t i = 0; i < n_feature; ++i) {
+		size_t pid = order[i];
+		pid_map[pid] = i;
+		feature_vec[i].swap(m_FeatureVec[pid]);
+		m_FeatureMap[feature_vec[i]] = i;
+		param_index[i].swap(m_ParamIndex[pid]);
+		vector<pair<size_t, size_t> >& param = param_index[i];
+		for (size_t j = 0; j < param.size(); ++j) {
+			count[fid] = m_Count[param[j].second];
+			if (m_Weight.size() > 0)
+				weight[fid] = m_Weight[param[j].second];
+			param[j].second = fid;
+			fid++;
+		}
+	}
+	assert(fid == n_weight);
+	m_FeatureVec.swap(feature_vec);
+	m_ParamIndex.swap(param_index);
+	m_Count.swap(count);
+	m_Weight.swap(weight);
+	fill(m_Gradient.begin(), m_Gradient.end(), 0.0);
+
+	return pid_map;
+}
+
 size_t Parameter::getDefaultState() {
 	return m_default_oid;
 }
@@ -380,6 +492,49 @@ void Parameter::makeActiveIndex(double eta) {
 	}
 }
 
+/** Replace the parameters by the active ones of a full parameter set (feature induction).
+	The parameters are renumbered in the order of the index, and the state index is rebuilt.
+	@param index	full parameter index (feature -> (label, id in the full set))
+	@param active	whether each parameter of the full set is active
+	@param weight	weights of the full set
+	@param gradient	gradient of the full set
+	@param count	empirical counts of the full set
+	@return id in the full set of each active parameter
+*/
+vector<size_t> Parameter::setActive(const vector<vector<pair<size_t, size_t> > >& index, const vector<bool>& active, 
+		const double* weight, const double* gradient, const double* count) {
+	if (index.size() != m_ParamIndex.size())
+		throw runtime_error("inconsistent parameter index");
+	vector<size_t> id;
+	for (size_t pid = 0; pid < index.size(); ++pid) {
+		for (size_t j = 0; j < index[pid].size(); ++j) {
+			if (active[index[pid][j].second])
+				id.push_back(index[pid][j].second);
+		}
+	}
+	n_weight = id.size();
+	m_Weight.resize(n_weight);
+	m_Gradient.resize(n_weight);
+	m_Count.resize(n_weight);
+	size_t fid = 0;
+	for (size_t pid = 0; pid < index.size(); ++pid) {
+		vector<pair<size_t, size_t> >& param = m_ParamIndex[pid];
+		param.clear();
+		for (size_t j = 0; j < index[pid].size(); ++j) {
+			size_t g = index[pid][j].second;
+			if (!active[g])
+				continue;
+			param.push_back(make_pair(index[pid][j].first, fid));
+			m_Weight[fid] = weight[g];
+			m_Gradient[fid] = gradient[g];
+			m_Count[fid] = count[g];
+			fid++;
+		}
+	}
+	makeStateIndex();
+	return id;
+}
+
 vector<StateParam> Parameter::makeStateIndex(size_t y1) {
 	vector<StateParam> state_param; 
 	string fi = mEDGE + m_StateVec[y1];
@@ -507,7 +662,7 @@ bool Parameter::save(ofstream& f) {
     /// write the weight vector
     f   << "// Weight ; " << n_weight << endl;
     for (size_t i = 0; i < n_weight; ++i) {
-        f << m_Weight[i] << endl;	
+        f << (m_SharedWeight != NULL ? m_SharedWeight[i] : m_Weight[i]) << endl;	
 	}
 
 	return true;
@@ -595,13 +750,316 @@ bool Parameter::load(ifstream& f) {
 	return true;
 }
 
+/** Find the weight index of a parameter.
+	@param pid	feature id
+	@param oid	outcome id
+	@return weight index (-1 if not exist)
+*/
+int Parameter::findParam(size_t pid, size_t oid) {
+	if (pid >= m_ParamIndex.size())
+		return -1;
+	vector<pair<size_t, size_t> >& param = m_ParamIndex[pid];
+	for (size_t i = 0; i < param.size(); i++) {
+		if (param[i].first == oid)
+			return param[i].second;
+	}
+	return -1;
+}
+
+/** Save the delta of the parameters (this) from the base parameters.
+	The delta lists the new states, the new features and the new parameter index entries
+	(appended to the base ids), and the weights changed by more than the threshold.
+	The base states should keep their ids.
+	@param f	file stream
+	@param base	base parameters
+	@param threshold	minimum change of a weight to be listed
+	@param n_changed	number of the listed weights
+	@return false if the delta cannot be made
+*/
+bool Parameter::saveDelta(ofstream& f, Parameter& base, double threshold, size_t& n_changed) {
+	/// Errors
+	if (m_ParamIndex.size() != m_FeatureVec.size() || base.m_ParamIndex.size() != base.m_FeatureVec.size())
+		return false;
+	if (m_StateVec.size() < base.m_StateVec.size())
+		return false;
+	for (size_t i = 0; i < base.m_StateVec.size(); ++i) {
+		if (m_StateVec[i] != base.m_StateVec[i])
+			return false;
+	}
+
+	/// feature id in the patched parameters
+	size_t n_base = base.m_FeatureVec.size();
+	vector<size_t> new_feature;
+	vector<size_t> pid_map(m_FeatureVec.size());
+	for (size_t i = 0; i < m_FeatureVec.size(); ++i) {
+		Map::iterator it = base.m_FeatureMap.find(m_FeatureVec[i]);
+		if (it != base.m_FeatureMap.end()) {
+			pid_map[i] = it->second;
+		} else {
+			pid_map[i] = n_base + new_feature.size();
+			new_feature.push_back(i);
+		}
+	}
+
+	/// new parameter index entries and changed weights
+	vector<pair<size_t, vector<size_t> > > new_param;
+	vector<pair<pair<size_t, size_t>, double> > weight;
+	vector<bool> seen(base.n_weight, false);
+	for (size_t i = 0; i < m_ParamIndex.size(); ++i) {
+		vector<pair<size_t, size_t> >& param = m_ParamIndex[i];
+		vector<size_t> oid;
+		for (size_t j = 0; j < param.size(); ++j) {
+			double base_weight = 0.0;
+			int fid = base.findParam(pid_map[i], param[j].first);
+			if (fid >= 0) {
+				base_weight = base.m_Weight[fid];
+				seen[fid] = true;
+			} else
+				oid.push_back(param[j].first);
+			if (fabs(m_Weight[param[j].second] - base_weight) > threshold)
+				weight.push_back(make_pair(make_pair(pid_map[i], param[j].first), m_Weight[param[j].second]));
+		}
+		if (oid.size() > 0)
+			new_param.push_back(make_pair(pid_map[i], oid));
+	}
+	for (size_t i = 0; i < base.m_ParamIndex.size(); ++i) {	///< removed parameters (zero weight)
+		vector<pair<size_t, size_t> >& param = base.m_ParamIndex[i];
+		for (size_t j = 0; j < param.size(); ++j) {
+			if (!seen[param[j].second] && fabs(base.m_Weight[param[j].second]) > threshold)
+				weight.push_back(make_pair(make_pair(i, param[j].first), 0.0));
+		}
+	}
+
+	/// base
+	f << "// Base ; " << base.m_StateVec.size() << ' ' << n_base << ' ' << base.n_weight << endl;
+	/// state
+	f << "// State ; " << m_StateVec.size() - base.m_StateVec.size() << endl;
+	for (size_t i = base.m_StateVec.size(); i < m_StateVec.size(); ++i)
+		f << m_StateVec[i] << endl;
+	/// feature
+	f << "// Feature ; " << new_feature.size() << endl;
+	for (size_t i = 0; i < new_feature.size(); ++i)
+		f << m_FeatureVec[new_feature[i]] << endl;
+	/// parameter index (feature id, count, outcome ids)
+	f << "// Parameter ; " << new_param.size() << endl;
+	for (size_t i = 0; i < new_param.size(); ++i) {
+		f << new_param[i].first << ' ' << new_param[i].second.size();
+		for (size_t j = 0; j < new_param[i].second.size(); ++j)
+			f << ' ' << new_param[i].second[j];
+		f << endl;
+	}
+	/// weight (feature id, outcome id, weight)
+	f << "// Weight ; " << weight.size() << endl;
+	for (size_t i = 0; i < weight.size(); ++i)
+		f << weight[i].first.first << ' ' << weight[i].first.second << ' ' << weight[i].second << endl;
+
+	n_changed = weight.size();
+	return true;
+}
+
+/** Apply a delta (see saveDelta) to the parameters.
+	The state index should be made again.
+	@param f	file stream
+	@return false if the delta is not made from these parameters
+*/
+bool Parameter::loadDelta(ifstream& f) {
+	string line;
+	size_t count;
+
+	/// base
+	getline(f, line);
+	vector<string> tok = tokenize(line);
+	if (tok.size() < 6 || tok[1] != "Base") {
+		cerr << "delta error\n";
+		return false;
+	}
+	if ((size_t)atoi(tok[3].c_str()) != m_StateVec.size() || (size_t)atoi(tok[4].c_str()) != m_FeatureVec.size() 
+			|| (size_t)atoi(tok[5].c_str()) != n_weight) {
+		cerr << "delta of another base model\n";
+		return false;
+	}
+
+	/// state
+	getline(f, line);
+	tok = tokenize(line);
+	if (tok.size() < 4)
+		return false;
+	count = atoi(tok[3].c_str());
+	for (size_t i = 0; i < count; ++i) {
+		getline(f, line);
+		addNewState(line);
+	}
+
+	/// feature
+	getline(f, line);
+	tok = tokenize(line);
+	if (tok.size() < 4)
+		return false;
+	count = atoi(tok[3].c_str());
+	for (size_t i = 0; i < count; ++i) {
+		getline(f, line);
+		size_t n_feature = m_FeatureVec.size();
+		if (addNewObs(line) != n_feature)
+			return false;
+	}
+	m_ParamIndex.resize(m_FeatureVec.size());
+
+	/// parameter index (appended, and then the weights are renumbered as in endUpdate)
+	getline(f, line);
+	tok = tokenize(line);
+	if (tok.size() < 4)
+		return false;
+	count = atoi(tok[3].c_str());
+	for (size_t i = 0; i < count; ++i) {
+		getline(f, line);
+		tok = tokenize(line);
+		if (tok.size() < 2 || (size_t)atoi(tok[0].c_str()) >= m_ParamIndex.size())
+			return false;
+		vector<pair<size_t, size_t> >& param = m_ParamIndex[atoi(tok[0].c_str())];
+		for (size_t j = 2; j < tok.size(); ++j)
+			param.push_back(make_pair((size_t)atoi(tok[j].c_str()), n_weight++));
+		sort(param.begin(), param.end());
+	}
+	m_Weight.resize(n_weight, 0.0);
+	HugeVector tmp_Weight = m_Weight;
+	size_t fid = 0;
+	for (size_t i = 0; i < m_ParamIndex.size(); ++i) {
+		vector<pair<size_t, size_t> >& param = m_ParamIndex[i];
+		for (size_t j = 0; j < param.size(); ++j) {
+			m_Weight[fid] = tmp_Weight[param[j].second];
+			param[j].second = fid;
+			fid++;
+		}
+	}
+	assert(fid == n_weight);
+
+	/// weight
+	getline(f, line);
+	tok = tokenize(line);
+	if (tok.size() < 4)
+		return false;
+	count = atoi(tok[3].c_str());
+	for (size_t i = 0; i < count; ++i) {
+		getline(f, line);
+		tok = tokenize(line);
+		if (tok.size() < 3)
+			return false;
+		int fid = findParam(atoi(tok[0].c_str()), atoi(tok[1].c_str()));
+		if (fid < 0)
+			return false;
+		m_Weight[fid] = atof(tok[2].c_str());
+	}
+
+	/// setting
+	m_Gradient.assign(n_weight, 0.0);
+	m_Count.assign(n_weight, 0.0);
+	m_StateIndex.clear();
+	m_SelectedStateList1.clear();
+	m_SelectedStateList2.clear();
+
+	return true;
+}
+
 /** Print the information.
 */
 void Parameter::print(Logger *log) {
 	//log->report("[Parameters]\n");
 	log->report("  # of States = \t%d\n", m_StateVec.size());
 	log->report("  # of Features = \t%d\n", m_FeatureVec.size());
-	log->report("  # of Parameters = \t%d\n\n", n_weight);
+	log->report("  # of Parameters = \t%d\n", n_weight);
+	if (useHugePages())
+		log->report("  Huge pages = \t\t%s\n", hugePageReport().c_str());
+	log->report("\n");
+}
+
+////////////////////////////////////////////////////////////////////////
+/// GradientBuffer
+////////////////////////////////////////////////////////////////////////
+
+GradientBuffer::GradientBuffer(size_t size) {
+	m_Block.resize((size + BLOCK_SIZE - 1) / BLOCK_SIZE, NULL);
+}
+
+GradientBuffer::~GradientBuffer() {
+	for (size_t i = 0; i < m_Touched.size(); i++)
+		delete [] m_Block[m_Touched[i]];
+	for (size_t i = 0; i < m_Free.size(); i++)
+		delete [] m_Free[i];
+}
+
+void GradientBuffer::touch(size_t b) {
+	if (m_Free.empty()) {
+		m_Block[b] = new double[BLOCK_SIZE];
+		fill(m_Block[b], m_Block[b] + BLOCK_SIZE, 0.0);
+	} else {
+		m_Block[b] = m_Free.back();
+		m_Free.pop_back();
+	}
+	m_Touched.push_back(b);
+}
+
+void GradientBuffer::clear() {
+	for (size_t i = 0; i < m_Touched.size(); i++) {
+		double *block = m_Block[m_Touched[i]];
+		fill(block, block + BLOCK_SIZE, 0.0);
+		m_Free.push_back(block);
+		m_Block[m_Touched[i]] = NULL;
+	}
+	m_Touched.clear();
+}
+
+/// Reduction of the per-thread buffers over a share of the touched blocks
+class ReduceTask : public ThreadTask {
+public:
+	vector<GradientBuffer*>* buffers;
+	vector<size_t> blocks;
+	double* gradient;
+	size_t size;
+	size_t n_threads;
+
+	void run(size_t thread) {
+		size_t begin = blocks.size() * thread / n_threads;
+		size_t end = blocks.size() * (thread + 1) / n_threads;
+		for (size_t k = begin; k < end; k++) {
+			size_t offset = blocks[k] * GradientBuffer::BLOCK_SIZE;
+			size_t n = min(GradientBuffer::BLOCK_SIZE, size - offset);
+			/// in the order of the buffers
+			for (size_t t = 0; t < buffers->size(); t++) {
+				const double *block = (*buffers)[t]->block(blocks[k]);
+				if (block == NULL)
+					continue;
+				for (size_t i = 0; i < n; i++)
+					gradient[offset + i] += block[i];
+			}
+		}
+	}
+};
+
+/** Add the sums of the per-thread buffers to the gradient.
+	Only the blocks touched by any of the buffers are processed (with multiple threads),
+	and each element is summed in the order of the buffers, so the result is deterministic.
+	@param buffers	per-thread buffers
+	@param gradient	gradient vector
+	@param size	size of the gradient vector
+	@param n_threads	number of threads for the reduction
+*/
+void reduceGradient(vector<GradientBuffer*>& buffers, double* gradient, size_t size, size_t n_threads) {
+	ReduceTask task;
+	vector<bool> touched((size + GradientBuffer::BLOCK_SIZE - 1) / GradientBuffer::BLOCK_SIZE, false);
+	for (size_t t = 0; t < buffers.size(); t++) {
+		const vector<size_t>& blocks = buffers[t]->touched();
+		for (size_t i = 0; i < blocks.size(); i++) 
+			touched[blocks[i]] = true;
+	}
+	for (size_t b = 0; b < touched.size(); b++) {
+		if (touched[b])
+			task.blocks.push_back(b);
+	}
+	task.buffers = &buffers;
+	task.gradient = gradient;
+	task.size = size;
+	task.n_threads = max((size_t)1, min(n_threads, task.blocks.size()));
+	runThreads(task, task.n_threads);
 }
 
 }	// namespace tricrf
@@ -10,6 +10,7 @@
 
 /// max headers
 #include "Utility.h"
+#include "HugePage.h"
 /// standard headers
 #include <vector>
 #include <string>
@@ -47,9 +48,11 @@ class Parameter {
 protected:
 	/// Weight
 	size_t n_weight;
-	std::vector<double> m_Weight;
-	std::vector<double> m_Gradient;
-	std::vector<double> m_Count;
+	HugeVector m_Weight;
+	HugeVector m_Gradient;
+	HugeVector m_Count;
+	double *m_SharedWeight;		///< read-only shared weights (see shareWeights)
+	size_t m_SharedBytes;
 	
 	/// Dictionary
 	Map m_FeatureMap;
@@ -58,6 +61,9 @@ protected:
 	Vec m_StateVec;
 	
 
+	/// Parameter lookup (-1 if not exist)
+	int findParam(size_t pid, size_t oid);
+
 	/// Options
 	std::string mEDGE;
 	size_t m_default_oid;
@@ -70,7 +76,7 @@ public:
 	~Parameter();
 
 	/// Parameter index
-	std::vector<std::vector<std::pair<size_t, size_t> > > m_ParamIndex;
+	std::vector<std::vector<std::pair<size_t, size_t> >, HugePageAllocator<std::vector<std::pair<size_t, size_t> > > > m_ParamIndex;
 
 	/// weight vector
 	void initialize();
@@ -83,6 +89,7 @@ public:
 	double* getWeight();
 	double* getGradient();
 	void setWeight(double* theta);
+	size_t shareWeights();	///< Move the weights into a read-only shared segment (for the forked workers)
 
 	std::vector<StateParam> m_StateIndex;
 	std::vector<ObsParam> makeObsIndex(std::vector<std::pair<size_t, double> >& obs);
@@ -102,10 +109,16 @@ public:
 	size_t addNewState(const std::string& key);
 	size_t addNewObs(const std::string& key);
 	size_t updateParam(size_t oid, size_t pid,  double fval = 1.0);
+	void clearCount();
+	void addCount(size_t oid, size_t pid, double fval);
 	void endUpdate();
+	std::vector<size_t> renumberByFrequency();	///< Renumber the features by frequency (for the locality)
 	void makeStateIndex(bool makeIndex = true);
 	std::vector<StateParam> makeStateIndex(size_t y1);
 	void makeActiveIndex(double eta = 1E-02);
+	const double* getCount() { return &m_Count[0]; };
+	std::vector<size_t> setActive(const std::vector<std::vector<std::pair<size_t, size_t> > >& index, const std::vector<bool>& active, 
+		const double* weight, const double* gradient, const double* count);	///< Keep only the active parameters (see Grafting)
 
 	// for tied potential
 	std::vector<StateParam> m_SelectedStateIndex;
@@ -119,11 +132,62 @@ public:
 	/// save and load
 	bool save(std::ofstream& f);
 	bool load(std::ifstream& f);
+	bool saveDelta(std::ofstream& f, Parameter& base, double threshold, size_t& n_changed);	///< Delta from the base (to this)
+	bool loadDelta(std::ifstream& f);	///< Apply a delta
 
 	/// Reporting
 	void print(Logger *log);
 };
 
+/** Per-thread gradient accumulator.
+	The parameters are split into blocks, and only the blocks touched by the thread are allocated,
+	so that the memory and the reduction cost follow the features seen in the shard of the thread
+	rather than the number of parameters.
+	@class GradientBuffer
+*/
+class GradientBuffer {
+private:
+	std::vector<double*> m_Block;		///< NULL for the untouched blocks
+	std::vector<size_t> m_Touched;		///< touched blocks
+	std::vector<double*> m_Free;		///< allocated blocks not in use (zeroed)
+
+	void touch(size_t b);
+	GradientBuffer(const GradientBuffer&);
+	GradientBuffer& operator=(const GradientBuffer&);
+
+public:
+	static const size_t BLOCK_BITS = 9;
+	static const size_t BLOCK_SIZE = 1 << BLOCK_BITS;
+
+	GradientBuffer(size_t size);
+	~GradientBuffer();
+	void clear();	///< Zero the touched blocks
+
+	inline void add(size_t i, long double val) {
+		size_t b = i >> BLOCK_BITS;
+		if (m_Block[b] == NULL)
+			touch(b);
+		m_Block[b][i & (BLOCK_SIZE - 1)] += val;
+	}
+	const std::vector<size_t>& touched() { return m_Touched; };
+	const double* block(size_t b) { return m_Block[b]; };
+	size_t allocated() { return (m_Touched.size() + m_Free.size()) * BLOCK_SIZE * sizeof(double); };
+	size_t blocks() { return m_Block.size(); };
+};
+
+/** Gradient sink adding straight into the gradient vector (the sequential training).
+	It has the add() of GradientBuffer, so that both can take the gradient of a sequence.
+	@class DirectGradient
+*/
+struct DirectGradient {
+	double* gradient;
+	DirectGradient(double* g) : gradient(g) {}
+	inline void add(size_t i, long double val) { gradient[i] += val; }
+};
+
+/// Add the sums of the per-thread buffers to the gradient, only over the touched blocks
+void reduceGradient(std::vector<GradientBuffer*>& buffers, double* gradient, size_t size, size_t n_threads);
+
 } // namespace tricrf
 
 #endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "TopicCache.h"
+
+using namespace std;
+
+namespace tricrf {
+
+/** Constructor.
+	@param margin	topics below the best / (prune threshold x margin) are dropped (0 for no cache)
+	@param refresh	every refresh-th iteration runs all the topics
+	@param max_mass	bound on the posterior mass dropped from a sequence
+*/
+TopicCache::TopicCache(double margin, size_t refresh, double max_mass) {
+	m_Margin = margin;
+	m_Refresh = refresh;
+	m_MaxMass = max_mass;
+	m_Full = true;
+	m_Restart = false;
+	m_WasApproximate = false;
+	m_ForceFull = false;
+	m_Readmitted = 0;
+	m_Topics = 0;
+	m_Skipped = 0;
+	m_Total = 0;
+	m_Cached = 0;
+	m_Mass = 0.0;
+	m_Drift = 0.0;
+}
+
+/** Start an iteration: every refresh-th one (and the first) is full, and so is the one after topics
+	were re-admitted. L-BFGS is to be restarted when the iteration drops topics and the previous one
+	did not (the first after a full iteration), or the other way around.
+	@param iter	iteration
+	@param n_seq	number of training sequences
+	@param n_topic	number of topics
+*/
+void TopicCache::begin(size_t iter, size_t n_seq, size_t n_topic) {
+	m_Topics = n_topic;
+	if (!enabled())
+		return;
+	if (m_Keep.size() != n_seq) {
+		m_Keep.assign(n_seq, vector<bool>());
+		m_Below.assign(n_seq, vector<bool>());
+		m_Off.assign(n_seq, false);
+	}
+	m_WasApproximate = approximate();
+	m_Full = (iter % m_Refresh == 0 || m_ForceFull);
+	m_ForceFull = false;
+	if (m_Full)
+		m_Cached = 0;
+	m_Restart = (approximate() != m_WasApproximate);
+}
+
+/** Topics of which the forward pass is run for a sequence.
+	@param n	index of the sequence
+	@return topics kept, or NULL for all
+*/
+const vector<bool>* TopicCache::topics(size_t n) {
+	m_Total += m_Topics;
+	if (!enabled() || m_Full || m_Keep[n].empty())
+		return NULL;
+	for (size_t z = 0; z < m_Keep[n].size(); z++) {
+		if (!m_Keep[n][z])
+			++m_Skipped;
+	}
+	return &m_Keep[n];
+}
+
+/** Record the topics of a sequence at a full iteration.
+	The least probable topics below the best / (prune x margin), here and at the previous full iteration,
+	are dropped while the dropped mass is within the bound.
+	@param n	index of the sequence
+	@param posterior	(posterior, topic) of all the topics, the most probable first
+	@param reference	reference topic (never dropped)
+	@param prune	prune threshold
+*/
+void TopicCache::update(size_t n, const vector<pair<long double, size_t> >& posterior, size_t reference, long double prune) {
+	if (!enabled() || !m_Full || posterior.empty() || m_Off[n])
+		return;
+	vector<bool>& keep = m_Keep[n];
+	if (!keep.empty()) {	///< the mass of the topics dropped so far
+		long double mass = 0.0;
+		for (size_t i = 0; i < posterior.size(); i++) {
+			if (!keep[posterior[i].second])
+				mass += posterior[i].first;
+		}
+		if (mass > m_Drift)
+			m_Drift = mass;
+		if (mass > m_MaxMass) {	///< over the bound: re-admit the topics, with no cache for the sequence
+			keep.clear();
+			m_Off[n] = true;
+			++m_Readmitted;
+			m_ForceFull = true;
+			return;
+		}
+	}
+
+	long double threshold = posterior[0].first / (prune * m_Margin);
+	vector<bool> below(m_Topics, false);
+	for (size_t i = 1; i < posterior.size(); i++)
+		below[posterior[i].second] = (posterior[i].first < threshold);
+	long double mass = 0.0;
+	keep.assign(m_Topics, true);
+	bool dropped = false;
+	for (size_t i = posterior.size(); i-- > 1; ) {
+		if (posterior[i].first >= threshold || mass + posterior[i].first > m_MaxMass)
+			break;
+		size_t z = posterior[i].second;
+		if (z == reference || m_Below[n].empty() || !m_Below[n][z])
+			continue;
+		keep[z] = false;
+		mass += posterior[i].first;
+		dropped = true;
+	}
+	m_Below[n].swap(below);
+	if (!dropped) {
+		keep.clear();
+		return;
+	}
+	++m_Cached;
+	if (mass > m_Mass)
+		m_Mass = mass;
+}
+
+/// Report the forward passes skipped and the dropped mass
+void TopicCache::report(Logger *logger) const {
+	if (!enabled())
+		return;
+	logger->report("[Topic cache]\n");
+	logger->report("  margin = \t\t%g (refresh every %d)\n", m_Margin, m_Refresh);
+	logger->report("  skipped = \t\t%d of %d topic forward passes (%.1f%%)\n", m_Skipped, m_Total, 
+		(m_Total > 0 ? 100.0 * m_Skipped / m_Total : 0.0));
+	logger->report("  cached sequences = \t%d (at the last full iteration)\n", m_Cached);
+	logger->report("  dropped mass = \t%Lg (max per sequence, bound %g)\n", m_Mass, m_MaxMass);
+	logger->report("  mass at refresh = \t%Lg (max per sequence)\n", m_Drift);
+	logger->report("  re-admitted = \t%d sequences (over the bound at refresh, no cache since)\n\n", m_Readmitted);
+}
+
+} // namespace tricrf
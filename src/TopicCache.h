@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __TOPICCACHE_H__
+#define __TOPICCACHE_H__
+
+/// max headers
+#include "Utility.h"
+/// standard headers
+#include <vector>
+#include <utility>
+
+namespace tricrf {
+
+/** Topics kept for the forward pass of each training sequence (TriCRF training).
+	At a full iteration, every topic is run, and the topics of a sequence far below the prune threshold
+	(by the margin) at this and the previous full iteration are dropped, as long as their posterior mass
+	is within the bound. In the following iterations, the forward pass of a dropped topic is skipped
+	(its alpha is zero), until the next full iteration, which also measures the current mass of the topics
+	dropped so far. A dropped topic gets no expected counts, so its weights are not held back; if the mass
+	of the dropped topics of a sequence exceeds the bound at a full iteration, they are re-admitted, the
+	cache is turned off for the sequence, and the next iteration is full as well. The reference topic is
+	never dropped. The objective changes with the dropped topics, so L-BFGS is restarted whenever an
+	iteration drops topics and the previous one did not, or the other way around.
+	@class TopicCache
+*/
+class TopicCache {
+	double m_Margin;			///< topics below the best / (prune threshold x margin) are dropped (0 for no cache)
+	size_t m_Refresh;			///< every m_Refresh-th iteration is full
+	double m_MaxMass;			///< bound on the posterior mass dropped from a sequence
+	bool m_Full;				///< the current iteration is full
+	size_t m_Topics;			///< number of topics
+	bool m_Restart;				///< the objective changed since the previous iteration
+	bool m_WasApproximate;		///< the previous iteration dropped some topics
+	bool m_ForceFull;			///< the next iteration is full (topics were re-admitted)
+	std::vector<bool> m_Off;	///< sequences whose dropped mass exceeded the bound (no cache)
+	size_t m_Readmitted;		///< sequences turned off
+	std::vector<std::vector<bool> > m_Keep;	///< topics kept for each sequence (empty for all)
+	std::vector<std::vector<bool> > m_Below;	///< topics below the threshold at the last full iteration
+	size_t m_Skipped, m_Total;	///< forward passes of topics skipped, and run or skipped
+	size_t m_Cached;			///< sequences with dropped topics (at the last full iteration)
+	long double m_Mass;			///< largest mass dropped at a full iteration
+	long double m_Drift;		///< largest mass of the dropped topics measured at the next full iteration
+
+public:
+	TopicCache(double margin = 0.0, size_t refresh = 0, double max_mass = 1E-06);
+	bool enabled() const { return m_Margin > 0.0 && m_Refresh > 1; };
+	void begin(size_t iter, size_t n_seq, size_t n_topic);	///< Start an iteration
+	const std::vector<bool>* topics(size_t n);	///< Topics to be run for a sequence (NULL for all)
+	bool approximate() const { return !m_Full && m_Cached > 0; };	///< Whether the current iteration drops some topics
+	bool restart() const { return m_Restart; };
+	void update(size_t n, const std::vector<std::pair<long double, size_t> >& posterior, size_t reference, long double prune);
+	void report(Logger *logger) const;
+};
+
+} // namespace tricrf
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+/// max headers
+#include "TriCRF.h"
+
+using namespace std;
+
+namespace tricrf {
+
+/** Constructor.
+*/
+TriCRF::TriCRF() {
+	m_topic_cache = 0.0;
+	m_topic_cache_refresh = 0;
+	m_topic_cache_mass = 0.0;
+	m_ForwardTopics = NULL;
+}
+
+/** Set the topic cache of the training (see TopicCache).
+	@param margin	topics below the best / (prune threshold x margin) skip the forward pass (0 for no cache)
+	@param refresh	every refresh-th iteration runs all the topics
+	@param max_mass	bound on the posterior mass dropped from a sequence
+*/
+void TriCRF::setTopicCache(double margin, size_t refresh, double max_mass) {
+	m_topic_cache = margin;
+	m_topic_cache_refresh = refresh;
+	m_topic_cache_mass = max_mass;
+}
+
+/// Report the coarse-to-fine search of the topic chains, and drop it
+void TriCRF::reportCoarse() {
+	CoarseToFine coarse(m_coarse_prune, m_coarse_exact);
+	for (size_t z = 0; z < m_Coarse.size(); z++)
+		coarse.merge(m_Coarse[z]);
+	coarse.report(logger);
+	m_Coarse.clear();
+}
+
+} // namespace tricrf
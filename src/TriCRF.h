@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2010 Minwoo Jeong (minwoo.j@gmail.com).
+ * This file is part of the "TriCRF" distribution.
+ * http://github.com/minwoo/TriCRF/
+ * This software is provided under the terms of Modified BSD license: see LICENSE for the detail.
+ */
+
+#ifndef __TRICRF_H__
+#define __TRICRF_H__
+
+/// max headers
+#include "CRF.h"
+#include "TopicCache.h"
+/// standard headers
+#include <vector>
+
+namespace tricrf {
+
+/** Common base of the triangular-chain models (TriCRF1, TriCRF2, TriCRF3).
+	It holds the state kept per topic, which the linear-chain CRF does not have.
+	@class TriCRF
+*/
+class TriCRF : public CRF {
+protected:
+	/// Topic cache of the training (see TopicCache)
+	double m_topic_cache;		///< margin below the prune threshold (0 for none)
+	size_t m_topic_cache_refresh;	///< every N-th iteration runs all the topics
+	double m_topic_cache_mass;	///< bound on the posterior mass dropped from a sequence
+	TopicCache m_TopicCache;
+	const std::vector<bool>* m_ForwardTopics;	///< topics run by the forward pass (NULL for all)
+
+	/// Coarse-to-fine decoding of each topic chain (made by test, see CoarseToFine)
+	std::vector<CoarseToFine> m_Coarse;
+	void reportCoarse();
+
+public:
+	TriCRF();
+
+	/// Training
+	void setTopicCache(double margin, size_t refresh, double max_mass);	///< Skip the forward pass of improbable topics in training
+};	///< TriCRF
+
+} // namespace tricrf
+
+#endif
@@ -10,6 +10,7 @@
 #include "Evaluator.h"
 #include "Utility.h"
 #include "LBFGS.h"
+#include "Chain.h"
 /// standard headers
 #include <cassert>
 #include <cfloat>
@@ -143,6 +144,7 @@ bool TriCRF1::loadModel(const std::string& filename) {
     string line;
     getline(f, line);
     while (line.empty() || line[0] == '#') {
+		readMetadata(count, line);
 		if (count == 1) {
 			vector<string> tok = tokenize(line);
 			if (tok.size() < 2 || tok[1] != "TriCRF1") {
@@ -183,8 +185,22 @@ bool TriCRF1::loadModel(const std::string& filename) {
 	f.close();
 	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
 
+	prepareInference();
+
+	return true;
+}
+
+vector<Parameter*> TriCRF1::paramSections() {
+	vector<Parameter*> param(1, &m_ParamTopic);
+	for (size_t i = 0; i < m_ParamSeq.size(); i++)
+		param.push_back(&m_ParamSeq[i]);
+	param.push_back(&m_Param);
+	return param;
+}
+
+void TriCRF1::prepareInference() {
 	m_topic_size = m_ParamTopic.sizeStateVec();
-	//m_Param.clear(true);
+	m_state_size.clear();
 
 	for (size_t i = 0; i < m_ParamTopic.sizeStateVec(); i++) {
 		m_ParamSeq[i].makeStateIndex();
@@ -193,23 +209,21 @@ bool TriCRF1::loadModel(const std::string& filename) {
 	//m_ParamTopic.makeStateIndex(false);
 	m_Param.makeStateIndex();
 
-	//m_state_size2 = m_Param.sizeStateVec();	
-	
-	return true;
+	//m_state_size2 = m_Param.sizeStateVec();
 }
 
-/**	Read the data from file
+/**	Read the data from a stream
 */
-void TriCRF1::readTrainData(const string& filename) {
+void TriCRF1::readTrainData(istream& in) {
 
 	m_Mapping.clear();
 	m_RMapping.clear();
 	
-	/// File stream
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 
 	size_t seq_count = 0;		
 	size_t topic_id = 0;
@@ -397,15 +411,15 @@ void TriCRF1::readTrainData(const string& filename) {
 
 }
 
-/**	Read the data from file
+/**	Read the data from a stream
 */
-void TriCRF1::readDevData(const string& filename) {
+void TriCRF1::readDevData(istream& in) {
 
-	/// File stream
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	
 	/// initializing
 	TriStringSequence triseq;
@@ -572,27 +586,12 @@ void TriCRF1::forward() {
 	m_Alpha.resize(m_topic_size);
 	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Alpha[z].resize(m_seq_size * m_state_size[z]);
-		fill(m_Alpha[z].begin(), m_Alpha[z].end(), 0.0);
-	}
-
-	for (size_t z = 0; z < m_topic_size; z++) {
-		for (size_t j = 0; j < m_state_size[z]; j++) {
-				m_Alpha[z][ZMAT2(z, 0, j)] += m_R[z][ZMAT2(z, 0, j)] * m_M[z][ZMAT2(z, m_default_oid, j)]; // * m_Z[MAT(z, m_RMapping[make_pair(z, j)])];
-		}
-	}
-
-	for (size_t z = 0; z < m_topic_size; z++) {
-		for (size_t i = 1; i < m_seq_size; i++) {
-			for (size_t j = 0; j < m_state_size[z]; j++) {
-				long double prob = m_R[z][ZMAT2(z, i, j)]; // * m_Z[MAT(z, m_RMapping[make_pair(z, j)])]; 
-				
-				if (prob > 0) {
-					for (size_t k = 0; k < m_state_size[z]; k++) {
-							m_Alpha[z][ZMAT2(z, i, j)] += m_Alpha[z][ZMAT2(z, i-1, k)] * m_M[z][ZMAT2(z, k, j)] * prob;
-					}
-				}
-			}
+		if (m_ForwardTopics != NULL && !(*m_ForwardTopics)[z]) {	///< dropped by the topic cache
+			fill(m_Alpha[z].begin(), m_Alpha[z].end(), 0.0);
+			continue;
 		}
+		DensePotential pot(&m_R[z][0], &m_M[z][0], m_state_size[z], &m_M[z][ZMAT2(z, m_default_oid, 0)]);
+		Chain<SumProduct>::forward(pot, m_seq_size, &m_Alpha[z][0]);
 	}
 }
 
@@ -604,27 +603,14 @@ void TriCRF1::backward() {
 	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Beta[z].resize(m_seq_size * m_state_size[z]);
 		fill(m_Beta[z].begin(), m_Beta[z].end(), 0.0);
-	}
-
-	/// initializing
-	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Beta[z][ZMAT2(z, m_seq_size-1, m_default_oid)] = 1.0;
 	}
 
 	///for (size_t z = 0; z < m_topic_size; z++) {
 	for (size_t prune = 0; prune < m_prune.size(); prune++) {
 		size_t z = m_prune[prune].second;
-
-	    for (size_t i = m_seq_size-1; i >= 1; i--) {
-		    for (size_t k = 0; k < m_state_size[z]; k++) {
-				long double prob = m_R[z][ZMAT2(z, i, k)]; // * m_Z[MAT(z, m_RMapping[make_pair(z, k)])];
-				if (prob > 0) {
-					for (size_t j = 0; j < m_state_size[z]; j++) {
-							m_Beta[z][ZMAT2(z, i-1, j)] += m_Beta[z][ZMAT2(z, i, k)] * m_M[z][ZMAT2(z, j, k)] * prob;
-					}
-				}
-            }
-        }
+		DensePotential pot(&m_R[z][0], &m_M[z][0], m_state_size[z], &m_M[z][ZMAT2(z, m_default_oid, 0)]);
+		Chain<SumProduct>::backward(pot, m_seq_size, m_default_oid, &m_Beta[z][0]);
     }
 }
 
@@ -687,58 +673,37 @@ vector<size_t> TriCRF1::viterbiSearch(size_t& max_z, long double& prob) {
 	long double max_prob = -10000.0;
 	max_z = m_default_oid;
 	vector<size_t> max_y;
-	vector<vector<size_t> > psi;
-    vector<vector<long double> > delta;
+	vector<size_t> psi;
+	vector<long double> delta;
 
 	/// Search
 	///for (size_t z = 0; z < m_topic_size; z++) {
 	for (size_t prune = 0; prune < m_prune.size(); prune++) {
 		size_t z = m_prune[prune].second;
 
-		delta.clear();
-		psi.clear();
-		for (size_t i=0; i < m_seq_size; i++) {
-			vector<size_t> psi_i;
-			vector<long double> delta_i;
-			for (size_t j=0; j < m_state_size[z]; j++) {
-				long double max = -10000.0;
-				size_t max_k = 0;
-				if (i == 0) {
-					max = m_R[z][ZMAT2(z, i, j)] * m_M[z][ZMAT2(z, m_default_oid, j)]; // * m_Z[MAT(z, m_RMapping[make_pair(z, j)])];
-					max_k = m_default_oid;
-				} else {
-					for (size_t k=0; k < m_state_size[z]; k++) {
-						double val = delta[i-1][k] * m_R[z][ZMAT2(z, i, j)] * m_M[z][ZMAT2(z, k, j)]; // * m_Z[MAT(z, m_RMapping[make_pair(z, j)])];
-						if (val > max) {
-							max = val;
-							max_k = k;
-						}
-					}
-				}
-
-				delta_i.push_back(max);
-				psi_i.push_back(max_k);
+		DensePotential pot(&m_R[z][0], &m_M[z][0], m_state_size[z], &m_M[z][ZMAT2(z, m_default_oid, 0)]);
+		vector<size_t> y_seq;
+		long double score;
+		if (z < m_Coarse.size() && m_Coarse[z].enabled() && m_Coarse[z].search(pot, m_seq_size, m_default_oid, m_default_oid, y_seq, score)) {
+			double tmp_prob = score * m_Gamma[z];	///< coarse-to-fine (see CoarseToFine)
+			if (tmp_prob > max_prob) {
+				max_prob = tmp_prob;
+				max_z = z;
+				y_seq.pop_back();
+				max_y = y_seq;
 			}
-			delta.push_back(delta_i);
-			psi.push_back(psi_i);
-
-		} ///< for each i
+			continue;
+		}
+		delta.resize(m_seq_size * m_state_size[z]);
+		psi.resize(m_seq_size * m_state_size[z]);
+		Chain<MaxProduct>::viterbi(pot, m_seq_size, &delta[0], &psi[0], m_default_oid);
 
 		/// Back-tracking
-		vector<size_t> y_seq;
-		size_t prev_y = m_default_oid;
-		for (size_t i = m_seq_size-1; i >= 1; i--) {
-			size_t y = psi[i][prev_y];
-			y_seq.push_back(y);
-			prev_y = y;
-		}
-		reverse(y_seq.begin(), y_seq.end());
-		double tmp_prob = delta[m_seq_size-1][m_default_oid] * m_Gamma[z];
-		
+		double tmp_prob = delta[ZMAT2(z, m_seq_size-1, m_default_oid)] * m_Gamma[z];
 		if (tmp_prob > max_prob) {
 			max_prob = tmp_prob;
 			max_z = z;
-			max_y = y_seq;
+			max_y = chainBacktrack(&psi[0], m_seq_size, m_state_size[z], m_default_oid);
 		}
 	} ///< for each z
 
@@ -747,6 +712,100 @@ vector<size_t> TriCRF1::viterbiSearch(size_t& max_z, long double& prob) {
 
 }
 
+/** Best path within the decoding budget (anytime decoding, see DecodeBudget).
+	Without a budget, it is the forward recursion, the topic pruning and the search over the remaining topics.
+	Otherwise the least probable topics are dropped, the topic is chosen by its own factor without
+	the forward recursion, or the labels are found greedily, whichever is predicted to fit the budget.
+	@param budget	decoding budget of the sequence
+	@param max_z	best topic
+	@return outcome sequence
+*/
+vector<size_t> TriCRF1::anytimeSearch(DecodeBudget& budget, size_t& max_z) {
+	/// work of the chain of each topic
+	vector<double> cells(m_topic_size);
+	double forward_cells = 0.0;
+	for (size_t z = 0; z < m_topic_size; z++) {
+		cells[z] = (double)m_seq_size * m_state_size[z] * m_state_size[z];
+		forward_cells += cells[z];
+	}
+	size_t best_z = max_element(m_Gamma.begin(), m_Gamma.end()) - m_Gamma.begin();
+
+	DecodeBudget::Level level;
+	if (budget.fits(forward_cells + cells[best_z])) {
+		wall_timer stop_watch;
+		forward();
+		getPartitionZ();
+		budget.measure(forward_cells, stop_watch.elapsed());
+
+		/// pruning
+		long double threshold = m_prune[0].first / m_prune_threshold;
+		vector<pair<long double, size_t> >::iterator pit = m_prune.begin();
+		for (; pit != m_prune.end(); pit++) {
+			if (pit->first < threshold) {
+				m_prune.erase(pit, m_prune.end());
+				break;
+			}
+		}
+
+		level = budget.trim(m_prune, cells);
+	} else {
+		/// topic by its own factor
+		m_prune.assign(1, make_pair((long double)1.0, best_z));
+		level = (budget.fits(cells[best_z]) ? DecodeBudget::TOPIC : DecodeBudget::GREEDY);
+	}
+
+	vector<size_t> y_seq;
+	long double prob;
+	if (level == DecodeBudget::GREEDY) {
+		max_z = m_prune[0].second;
+		y_seq = greedySearch(max_z, prob);
+	} else {
+		double search_cells = 0.0;
+		for (size_t i = 0; i < m_prune.size(); i++)
+			search_cells += cells[m_prune[i].second];
+		wall_timer stop_watch;
+		y_seq = viterbiSearch(max_z, prob);
+		budget.measure(search_cells, stop_watch.elapsed());
+	}
+	budget.finish(level);
+	return y_seq;
+}
+
+/** Greedy labeling of the chain of a topic (the cheapest fallback of anytime decoding).
+	@param z	topic
+	@param prob	unnormalized score of the path and the topic (comparable with that of viterbiSearch)
+	@return outcome sequence
+*/
+vector<size_t> TriCRF1::greedySearch(size_t z, long double& prob) {
+	DensePotential pot(&m_R[z][0], &m_M[z][0], m_state_size[z], &m_M[z][ZMAT2(z, m_default_oid, 0)]);
+	vector<size_t> y_seq(m_seq_size);
+	prob = Chain<MaxProduct>::greedy(pot, m_seq_size, &y_seq[0], m_default_oid) * m_Gamma[z];
+	y_seq.pop_back();
+	return y_seq;
+}
+
+/** Greedy decoding (MEMM-style): each topic is labeled greedily, without the forward recursion,
+	and the topic of the best path score is taken. The work is T x S per topic instead of T x S x S.
+	@param max_z	best topic
+	@param prob	unnormalized score of the path
+	@return outcome sequence
+*/
+vector<size_t> TriCRF1::greedyTopicSearch(size_t& max_z, long double& prob) {
+	prob = -1.0;
+	max_z = m_default_oid;
+	vector<size_t> max_y;
+	for (size_t z = 0; z < m_topic_size; z++) {
+		long double tmp_prob;
+		vector<size_t> y_seq = greedySearch(z, tmp_prob);
+		if (tmp_prob > prob) {
+			prob = tmp_prob;
+			max_z = z;
+			max_y.swap(y_seq);
+		}
+	}
+	return max_y;
+}
+
 
 /** Training with LBFGS optimizer.
 	@param max_iter	maximum number of iteration
@@ -804,6 +863,9 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		logger->report("  >>Parameters for %d plane\n", z);
 		m_ParamSeq[z].print(logger);
 	}
+	m_TopicCache = TopicCache(m_topic_cache, m_topic_cache_refresh, m_topic_cache_mass);
+	if (m_TopicCache.enabled())
+		logger->report("  Topic cache = \t%g x prune (refresh every %d, mass < %g)\n", m_topic_cache, m_topic_cache_refresh, m_topic_cache_mass);
 	logger->report("[Iterations]\n");
 	logger->report("%4s %15s %8s %8s %8s %8s\n", "iter", "loglikelihood", "acc", "micro-f1", "macro-f1", "sec");
 	
@@ -833,6 +895,7 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		double time_for_inference = 0.0;
 
 		calculateEdge();
+		m_TopicCache.begin(niter, m_TrainSet.size(), m_topic_size);
 
 		////////////////////////////////////////////////////////////////////////////
 		/// for each training set
@@ -842,14 +905,19 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		vector<vector<TriSequence> >::iterator label_it = m_TrainLabelSet.begin();
         for (; it != m_TrainSet.end(); ++it, ++count_it, ++label_it) {
 			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 			/// Forward-Backward  
 			timer stop_watch;
 			calculateFactors(*it);
 			time_for_factor += stop_watch.elapsed();
 			stop_watch.restart();
+			m_ForwardTopics = m_TopicCache.topics(it - m_TrainSet.begin());
   			forward();
+			m_ForwardTopics = NULL;
 			time_for_forward += stop_watch.elapsed();
 			long double zval = getPartitionZ();
+			m_TopicCache.update(it - m_TrainSet.begin(), m_prune, it->topic.label, m_prune_threshold);
 
 			////////////////////////////////////////////////////////////////////
 			/// pruning
@@ -1106,9 +1174,10 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		/// Checking the end condition 
 		////////////////////////////////////////////////////////////////////////////
 		double diff = (niter == 0 ? 1.0 : abs(old_obj - eval2.getObjFunc()) / old_obj);
-		if (diff < eta) 
-			converge++;
-		else
+		if (diff < eta) {
+			if (!m_TopicCache.approximate())	///< converged on the full objective only
+				converge++;
+		} else
 			converge = 0;
 		old_obj = eval2.getObjFunc();
 		if (converge == 3)
@@ -1117,11 +1186,15 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		////////////////////////////////////////////////////////////////////////////
 		/// LBFGS optimizer
 		////////////////////////////////////////////////////////////////////////////
+		if (m_TopicCache.restart())	///< the cached topics changed the objective
+			lbfgs.clear();
 		int ret = lbfgs.optimize(n_theta, theta, eval2.getObjFunc(), gradient, L1, sigma);
 		if (ret < 0)
 			return false;
-		else if (ret == 0)
+		else if (ret == 0) {
+			m_TopicCache.report(logger);
 			return true;
+		}
 
 		////////////////////////////////////////////////////////////////////////////
 		/// Reporting the results
@@ -1158,6 +1231,7 @@ bool TriCRF1::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		m_Param.setWeight(&theta[tmp_z]);
 
 	} ///< for iter
+	m_TopicCache.report(logger);
 	
 	delete theta;
 	delete gradient;
@@ -1253,6 +1327,8 @@ bool TriCRF1::estimateWithPL(size_t max_iter, double sigma, bool L1, double eta)
 		vector<vector<TriSequence> >::iterator label_it = m_TrainLabelSet.begin();
         for (; it != m_TrainSet.end(); ++it, ++count_it, ++label_it) {
 			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 
 			/////////////////////////////////////////////////////////////////////
 			/// PL for topic
@@ -1430,6 +1506,7 @@ bool TriCRF1::estimateWithPL(size_t max_iter, double sigma, bool L1, double eta)
 		Evaluator dev_eval2(m_Param);						///< Evaluator (sequence)
 		dev_eval1.initialize();										///< Evaluator intialization
 		dev_eval2.initialize();										
+		calculateEdge();	///< PL does not use the transition factors, but inference on the dev set does
 		
 		/// Timer for dev set evaluation
 		timer stop_watch;
@@ -1606,18 +1683,18 @@ bool TriCRF1::train(size_t max_iter, double sigma, bool L1) {
 	return estimateWithLBFGS(max_iter, sigma, L1); 
 }
 
-bool TriCRF1::test(const std::string& filename, const std::string& outputfile, bool confidence) {
-	/// File stream
+bool TriCRF1::test(istream& in, ostream* output, bool confidence) {
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 
 	/// output
-	ofstream out;
+	ostream null_out(NULL);
+	ostream& out = (output != NULL ? *output : null_out);
 	vector<string> state_vec;
-	if (outputfile != "") {
-		out.open(outputfile.c_str());
+	if (output != NULL) {
 		out.precision(20);
 		state_vec = m_ParamTopic.getState().second;
 	}
@@ -1642,38 +1719,53 @@ bool TriCRF1::test(const std::string& filename, const std::string& outputfile, b
 	size_t seq_count = 0;
 	
 	calculateEdge();
+	if (m_coarse_prune > 0.0) {
+		m_Coarse.assign(m_topic_size, CoarseToFine(m_coarse_prune, m_coarse_exact));
+		for (size_t z = 0; z < m_topic_size; z++) {
+			m_Coarse[z].build(m_ParamSeq[z].getState().second, m_coarse_map);
+			m_Coarse[z].bound(DensePotential(NULL, &m_M[z][0], m_state_size[z], &m_M[z][ZMAT2(z, m_default_oid, 0)]));
+		}
+	}
 	
+	DecodeBudget budget(m_decode_budget);
+	DecoderComparison compare(m_Param);
+
 	/// reading the text
 	while (getline(f,line)) {
 		vector<string> tokens = tokenize(line, " \t");
 		if (line.empty()) {
 			/// test
+			budget.start();
 			calculateFactors(triseq);
-  			forward();
-			long double zval = getPartitionZ();
-            long double dummy_prob;
-
-			////////////////////////////////////////////////////////////////////
-			/// pruning
-			////////////////////////////////////////////////////////////////////
-			long double threshold = m_prune[0].first / m_prune_threshold;
-			vector<pair<long double, size_t> >::iterator pit = m_prune.begin();
-			for (; pit != m_prune.end(); pit++) {
-				if (pit->first < threshold) {
-					m_prune.erase(pit, m_prune.end());
-					break;
+			size_t max_z, other_z = 0;
+			vector<size_t> y_seq, y_other;
+			double seconds[2] = { 0.0, 0.0 };	///< search time of the Viterbi and the greedy decoding
+			wall_timer search_watch;
+			if (m_greedy) {
+				long double prob;
+				y_seq = greedyTopicSearch(max_z, prob);
+				budget.finish(DecodeBudget::GREEDY);
+			} else
+				y_seq = anytimeSearch(budget, max_z);
+			assert(y_seq.size() == triseq.seq.size());
+			if (m_compare_decoders) {
+				seconds[m_greedy ? 1 : 0] = search_watch.elapsed();
+				wall_timer other_watch;
+				if (m_greedy) {
+					DecodeBudget unlimited;
+					y_other = anytimeSearch(unlimited, other_z);
+				} else {
+					long double prob;
+					y_other = greedyTopicSearch(other_z, prob);
 				}
+				seconds[m_greedy ? 0 : 1] = other_watch.elapsed();
 			}
 
-			size_t max_z;
-			vector<size_t> y_seq = viterbiSearch(max_z, dummy_prob);
-			assert(y_seq.size() == triseq.seq.size());
-
 			vector<size_t> reference1, hypothesis1;
 			reference1.push_back(triseq.topic.label);
 			hypothesis1.push_back(max_z);
 			test_eval1.append(reference1, hypothesis1);
-			if (outputfile != "") {
+			if (output != NULL) {
 				out << state_vec[max_z];
 				/*
 				if (confidence) {
@@ -1700,7 +1792,7 @@ bool TriCRF1::test(const std::string& filename, const std::string& outputfile, b
 				reference.push_back(outcome_s);
 				hypothesis.push_back(y_seq_s);
 
-				if (outputfile != "") {
+				if (output != NULL) {
 					out << y_seq_s;
 					/*
 					if (confidence) {
@@ -1715,10 +1807,17 @@ bool TriCRF1::test(const std::string& filename, const std::string& outputfile, b
 					out << endl; 
 				}
 			}
-			if (outputfile != "")
+			if (output != NULL)
 				out << endl;
 
 			test_eval2.append(m_Param, reference, hypothesis);
+			if (m_compare_decoders) {
+				vector<string> other;
+				for (size_t i = 0; i < y_other.size(); i++)
+					other.push_back(m_ParamSeq[other_z].getState().second[y_other[i]]);
+				compare.append(reference, m_greedy ? other : hypothesis, m_greedy ? hypothesis : other, seconds[0], seconds[1]);
+				compare.appendTopic(triseq.topic.label, m_greedy ? other_z : max_z, m_greedy ? max_z : other_z);
+			}
 			evals[triseq.topic.label].append(m_ParamSeq[triseq.topic.label], reference, hypothesis);		
 
 			triseq.seq.clear();
@@ -1744,6 +1843,10 @@ bool TriCRF1::test(const std::string& filename, const std::string& outputfile, b
 	
 	logger->report("  # of data = \t\t%d\n", count);
 	logger->report("  testing time = \t%.3f\n\n", stop_watch.elapsed());
+	budget.report(logger);
+	reportCoarse();
+	if (m_compare_decoders)
+		compare.report(logger);
 	logger->report("[Topic Classification]\n");
 	logger->report("  Acc = \t\t%8.3f\n", test_eval1.getAccuracy());
 	logger->report("  MicroF1 = \t\t%8.3f\n", test_eval1.getMicroF1()[2]);
@@ -1762,6 +1865,109 @@ bool TriCRF1::test(const std::string& filename, const std::string& outputfile, b
 		evals[i].Print(logger);
 	}
 	
+	return true;
+}
+
+/** Evaluate the current weights on the dev set.
+	@return topic accuracy, and accuracy and F1 scores of sequence labeling (zero if there is no dev data)
+*/
+Score TriCRF1::evaluateDev() {
+	Score score;
+	if (m_DevSet.size() == 0)
+		return score;
+
+	DecodeBudget budget;
+	calculateEdge();
+	Evaluator dev_eval1(m_ParamTopic, false);		///< Evaluator (topic)
+	Evaluator dev_eval2(m_Param);						///< Evaluator (sequence)
+	dev_eval1.initialize();
+	dev_eval2.initialize();
+	Data<TriStringSequence>::iterator it = m_DevSet.begin();
+	vector<double>::iterator count_it = m_DevSetCount.begin();
+	for (; it != m_DevSet.end(); ++it, ++count_it) {
+		calculateFactors(*it);
+		size_t max_z;
+		vector<size_t> y_seq = anytimeSearch(budget, max_z);	///< as in test, without a budget
+		assert(y_seq.size() == it->seq.size());
+
+		vector<string> reference, hypothesis;
+		for (size_t i = 0; i < it->seq.size(); ++i) {
+			size_t outcome = it->seq[i].label;
+			string outcome_s;
+			/// If there are non-attested labels in dev, test sets, then ...
+			if (m_ParamTopic.sizeStateVec() <= it->topic.label || m_ParamSeq[it->topic.label].sizeStateVec() <= outcome) 
+				outcome_s = m_Param.getState().second[m_default_oid];
+			else
+				outcome_s = m_ParamSeq[it->topic.label].getState().second[outcome];
+			reference.push_back(outcome_s);
+			hypothesis.push_back(m_ParamSeq[max_z].getState().second[y_seq[i]]);
+		}
+		vector<size_t> reference1, hypothesis1;
+		reference1.push_back(it->topic.label);
+		hypothesis1.push_back(max_z);
+		for (size_t c = 0; c < *count_it; c++) {
+			dev_eval2.append(m_Param, reference, hypothesis);
+			dev_eval1.append(reference1, hypothesis1);
+		}
+	}
+	dev_eval1.calculateF1();
+	dev_eval2.calculateF1();
+
+	score.topic_accuracy = dev_eval1.getAccuracy();
+	score.accuracy = dev_eval2.getAccuracy();
+	score.micro_f1 = dev_eval2.getMicroF1()[2];
+	score.macro_f1 = dev_eval2.getMacroF1()[2];
+	return score;
+}
+
+/** Hold out a part of the training data as the dev set (e.g. a cross-validation fold).
+	@param held_out	unique training sequences to be held out
+*/
+void TriCRF1::holdOut(const vector<bool>& held_out) {
+	holdOutData(m_TrainSet, m_TrainSetCount, held_out, m_DevSet, m_DevSetCount);
+	recount();
+}
+
+/** Recount the empirical feature counts of the training set.
+	@warning	Events do not keep the values of "feature:value" observations, so the label value is used.
+*/
+void TriCRF1::recount() {
+	m_ParamTopic.clearCount();
+	vector<vector<string> > states(m_topic_size);
+	for (size_t z = 0; z < m_topic_size; ++z) {
+		m_ParamSeq[z].clearCount();
+		states[z] = m_ParamSeq[z].getState().second;
+	}
+
+	for (size_t n = 0; n < m_TrainSet.size(); ++n) {
+		double count = m_TrainSetCount[n];
+		if (count == 0.0)
+			continue;
+		TriStringSequence& triseq = m_TrainSet[n];
+		/// topic features
+		vector<pair<size_t, double> >::iterator obs = triseq.topic.obs.begin();
+		for (; obs != triseq.topic.obs.end(); ++obs)
+			m_ParamTopic.addCount(triseq.topic.label, obs->first, triseq.topic.fval * count);
+
+		/// sequence features
+		size_t z = triseq.topic.label;
+		Parameter& param = m_ParamSeq[z];
+		for (size_t i = 0; i < triseq.seq.size(); ++i) {
+			StringEvent& ev = triseq.seq[i];
+			vector<pair<string, double> >::iterator sobs = ev.obs.begin();
+			for (; sobs != ev.obs.end(); ++sobs) {
+				int pid = param.findObs(sobs->first);
+				if (pid >= 0)
+					param.addCount(ev.label, pid, ev.fval * count);
+			}
+			if (i > 0) {	///< state transition features
+				const string prev = "@" + states[z][triseq.seq[i-1].label];
+				int pid = param.findObs(prev);
+				if (pid >= 0)
+					param.addCount(ev.label, pid, ev.fval * count);
+			}
+		}
+	}
 }
 
 }	///< namespace tricrf
@@ -10,6 +10,7 @@
 #include "Evaluator.h"
 #include "Utility.h"
 #include "LBFGS.h"
+#include "Chain.h"
 /// standard headers
 #include <cassert>
 #include <cfloat>
@@ -125,6 +126,7 @@ bool TriCRF2::loadModel(const std::string& filename) {
     string line;
     getline(f, line);
     while (line.empty() || line[0] == '#') {
+		readMetadata(count, line);
 		if (count == 1) {
 			vector<string> tok = tokenize(line);
 			if (tok.size() < 2 || tok[1] != "TriCRF2") {
@@ -149,25 +151,35 @@ bool TriCRF2::loadModel(const std::string& filename) {
 	f.close();
 	logger->report("  loading time = \t%.3f\n\n", stop_watch.elapsed());
 
+	prepareInference();
+
+	return true;
+}
+
+vector<Parameter*> TriCRF2::paramSections() {
+	vector<Parameter*> param(1, &m_ParamTopic);
+	param.push_back(&m_ParamSeq);
+	return param;
+}
+
+void TriCRF2::prepareInference() {
 	m_ParamTopic.makeStateIndex(false);
 	m_ParamSeq.makeStateIndex();
 	m_state_size = m_ParamSeq.sizeStateVec();
 	m_topic_size = m_ParamTopic.sizeStateVec();
 
 	createIndex();
-
-	return true;
 }
 
-/**	Read the data from file
+/**	Read the data from a stream
 */
-void TriCRF2::readTrainData(const string& filename) {
+void TriCRF2::readTrainData(istream& in) {
 
-	/// File stream
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	
 	/// initializing
 	TriSequence triseq;
@@ -237,15 +249,15 @@ void TriCRF2::readTrainData(const string& filename) {
 	m_topic_size = m_ParamTopic.sizeStateVec();
 }
 
-/**	Read the data from file
+/**	Read the data from a stream
 */
-void TriCRF2::readDevData(const string& filename) {
+void TriCRF2::readDevData(istream& in) {
 
-	/// File stream
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 	
 	/// initializing
 	TriSequence triseq;
@@ -418,80 +430,35 @@ void TriCRF2::calculateFactors(TriStringSequence &triseq) {
 	Computing and storing the alpha value.
 */
 void TriCRF2::forward() {
-	//m_Alpha.resize(m_topic_size* m_seq_size * m_state_size);
-	//fill(m_Alpha.begin(), m_Alpha.end(), 0.0);
 	m_Alpha.resize(m_topic_size);
 	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Alpha[z].resize(m_seq_size * m_zy_size[z]);
-		fill(m_Alpha[z].begin(), m_Alpha[z].end(), 0.0);
-	}
-
-	for (size_t z = 0; z < m_topic_size; z++) {
-		//for (size_t j = 0; j < m_state_size; j++) {
-		for (vector<StateParam>::iterator iter = m_y_state[z].begin(); iter != m_y_state[z].end(); ++iter) {
-			size_t j = iter->y2;
-			long double prob = m_R[MAT2(0, j)] * m_M[MAT2(m_default_oid, j)];
-			m_Alpha[z][TCRF2_MAT2(m_zy_size[z], 0, iter->y1)] += prob * m_Z[MAT2(z, j)];
+		if (m_ForwardTopics != NULL && !(*m_ForwardTopics)[z]) {	///< dropped by the topic cache
+			fill(m_Alpha[z].begin(), m_Alpha[z].end(), 0.0);
+			continue;
 		}
+		ReducedPotential pot(&m_R[0], &m_M[0], &m_Z[MAT2(z, 0)], m_state_size, m_zy_state[z], m_default_oid);
+		Chain<SumProduct>::forward(pot, m_seq_size, &m_Alpha[z][0]);
 	}
-
-	for (size_t z = 0; z < m_topic_size; z++) {
-		for (size_t i = 1; i < m_seq_size; i++) {
-			//for (size_t j = 0; j < m_state_size; j++) {
-			for (vector<StateParam>::iterator iter = m_y_state[z].begin(); iter != m_y_state[z].end(); ++iter) {
-				size_t j = iter->y2;
-				long double prob = m_R[MAT2(i, j)] * m_Z[MAT2(z, j)];
-				if (prob > 0) {
-					//for (size_t k = 0; k < m_state_size; k++) {
-					for (vector<StateParam>::iterator iter2 = m_y_state[z].begin(); iter2 != m_y_state[z].end(); ++iter2) {
-						size_t k = iter2->y2;
-						m_Alpha[z][TCRF2_MAT2(m_zy_size[z],i, iter->y1)] += 
-										m_Alpha[z][TCRF2_MAT2(m_zy_size[z], i-1, iter2->y1)] * m_M[MAT2(k, j)] * prob;
-					} ///< for k
-				} // if prob > 0
-			} ///< for j
-		}  ///< for i
-	}  ///< for z
-
 }
 
 /**	Backward Recursion.
 	Computing and storing the beta value.
 */
 void TriCRF2::backward() {
-	//m_Beta.resize(m_topic_size * m_seq_size * m_state_size);
-	//fill(m_Beta.begin(), m_Beta.end(), 0.0);
 	m_Beta.resize(m_topic_size);
 	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Beta[z].resize(m_seq_size * m_zy_size[z]);
 		fill(m_Beta[z].begin(), m_Beta[z].end(), 0.0);
-	}
-
-	for (size_t z = 0; z < m_topic_size; z++) {
 		m_Beta[z][TCRF2_MAT2(m_zy_size[z], m_seq_size-1, m_y_state[z][0].y1)] = 1.0;
 	}
 
 	//for (size_t z = 0; z < m_topic_size; z++) { // original
 	for (size_t prune = 0; prune < m_prune.size(); prune++) {
 		size_t z = m_prune[prune].second;
-
-		for (size_t i = m_seq_size-1; i >= 1; i--) {
-			//for (size_t k = 0; k < m_state_size; k++) {
-			for (vector<StateParam>::iterator iter = m_y_state[z].begin(); iter != m_y_state[z].end(); ++iter) {
-				size_t k = iter->y2;
-				long double prob = m_R[MAT2(i, k)] * m_Z[MAT2(z, k)]; 
-				if (prob > 0) {
-					//for (size_t j = 0; j < m_state_size; j++) {
-					for (vector<StateParam>::iterator iter2 = m_y_state[z].begin(); iter2 != m_y_state[z].end(); ++iter2) {
-						size_t j = iter2->y2;
-						m_Beta[z][TCRF2_MAT2(m_zy_size[z], i-1, iter2->y1)] += 
-										m_Beta[z][TCRF2_MAT2(m_zy_size[z], i, iter->y1)] * m_M[MAT2(j, k)] * prob;
-					} ///< for j
-				} ///< if prob > 0
-            } ///< for k
-        } ///< for i
-    } ///< for z
-
+		ReducedPotential pot(&m_R[0], &m_M[0], &m_Z[MAT2(z, 0)], m_state_size, m_zy_state[z], m_default_oid);
+		Chain<SumProduct>::backward(pot, m_seq_size, m_y_state[z][0].y1, &m_Beta[z][0]);
+	}
 }
 
 /**	Partition function (Z).
@@ -552,70 +519,42 @@ vector<size_t> TriCRF2::viterbiSearch(size_t& max_z, long double& prob) {
 	long double max_prob = -10000.0;
 	max_z = m_default_oid;
 	vector<size_t> max_y;
-
-	vector<size_t> psi_x(m_state_size) ;
-	vector<long double> delta_x(m_state_size);
-	fill(psi_x.begin(), psi_x.end(), m_state_size);
-	fill(delta_x.begin(), delta_x.begin(), 0.0);
+	vector<size_t> psi;
+	vector<long double> delta;
 
 	/// Search
 	///for (size_t z = 0; z < m_topic_size; z++) {
 	for (size_t prune = 0; prune < m_prune.size(); prune++) {
 		size_t z = m_prune[prune].second;
 
-		vector<vector<size_t> > psi;
-		vector<vector<long double> > delta;
-
-		for (size_t i=0; i < m_seq_size; i++) {
-			vector<size_t> psi_i= psi_x;
-			vector<long double> delta_i = delta_x;
-
-			//for (size_t j=0; j < m_state_size; j++) {
-			for (vector<StateParam>::iterator iter = m_y_state[z].begin(); iter != m_y_state[z].end(); ++iter) {
-				size_t j = iter->y2;
-				long double max = -10000.0;
-				size_t max_k = m_y_state[z][0].y2;
-				if (i == 0) {
-					max = m_R[MAT2(i, j)] * m_M[MAT2(m_default_oid, j)] * m_Z[MAT2(z, j)];
-					max_k = m_default_oid;
-				} else {
-					long double p = m_R[MAT2(i,j)] * m_Z[MAT2(z, j)];
-					//for (size_t k=0; k < m_state_size; k++) {
-					for (vector<StateParam>::iterator iter2 = m_y_state[z].begin(); iter2 != m_y_state[z].end(); ++iter2) {
-						size_t k = iter2->y2;
-						double val = delta[i-1][k] *  m_M[MAT2(k,j)] * p;
-						if (val > max) {
-							max = val;
-							max_k = k;
-						}
-					}
-				}
-				
-				delta_i[j] = max;
-				psi_i[j] = max_k;
-				//delta_i.push_back(max);
-				//psi_i.push_back(max_k);
-			}
-			delta.push_back(delta_i);
-			psi.push_back(psi_i);
-		} ///< for each i
-
-		/// Back-tracking
+		ReducedPotential pot(&m_R[0], &m_M[0], &m_Z[MAT2(z, 0)], m_state_size, m_zy_state[z], m_default_oid);
+		size_t end = m_y_state[z][0].y1;
 		vector<size_t> y_seq;
-		size_t prev_y = m_y_state[z][0].y2;
-		for (size_t i = m_seq_size-1; i >= 1; i--) {
-			//cout << prev_y << " " << psi[i][prev_y] << endl;
-			size_t y = psi[i][prev_y];
-			y_seq.push_back(y);
-			prev_y = y;
+		long double score;
+		if (z < m_Coarse.size() && m_Coarse[z].enabled() && m_Coarse[z].search(pot, m_seq_size, m_default_oid, end, y_seq, score)) {
+			double tmp_prob = score * m_Gamma[z];	///< coarse-to-fine (see CoarseToFine)
+			if (tmp_prob > max_prob) {
+				max_prob = tmp_prob;
+				max_z = z;
+				y_seq.pop_back();
+				max_y = y_seq;
+				for (size_t i = 0; i < max_y.size(); i++)
+					max_y[i] = m_zy_state[z][max_y[i]];
+			}
+			continue;
 		}
-		reverse(y_seq.begin(), y_seq.end());
-		double tmp_prob = delta[m_seq_size-1][m_y_state[z][0].y2] * m_Gamma[z];
-		
+		delta.resize(m_seq_size * m_zy_size[z]);
+		psi.resize(m_seq_size * m_zy_size[z]);
+		Chain<MaxProduct>::viterbi(pot, m_seq_size, &delta[0], &psi[0], m_default_oid);
+
+		/// Back-tracking (local -> global states)
+		double tmp_prob = delta[TCRF2_MAT2(m_zy_size[z], m_seq_size-1, end)] * m_Gamma[z];
 		if (tmp_prob > max_prob) {
 			max_prob = tmp_prob;
 			max_z = z;
-			max_y = y_seq;
+			max_y = chainBacktrack(&psi[0], m_seq_size, m_zy_size[z], end);
+			for (size_t i = 0; i < max_y.size(); i++)
+				max_y[i] = m_zy_state[z][max_y[i]];
 		}
 
 	} ///< for each z
@@ -624,10 +563,107 @@ vector<size_t> TriCRF2::viterbiSearch(size_t& max_z, long double& prob) {
 
 }
 
+/** Best path within the decoding budget (anytime decoding, see DecodeBudget).
+	Without a budget, it is the forward recursion, the topic pruning and the search over the remaining topics.
+	Otherwise the least probable topics are dropped, the topic is chosen by its own factor without
+	the forward recursion, or the labels are found greedily, whichever is predicted to fit the budget.
+	@param budget	decoding budget of the sequence
+	@param max_z	best topic
+	@return outcome sequence
+*/
+vector<size_t> TriCRF2::anytimeSearch(DecodeBudget& budget, size_t& max_z) {
+	/// work of the chain of each topic
+	vector<double> cells(m_topic_size);
+	double forward_cells = 0.0;
+	for (size_t z = 0; z < m_topic_size; z++) {
+		cells[z] = (double)m_seq_size * m_zy_size[z] * m_zy_size[z];
+		forward_cells += cells[z];
+	}
+	size_t best_z = max_element(m_Gamma.begin(), m_Gamma.end()) - m_Gamma.begin();
+
+	DecodeBudget::Level level;
+	if (budget.fits(forward_cells + cells[best_z])) {
+		wall_timer stop_watch;
+		forward();
+		getPartitionZ();
+		budget.measure(forward_cells, stop_watch.elapsed());
+
+		/// pruning
+		long double threshold = m_prune[0].first / m_prune_threshold;
+		vector<pair<long double, size_t> >::iterator pit = m_prune.begin();
+		for (; pit != m_prune.end(); pit++) {
+			if (pit->first < threshold) {
+				m_prune.erase(pit, m_prune.end());
+				break;
+			}
+		}
+
+		level = budget.trim(m_prune, cells);
+	} else {
+		/// topic by its own factor
+		m_prune.assign(1, make_pair((long double)1.0, best_z));
+		level = (budget.fits(cells[best_z]) ? DecodeBudget::TOPIC : DecodeBudget::GREEDY);
+	}
+
+	vector<size_t> y_seq;
+	long double prob;
+	if (level == DecodeBudget::GREEDY) {
+		max_z = m_prune[0].second;
+		y_seq = greedySearch(max_z, prob);
+	} else {
+		double search_cells = 0.0;
+		for (size_t i = 0; i < m_prune.size(); i++)
+			search_cells += cells[m_prune[i].second];
+		wall_timer stop_watch;
+		y_seq = viterbiSearch(max_z, prob);
+		budget.measure(search_cells, stop_watch.elapsed());
+	}
+	budget.finish(level);
+	return y_seq;
+}
+
+/** Greedy labeling of the chain of a topic (the cheapest fallback of anytime decoding).
+	@param z	topic
+	@param prob	unnormalized score of the path and the topic (comparable with that of viterbiSearch)
+	@return outcome sequence
+*/
+vector<size_t> TriCRF2::greedySearch(size_t z, long double& prob) {
+	ReducedPotential pot(&m_R[0], &m_M[0], &m_Z[MAT2(z, 0)], m_state_size, m_zy_state[z], m_default_oid);
+	vector<size_t> y_seq(m_seq_size);
+	prob = Chain<MaxProduct>::greedy(pot, m_seq_size, &y_seq[0], m_y_state[z][0].y1) * m_Gamma[z];
+	y_seq.pop_back();
+	for (size_t i = 0; i < y_seq.size(); i++)	///< local -> global states
+		y_seq[i] = m_zy_state[z][y_seq[i]];
+	return y_seq;
+}
+
+/** Greedy decoding (MEMM-style): each topic is labeled greedily, without the forward recursion,
+	and the topic of the best path score is taken. The work is T x S per topic instead of T x S x S.
+	@param max_z	best topic
+	@param prob	unnormalized score of the path
+	@return outcome sequence
+*/
+vector<size_t> TriCRF2::greedyTopicSearch(size_t& max_z, long double& prob) {
+	prob = -1.0;
+	max_z = m_default_oid;
+	vector<size_t> max_y;
+	for (size_t z = 0; z < m_topic_size; z++) {
+		long double tmp_prob;
+		vector<size_t> y_seq = greedySearch(z, tmp_prob);
+		if (tmp_prob > prob) {
+			prob = tmp_prob;
+			max_z = z;
+			max_y.swap(y_seq);
+		}
+	}
+	return max_y;
+}
+
 void TriCRF2::createIndex() {
 	/// Creating Z-Y indexes for reduced search space
 	/// todo: remove the makeStateIndex(z)
 	m_y_state.clear();
+	m_zy_state.clear();
 	m_zy_index.clear();
 	m_zy_size.clear();
 	m_zy_index.resize(m_topic_size);
@@ -643,6 +679,11 @@ void TriCRF2::createIndex() {
 			m_yz_index[z][iter->y1] = iter->y2;
 		}
 		m_y_state.push_back(y_state);
+
+		vector<size_t> zy_state(y_state.size());
+		for (vector<StateParam>::iterator iter = y_state.begin(); iter != y_state.end(); ++iter)
+			zy_state[iter->y1] = iter->y2;
+		m_zy_state.push_back(zy_state);
 	}
 }
 
@@ -682,6 +723,9 @@ bool TriCRF2::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 	m_ParamTopic.print(logger);
 	logger->report("  >>Parameters for sequence features\n");
 	m_ParamSeq.print(logger);
+	m_TopicCache = TopicCache(m_topic_cache, m_topic_cache_refresh, m_topic_cache_mass);
+	if (m_TopicCache.enabled())
+		logger->report("  Topic cache = \t%g x prune (refresh every %d, mass < %g)\n", m_topic_cache, m_topic_cache_refresh, m_topic_cache_mass);
 	logger->report("[Iterations]\n");
 	logger->report("%4s %15s %8s %8s %8s %8s\n", "iter", "loglikelihood", "acc", "micro-f1", "macro-f1", "sec");
 	
@@ -708,20 +752,26 @@ bool TriCRF2::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		eval2.initialize(); 
 
 		calculateEdge();
+		m_TopicCache.begin(niter, m_TrainSet.size(), m_topic_size);
 		
 		/// for each training set
         vector<TriSequence>::iterator it = m_TrainSet.begin();
 		vector<double>::iterator count_it = m_TrainSetCount.begin();
         for (; it != m_TrainSet.end(); ++it, ++count_it) {
 			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 			/// Forward-Backward  
 			timer stop_watch;
 			calculateFactors(*it);
 			time_for_factor += stop_watch.elapsed();
 			stop_watch.restart();
+			m_ForwardTopics = m_TopicCache.topics(it - m_TrainSet.begin());
   			forward();
+			m_ForwardTopics = NULL;
 			time_for_forward += stop_watch.elapsed();
 			long double zval = getPartitionZ();
+			m_TopicCache.update(it - m_TrainSet.begin(), m_prune, it->topic.label, m_prune_threshold);
 
 			////////////////////////////////////////////////////////////////////
 			/// pruning
@@ -919,20 +969,25 @@ bool TriCRF2::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 
 		/// Checking the end condition 
 		double diff = (niter == 0 ? 1.0 : abs(old_obj - eval2.getObjFunc()) / old_obj);
-		if (diff < eta) 
-			converge++;
-		else
+		if (diff < eta) {
+			if (!m_TopicCache.approximate())	///< converged on the full objective only
+				converge++;
+		} else
 			converge = 0;
 		old_obj = eval2.getObjFunc();
 		if (converge == 3)
 			break;
 		
 		/// LBFGS optimizer
+		if (m_TopicCache.restart())	///< the cached topics changed the objective
+			lbfgs.clear();
 		int ret = lbfgs.optimize(n_theta, theta, eval2.getObjFunc(), gradient, L1, sigma);
 		if (ret < 0)
 			return false;
-		else if (ret == 0)
+		else if (ret == 0) {
+			m_TopicCache.report(logger);
 			return true;
+		}
 		
 		/// Reporting the result
 		eval1.calculateF1();
@@ -960,6 +1015,7 @@ bool TriCRF2::estimateWithLBFGS(size_t max_iter, double sigma, bool L1, double e
 		m_ParamSeq.setWeight(&theta[m_ParamTopic.size()]);
 
 	} ///< for iter
+	m_TopicCache.report(logger);
 	
 	delete theta;
 	delete gradient;
@@ -1020,6 +1076,8 @@ bool TriCRF2::estimateWithPL(size_t max_iter, double sigma, bool L1, double eta)
 		vector<double>::iterator count_it = m_TrainSetCount.begin();
         for (; it != m_TrainSet.end(); ++it, ++count_it) {
 			double count = *count_it;
+			if (count == 0.0)	///< held out (cross-validation)
+				continue;
 
 
 			/////////////////////////////////////////////////////////////////////
@@ -1146,6 +1204,7 @@ bool TriCRF2::estimateWithPL(size_t max_iter, double sigma, bool L1, double eta)
 		Evaluator dev_eval2(m_ParamSeq);		///< Evaluator (sequence)
 		dev_eval1.initialize();	///< evaluator intialization
 		dev_eval2.initialize(); 
+		calculateEdge();	///< PL does not use the transition factors, but inference on the dev set does
 		stop_watch.restart();
 		double time_for_dev = 0.0;
 		/// for each dev data
@@ -1293,18 +1352,18 @@ bool TriCRF2::train(size_t max_iter, double sigma, bool L1) {
 		return estimateWithLBFGS(max_iter, sigma, L1);
 }
 
-bool TriCRF2::test(const std::string& filename, const std::string& outputfile, bool confidence) {
-	/// File stream
+bool TriCRF2::test(istream& in, ostream* output, bool confidence) {
+	/// Data stream
 	string line;
-	ifstream f(filename.c_str());
+	DataStream f(in, m_Gazetteer);
 	if (!f)
-		throw runtime_error("cannot open data file");
+		throw runtime_error("cannot read data stream");
 
 	/// output
-	ofstream out;
+	ostream null_out(NULL);
+	ostream& out = (output != NULL ? *output : null_out);
 	vector<string> state_vec, seq_state_vec;
-	if (outputfile != "") {
-		out.open(outputfile.c_str());
+	if (output != NULL) {
 		out.precision(20);
 		state_vec = m_ParamTopic.getState().second;
 		seq_state_vec = m_ParamSeq.getState().second;
@@ -1322,38 +1381,57 @@ bool TriCRF2::test(const std::string& filename, const std::string& outputfile, b
 	size_t seq_count = 0;
 
 	calculateEdge();
+	if (m_coarse_prune > 0.0) {
+		vector<string> labels = m_ParamSeq.getState().second;
+		m_Coarse.assign(m_topic_size, CoarseToFine(m_coarse_prune, m_coarse_exact));
+		for (size_t z = 0; z < m_topic_size; z++) {
+			vector<string> topic_labels;
+			for (size_t s = 0; s < m_zy_state[z].size(); s++)
+				topic_labels.push_back(labels[m_zy_state[z][s]]);
+			m_Coarse[z].build(topic_labels, m_coarse_map);
+			m_Coarse[z].bound(ReducedPotential(NULL, &m_M[0], NULL, m_state_size, m_zy_state[z], m_default_oid));
+		}
+	}
+
+	DecodeBudget budget(m_decode_budget);
+	DecoderComparison compare(m_ParamSeq);
 
 	/// reading the text
 	while (getline(f,line)) {
 		vector<string> tokens = tokenize(line, " \t");
 		if (line.empty()) {
 			/// test
+			budget.start();
 			calculateFactors(triseq);
-  			forward();
-			long double zval = getPartitionZ();
-            long double dummy_prob;
-
-			////////////////////////////////////////////////////////////////////
-			/// pruning
-			////////////////////////////////////////////////////////////////////
-			long double threshold = m_prune[0].first / m_prune_threshold;
-			vector<pair<long double, size_t> >::iterator pit = m_prune.begin();
-			for (; pit != m_prune.end(); pit++) {
-				if (pit->first < threshold) {
-					m_prune.erase(pit, m_prune.end());
-					break;
+			size_t max_z, other_z = 0;
+			vector<size_t> y_seq, y_other;
+			double seconds[2] = { 0.0, 0.0 };	///< search time of the Viterbi and the greedy decoding
+			wall_timer search_watch;
+			if (m_greedy) {
+				long double prob;
+				y_seq = greedyTopicSearch(max_z, prob);
+				budget.finish(DecodeBudget::GREEDY);
+			} else
+				y_seq = anytimeSearch(budget, max_z);
+			assert(y_seq.size() == triseq.size());
+			if (m_compare_decoders) {
+				seconds[m_greedy ? 1 : 0] = search_watch.elapsed();
+				wall_timer other_watch;
+				if (m_greedy) {
+					DecodeBudget unlimited;
+					y_other = anytimeSearch(unlimited, other_z);
+				} else {
+					long double prob;
+					y_other = greedyTopicSearch(other_z, prob);
 				}
+				seconds[m_greedy ? 0 : 1] = other_watch.elapsed();
 			}
 
-			size_t max_z;
-			vector<size_t> y_seq = viterbiSearch(max_z, dummy_prob);
-			assert(y_seq.size() == triseq.size());
-
 			vector<size_t> reference1, hypothesis1;
 			reference1.push_back(triseq.topic.label);
 			hypothesis1.push_back(max_z);
 			test_eval1.append(reference1, hypothesis1);
-			if (outputfile != "") {
+			if (output != NULL) {
 				out << state_vec[max_z];
 				/*
 				if (confidence) {
@@ -1379,7 +1457,7 @@ bool TriCRF2::test(const std::string& filename, const std::string& outputfile, b
 				reference.push_back(outcome_s);
 				hypothesis.push_back(y_seq_s);
 
-				if (outputfile != "") {
+				if (output != NULL) {
 					out << y_seq_s;
 					/*
 					if (confidence) {
@@ -1394,10 +1472,17 @@ bool TriCRF2::test(const std::string& filename, const std::string& outputfile, b
 					out << endl; 
 				}
 			}
-			if (outputfile != "")
+			if (output != NULL)
 				out << endl;
 
 			test_eval2.append(m_ParamSeq, reference, hypothesis);	
+			if (m_compare_decoders) {
+				vector<string> other;
+				for (size_t i = 0; i < y_other.size(); i++)
+					other.push_back(m_ParamSeq.getState().second[y_other[i]]);
+				compare.append(reference, m_greedy ? other : hypothesis, m_greedy ? hypothesis : other, seconds[0], seconds[1]);
+				compare.appendTopic(triseq.topic.label, m_greedy ? other_z : max_z, m_greedy ? max_z : other_z);
+			}
 
 			triseq.seq.clear();
 			seq_count = 0;
@@ -1420,6 +1505,10 @@ bool TriCRF2::test(const std::string& filename, const std::string& outputfile, b
 	test_eval2.calculateF1();
 	logger->report("  # of data = \t\t%d\n", count);
 	logger->report("  testing time = \t%.3f\n\n", stop_watch.elapsed());
+	budget.report(logger);
+	reportCoarse();
+	if (m_compare_decoders)
+		compare.report(logger);
 	logger->report("  Topic Classification \n");
 	logger->report("  Acc = \t\t%8.3f\n", test_eval1.getAccuracy());
 	logger->report("  MicroF1 = \t\t%8.3f\n", test_eval1.getMicroF1()[2]);
@@ -1428,6 +1517,99 @@ bool TriCRF2::test(const std::string& filename, const std::string& outputfile, b
 	logger->report("  Acc = \t\t%8.3f\n", test_eval2.getAccuracy());
 	logger->report("  MicroF1 = \t\t%8.3f\n", test_eval2.getMicroF1()[2]);
 	logger->report("  MacroF1 = \t\t%8.3f\n", test_eval2.getMacroF1()[2]);
+
+	return true;
+}
+
+/** Evaluate the current weights on the dev set.
+	@return topic accuracy, and accuracy and F1 scores of sequence labeling (zero if there is no dev data)
+*/
+Score TriCRF2::evaluateDev() {
+	Score score;
+	if (m_DevSet.size() == 0)
+		return score;
+
+	DecodeBudget budget;
+	calculateEdge();
+	Evaluator dev_eval1(m_ParamTopic, false);		///< Evaluator (topic)
+	Evaluator dev_eval2(m_ParamSeq);		///< Evaluator (sequence)
+	dev_eval1.initialize();
+	dev_eval2.initialize();
+	Data<TriSequence>::iterator it = m_DevSet.begin();
+	vector<double>::iterator count_it = m_DevSetCount.begin();
+	for (; it != m_DevSet.end(); ++it, ++count_it) {
+		calculateFactors(*it);
+		size_t max_z;
+		vector<size_t> y_seq = anytimeSearch(budget, max_z);	///< as in test, without a budget
+		assert(y_seq.size() == it->seq.size());
+
+		vector<size_t> reference, hypothesis;
+		for (size_t i = 0; i < it->seq.size(); ++i) {
+			reference.push_back(it->seq[i].label);
+			hypothesis.push_back(y_seq[i]);
+		}
+		vector<size_t> reference1, hypothesis1;
+		reference1.push_back(it->topic.label);
+		hypothesis1.push_back(max_z);
+		for (size_t c = 0; c < *count_it; c++) {
+			dev_eval2.append(reference, hypothesis);
+			dev_eval1.append(reference1, hypothesis1);
+		}
+	}
+	dev_eval1.calculateF1();
+	dev_eval2.calculateF1();
+
+	score.topic_accuracy = dev_eval1.getAccuracy();
+	score.accuracy = dev_eval2.getAccuracy();
+	score.micro_f1 = dev_eval2.getMicroF1()[2];
+	score.macro_f1 = dev_eval2.getMacroF1()[2];
+	return score;
+}
+
+/** Hold out a part of the training data as the dev set (e.g. a cross-validation fold).
+	@param held_out	unique training sequences to be held out
+*/
+void TriCRF2::holdOut(const vector<bool>& held_out) {
+	holdOutData(m_TrainSet, m_TrainSetCount, held_out, m_DevSet, m_DevSetCount);
+	recount();
+}
+
+/** Recount the empirical feature counts of the training set.
+	@warning	Events do not keep the values of "feature:value" observations, so the label value is used.
+*/
+void TriCRF2::recount() {
+	m_ParamTopic.clearCount();
+	m_ParamSeq.clearCount();
+	vector<string> topics = m_ParamTopic.getState().second;
+	vector<string> states = m_ParamSeq.getState().second;
+
+	for (size_t n = 0; n < m_TrainSet.size(); ++n) {
+		double count = m_TrainSetCount[n];
+		if (count == 0.0)
+			continue;
+		TriSequence& triseq = m_TrainSet[n];
+		/// topic features
+		vector<pair<size_t, double> >::iterator obs = triseq.topic.obs.begin();
+		for (; obs != triseq.topic.obs.end(); ++obs)
+			m_ParamTopic.addCount(triseq.topic.label, obs->first, triseq.topic.fval * count);
+
+		int topic_pid = m_ParamTopic.findObs("@" + topics[triseq.topic.label]);
+		for (size_t i = 0; i < triseq.seq.size(); ++i) {
+			Event& ev = triseq.seq[i];
+			/// sequence features
+			for (obs = ev.obs.begin(); obs != ev.obs.end(); ++obs)
+				m_ParamSeq.addCount(ev.label, obs->first, ev.fval * count);
+			/// state transition features
+			if (i > 0) {
+				int pid = m_ParamSeq.findObs("@" + states[triseq.seq[i-1].label]);
+				if (pid >= 0)
+					m_ParamSeq.addCount(ev.label, pid, ev.fval * count);
+			}
+			/// topic-sequence state features
+			if (topic_pid >= 0)
+				m_ParamTopic.addCount(ev.label, topic_pid, ev.fval * count);
+		}
+	}
 }
 
 }	///< namespace tricrf
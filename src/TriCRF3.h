@@ -9,7 +9,7 @@
 #define __TRICRF3_H__
 
 /// max headers
-#include "CRF.h"
+#include "TriCRF.h"
 /// standard headers
 #include <vector>
 #include <string>
@@ -20,7 +20,7 @@ namespace tricrf {
 /** Triangular-chain Conditional Random Fields (Model3).
 	@class TriCRF3
 */
-class TriCRF3 : public CRF {
+class TriCRF3 : public TriCRF {
 protected:
 	/// Data sets
 	Data<TriStringSequence> m_TrainSet;	 ///< Train data
@@ -53,19 +53,28 @@ protected:
 	long double getPartitionZ();	///< Z
 	long double calculateProb(TriStringSequence& seq);	///< Prob(y|x)
 	std::vector<size_t> viterbiSearch(size_t& max_z, long double& prob);	///< Find the best path
+	std::vector<size_t> anytimeSearch(DecodeBudget& budget, size_t& max_z);	///< Find the best path within the budget
+	std::vector<size_t> greedySearch(size_t z, long double& prob);	///< Greedy labeling of a topic
+	std::vector<size_t> greedyTopicSearch(size_t& max_z, long double& prob);	///< Greedy labeling of the best topic
 
 	/// Parameter Estimation
 	bool estimateWithLBFGS(size_t max_iter, double sigma, bool L1 = false, double eta = 1E-05);
 	bool estimateWithPL(size_t max_iter, double sigma, bool L1 = false, double eta = 1E-05);
-	virtual bool averageParam() {};
+	virtual bool averageParam() { return true; };
+	void recount();
+	std::vector<Parameter*> paramSections();
+	void prepareInference();
 	
 public:
 	TriCRF3();
 	TriCRF3(Logger *logger);
 	
 	/// Data manipulation
-	void readTrainData(const std::string& filename);
-	void readDevData(const std::string& filename);
+	using CRF::readTrainData;
+	using CRF::readDevData;
+	void readTrainData(std::istream& in);
+	void readDevData(std::istream& in);
+	void holdOut(const std::vector<bool>& held_out);
 
 	/// Model 
 	bool loadModel(const std::string& filename);
@@ -78,7 +87,9 @@ public:
 	bool train(size_t max_iter = 100, double sigma = 20, bool L1 = false); 
 
 	/// Testing
-	bool test(const std::string& filename, const std::string& outputfile = "", bool confidence = false);	
+	using CRF::test;
+	bool test(std::istream& in, std::ostream* output = NULL, bool confidence = false);
+	Score evaluateDev();
 	
 	Parameter& getTopicParam() { return m_ParamTopic; };
 	std::vector<Parameter>& getSeqParam() { return m_ParamSeq; };
@@ -90,11 +90,13 @@ int Logger::report(const char *fmt, ...) {
 		va_list argptr;
 		va_start(argptr, fmt);
 		ret = vfprintf(m_File, fmt, argptr);
+		va_end(argptr);
 		/// standard out
 		if (m_Level > 1) {
+			va_start(argptr, fmt);
 			vfprintf(stderr, fmt, argptr);
+			va_end(argptr);
 		}
-		va_end(argptr);
 	}
 	fflush(m_File);
 
@@ -114,10 +116,12 @@ int Logger::report(size_t level, const char *fmt, ...) {
 		va_list argptr;
 		va_start(argptr, fmt);
 		ret = vfprintf(m_File, fmt, argptr);
+		va_end(argptr);
 		if (level > 1) {
+			va_start(argptr, fmt);
 			vfprintf(stderr, fmt, argptr);
+			va_end(argptr);
 		}
-		va_end(argptr);
 	}
 	fflush(m_File);
 
@@ -150,6 +154,8 @@ bool Configurator::parse(const string& filename) {
 				throw runtime_error("invalid configuration file");
 			vector<string> values;
 			for (size_t i = 1; i < tokens.size(); i++) {
+				if (tokens[i][0] == '#')	///< trailing comment
+					break;
 				if (tokens[i].find("[") != string::npos) {
 					vector<string> tok = tokenize(tokens[i], "[-]");
 					if (tok.size() < 3)
@@ -161,6 +167,8 @@ bool Configurator::parse(const string& filename) {
 					}
 				} else
 					values.push_back(tokens[i]);			}
+			if (values.empty())
+				throw runtime_error("invalid configuration file");
 			config.insert(make_pair(tokens[0], values));
 		}
 	}
@@ -19,6 +19,7 @@
 #include <fstream>
 #include <stdarg.h>
 #include <limits>
+#include <sys/time.h>
 
 namespace tricrf {
 
@@ -74,6 +75,20 @@ private:
 	std::clock_t _start_time;
 }; // timer
 
+/// wall-clock timer (timer measures the processor time of this process only)
+class wall_timer {
+ public:
+	wall_timer() { restart(); }
+	void   restart() { gettimeofday(&_start_time, NULL); }
+	double elapsed() const { 
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		return double(now.tv_sec - _start_time.tv_sec) + double(now.tv_usec - _start_time.tv_usec) / 1E6;
+	}
+private:
+	struct timeval _start_time;
+}; // wall_timer
+
 /// finite testing function
 #if defined(_MSC_VER) || defined(__BORLANDC__)
 inline int finite(double x) { return _finite(x); }